@@ -21,6 +21,8 @@
 
 #include "bpp.h"
 
+#define PI  3.1415926535897932384626433832795
+
 static char buffer[LINEALLOC];
 static char * line = NULL;
 static size_t line_size = 0;
@@ -100,75 +102,57 @@ static char * getnextline(FILE * fp)
   return line;
 }
 
+/* the following two functions parse a value in place, as they are called
+   for every column of every sample */
 static long get_long(const char * line, long * value)
 {
-  int ret,len=0;
   size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
+  char * endptr;
 
   /* skip all white-space */
-  ws = strspn(p, " \t\r\n");
+  ws = strspn(line, " \t\r\n");
 
   /* is it a blank line or comment ? */
-  if (!p[ws] || p[ws] == '*' || p[ws] == '#')
-  {
-    free(s);
+  if (!line[ws] || line[ws] == '*' || line[ws] == '#')
     return 0;
-  }
 
   /* store address of value's beginning */
-  char * start = p+ws;
+  const char * start = line+ws;
 
   /* skip all characters except star, hash and whitespace */
-  char * end = start + strcspn(start," \t\r\n*#");
-
-  *end = 0;
+  const char * end = start + strcspn(start," \t\r\n*#");
 
-  ret = sscanf(start, "%ld%n", value, &len);
-  if ((ret == 0) || (((unsigned int)(len)) < strlen(start)))
-  {
-    free(s);
+  /* the value must span the whole token */
+  *value = strtol(start,&endptr,10);
+  if (endptr != end)
     return 0;
-  }
 
-  free(s);
   return ws + end - start;
 }
 
 static long get_double(const char * line, double * value)
 {
-  int ret,len=0;
   size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
+  char * endptr;
 
   /* skip all white-space */
-  ws = strspn(p, " \t\r\n");
+  ws = strspn(line, " \t\r\n");
 
   /* is it a blank line or comment ? */
-  if (!p[ws] || p[ws] == '*' || p[ws] == '#')
-  {
-    free(s);
+  if (!line[ws] || line[ws] == '*' || line[ws] == '#')
     return 0;
-  }
 
   /* store address of value's beginning */
-  char * start = p+ws;
+  const char * start = line+ws;
 
   /* skip all characters except star, hash and whitespace */
-  char * end = start + strcspn(start," \t\r\n*#");
-
-  *end = 0;
+  const char * end = start + strcspn(start," \t\r\n*#");
 
-  ret = sscanf(start, "%lf%n", value, &len);
-  if ((ret == 0) || (((unsigned int)(len)) < strlen(start)))
-  {
-    free(s);
+  /* the value must span the whole token */
+  *value = strtod(start,&endptr);
+  if (endptr != end)
     return 0;
-  }
 
-  free(s);
   return ws + end - start;
 }
 
@@ -182,44 +166,166 @@ static int cb_cmp_double(const void * a, const void * b)
   return 0;
 }
 
+/* in-place radix-2 FFT of m (power of two) complex values stored as
+   interleaved real and imaginary parts. w holds the first size/2 powers of
+   exp(-2*pi*i/size) for some size that is a multiple of m. The inverse
+   transform (sign = 1) is not scaled */
+static void fft(double * x, long m, const double * w, long size, int sign)
+{
+  long i,j,k,len;
+
+  /* bit-reversal permutation */
+  for (i = 1, j = 0; i < m; ++i)
+  {
+    long bit = m >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      SWAP(x[2*i],x[2*j]);
+      SWAP(x[2*i+1],x[2*j+1]);
+    }
+  }
+
+  for (len = 2; len <= m; len <<= 1)
+  {
+    long half = len >> 1;
+    long step = size / len;
+
+    for (i = 0; i < m; i += len)
+    {
+      double * a = x + 2*i;
+      double * b = x + 2*(i+half);
+
+      for (k = 0; k < half; ++k)
+      {
+        double wr = w[2*k*step];
+        double wi = -sign * w[2*k*step+1];
+
+        double tr = b[2*k]*wr - b[2*k+1]*wi;
+        double ti = b[2*k]*wi + b[2*k+1]*wr;
+
+        b[2*k]   = a[2*k] - tr;
+        b[2*k+1] = a[2*k+1] - ti;
+        a[2*k]   += tr;
+        a[2*k+1] += ti;
+      }
+    }
+  }
+}
+
+/* replace the first n elements of x (size elements, zero-padded) by the
+   autocovariances sum_j x[j]*x[j+lag]. The real series is transformed as a
+   complex series of half length, and its power spectrum is transformed back
+   in the same way */
+static void autocovariance(double * x, long size, double * w, double * power)
+{
+  long k;
+  long m = size/2;
+
+  fft(x,m,w,size,-1);
+
+  /* power spectrum of the real series for frequencies 0..m */
+  for (k = 0; k <= m; ++k)
+  {
+    double a = x[2*(k%m)];
+    double b = x[2*(k%m)+1];
+    double c = x[2*((m-k)%m)];
+    double d = x[2*((m-k)%m)+1];
+
+    double wr = (k < m) ? w[2*k] : -1;
+    double wi = (k < m) ? w[2*k+1] : 0;
+
+    double er = (a+c)/2, ei = (b-d)/2;
+    double or = (b+d)/2, oi = (c-a)/2;
+
+    double xr = er + wr*or - wi*oi;
+    double xi = ei + wr*oi + wi*or;
+
+    power[k] = xr*xr + xi*xi;
+  }
+
+  /* pack the real and even spectrum for the inverse transform */
+  for (k = 0; k < m; ++k)
+  {
+    double sum = power[k] + power[m-k];
+    double diff = power[k] - power[m-k];
+
+    x[2*k]   = (sum + diff*w[2*k+1]) / 2;
+    x[2*k+1] = diff*w[2*k] / 2;
+  }
+
+  fft(x,m,w,size,1);
+
+  for (k = 0; k < size; ++k)
+    x[k] /= m;
+}
+
+/* length of the zero-padded series for n samples, which avoids circular
+   correlation */
+static long fft_length(long n)
+{
+  long size;
+
+  for (size = 2; size < 2*n; size <<= 1);
+
+  return size;
+}
+
+/* bytes of scratch space allocated by eff_ict for n samples */
+static size_t eff_ict_scratch(long n)
+{
+  long size = fft_length(n);
+
+  return (size_t)(2*size + size/2 + 1) * sizeof(double);
+}
+
 static double eff_ict(double * y, long n, double mean, double stdev)
 {
   /* This calculates Efficiency or Tint using Geyer's (1992) initial positive
-     sequence method */
+     sequence method. Autocorrelations are computed with FFT */
 
-  long i,j;
+  long i;
+  long size;
   double tint = 1;
   double rho, rho0 = 0;
 
-  /* TODO: ADDED NOW */
-  double * x = (double *)xmalloc((size_t)n * sizeof(double));
-  for (i = 0; i < n; ++i)
-    x[i] = (y[i]-mean)/stdev;
+  if (stdev/(fabs(mean)+1) < 1E-9)
+    return n;
 
+  size = fft_length(n);
 
-  if (stdev/(fabs(mean)+1) < 1E-9)
+  double * x = (double *)xcalloc((size_t)size, sizeof(double));
+  double * w = (double *)xmalloc((size_t)size * sizeof(double));
+  double * power = (double *)xmalloc((size_t)(size/2+1) * sizeof(double));
+
+  for (i = 0; i < size/2; ++i)
   {
-   tint = n;
+    w[2*i]   = cos(-2*PI*i/size);
+    w[2*i+1] = sin(-2*PI*i/size);
   }
-  else
-  {
-    for (i = 1; i < n-10; ++i)
-    {
-      rho = 0;
-      for (j = 0; j < n - i; ++j)
-        rho += x[j]*x[i+j];
 
-      rho /= (n-1);
+  for (i = 0; i < n; ++i)
+    x[i] = (y[i]-mean)/stdev;
 
-      if (i > 10 && rho+rho0 < 0)
-        break;
+  autocovariance(x,size,w,power);
 
-      tint += rho*2;
-      rho0 = rho;
-    }
+  for (i = 1; i < n-10; ++i)
+  {
+    rho = x[i] / (n-1);
+
+    if (i > 10 && rho+rho0 < 0)
+      break;
+
+    tint += rho*2;
+    rho0 = rho;
   }
 
   free(x);
+  free(w);
+  free(power);
 
   return tint;
 }
@@ -360,65 +466,34 @@ static void write_figtree(stree_t * stree,
   return;
 }
 
-void allfixed_summary(FILE * fp_out, stree_t * stree)
+/* per-column summary statistics */
+typedef struct colstats_s
 {
-  long i,j,count;
+  double ** matrix;
+  long first;
+  double * mean;
+  double * stdev;
+  double * tint;
+  double * median;
+  double * min;
+  double * max;
+  double * q025;
+  double * q975;
+  double * hpd025;
+  double * hpd975;
+} colstats_t;
+
+/* read the columns with a non-NULL entry in matrix from the text MCMC file.
+   Returns the number of records read or -1 on error */
+static long load_columns(FILE * fp, long col_count, double ** matrix, int verbose)
+{
+  long i,count;
   long sample_num;
-  long rc = 0;
-  FILE * fp;
-
-  /* TODO: pretty-fy output */
-
-  fp = xopen(opt_mcmcfile,"r");
-
-  /* skip line containing header */
-  getnextline(fp);
-  assert(strlen(line) > 4);
-  char * header = xstrdup(line);
-
-  /* compute number of columns in the file */
-  long col_count = 0;
-
-  /* compute number of theta parameters */
-  if (opt_est_theta)
-    for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
-      if (stree->nodes[i]->theta >= 0)
-        col_count++;
-
-  /* compute number of tau parameters */
-  for (i = 0; i < stree->inner_count; ++i)
-    if (stree->nodes[stree->tip_count+i]->tau)
-      col_count++;
-
-  if (opt_est_locusrate && opt_print_locusrate)
-    col_count += opt_locus_count;
-
-  if (opt_est_heredity && opt_print_hscalars)
-    col_count += opt_locus_count;
-
-  /* add one more for log-L if usedata is on */
-  if (opt_usedata)
-    col_count++;
-
-
-  /* allocate storage matrix */
-  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
-  for (i = 0; i < col_count; ++i)
-    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
-
-  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
-
-  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
-
   long line_count = 0;
   long bad_count = 0;
   long lineno = 0;
   long prevbad = 0;
 
-  /* read data line by line and store in matrix */
   while (getnextline(fp))
   {
     double x;
@@ -428,7 +503,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
 
     /* skip sample number */
     count = get_long(p,&sample_num);
-    if (!count) goto l_unwind;
+    if (!count) return -1;
 
     p += count;
 
@@ -448,13 +523,14 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
             fprintf(stderr,
                     "ERROR: Found two consecutive records with mismatching "
                     "number of columns (lines %ld and %ld)\n", lineno-1,lineno);
-          goto l_unwind;
+          return -1;
         }
         else
         {
-          fprintf(stderr,
-                  "WARNING: Found and ignored record with mismatching number "
-                  "of columns (line %ld)\n", lineno);
+          if (verbose)
+            fprintf(stderr,
+                    "WARNING: Found and ignored record with mismatching number "
+                    "of columns (line %ld)\n", lineno);
           prevbad = 1;
           assert(line_count > 0);
           bad_count++;
@@ -464,7 +540,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
 
       p += count;
 
-      matrix[i][line_count] = x;
+      if (matrix[i])
+        matrix[i][line_count] = x;
     }
     if (i == col_count)
     {
@@ -472,195 +549,238 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
       prevbad = 0;
     }
   }
-  assert(line_count > 0);
-  if (bad_count)
+  if (bad_count && verbose)
     fprintf(stderr, "Skipped a total of %ld erroneous records...\n", bad_count);
 
-  fprintf(stdout, "          %s\n", header+4);
-  fprintf(fp_out, "          %s\n", header+4);
-  free(header);
+  return line_count;
+}
 
+static void cb_summarize_column(long index, void * data)
+{
+  long j;
+  colstats_t * cs = (colstats_t *)data;
+  long i = cs->first + index;
+  double * x = cs->matrix[i];
 
-  /* compute means */
-  fprintf(stdout, "mean    ");
-  fprintf(fp_out, "mean    ");
-  for (i = 0; i < col_count; ++i)
-  {
-    double sum = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sum += matrix[i][j];
+  /* mean and standard deviation */
+  double sum = 0;
+  for (j = 0; j < opt_samples; ++j)
+    sum += x[j];
+  cs->mean[i] = sum/opt_samples;
 
-    mean[i] = sum/opt_samples;
-    fprintf(stdout, "  %f", mean[i]);
-    fprintf(fp_out, "  %f", mean[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  double sd = 0;
+  for (j = 0; j < opt_samples; ++j)
+    sd += (x[j]-cs->mean[i]) * (x[j]-cs->mean[i]);
+  cs->stdev[i] = sqrt(sd/(opt_samples-1));
 
-  /* compute standard deviation */
-  for (i = 0; i < col_count; ++i)
-  {
-    double sd = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sd += (matrix[i][j]-mean[i]) * (matrix[i][j]-mean[i]);
+  cs->tint[i] = eff_ict(x,opt_samples,cs->mean[i],cs->stdev[i]);
 
-    stdev[i] = sqrt(sd/(opt_samples-1));
-  }
-  
-  /* compute tint */
-  for (i = 0; i < col_count; ++i)
-    tint[i] = eff_ict(matrix[i],opt_samples,mean[i],stdev[i]);
+  /* order statistics */
+  qsort(x, opt_samples, sizeof(double), cb_cmp_double);
 
-  /* compute and print medians */
-  fprintf(stdout, "median  ");
-  fprintf(fp_out, "median  ");
   long median_line = opt_samples / 2;
-
-  for (i = 0; i < col_count; ++i)
+  cs->median[i] = x[median_line];
+  if ((opt_samples & 1) == 0)
   {
-    qsort(matrix[i], opt_samples, sizeof(double), cb_cmp_double);
+    cs->median[i] += x[median_line-1];
+    cs->median[i] /= 2;
+  }
 
-    double median = matrix[i][median_line];
-    if ((opt_samples & 1) == 0)
-    {
-      median += matrix[i][median_line-1];
-      median /= 2;
-    }
+  cs->min[i] = x[0];
+  cs->max[i] = x[opt_samples-1];
+  cs->q025[i] = x[(long)(opt_samples*.025)];
+  cs->q975[i] = x[(long)(opt_samples*.975)];
 
-    fprintf(stdout, "  %f", median);
-    fprintf(fp_out, "  %f", median);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  hpd_interval(x,opt_samples,cs->hpd025+i,cs->hpd975+i,0.05);
+}
 
-  /* print standard deviation */
-  fprintf(stdout, "S.D     ");
-  fprintf(fp_out, "S.D     ");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", stdev[i]);
-    fprintf(fp_out, "  %f", stdev[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+static void print_row(FILE * fp_out,
+                      const char * label,
+                      const double * x,
+                      long col_count)
+{
+  long i;
 
-  /* print minimum values */
-  fprintf(stdout, "min     ");
-  fprintf(fp_out, "min     ");
+  fprintf(stdout, "%s", label);
+  fprintf(fp_out, "%s", label);
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", matrix[i][0]);
-    fprintf(fp_out, "  %f", matrix[i][0]);
+    fprintf(stdout, "  %f", x[i]);
+    fprintf(fp_out, "  %f", x[i]);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
+}
 
-  /* print maximum values */
-  fprintf(stdout, "max     ");
-  fprintf(fp_out, "max     ");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][opt_samples-1]);
-    fprintf(fp_out, "  %f", matrix[i][opt_samples-1]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+void allfixed_summary(FILE * fp_out, stree_t * stree)
+{
+  long i,j;
+  long rc = 0;
+  FILE * fp = NULL;
+  char * header = NULL;
+  int binary = mcmcbin_detect(opt_mcmcfile);
+  colstats_t cs;
 
-  /* print line at 2.5% of matrix */
-  fprintf(stdout, "2.5%%    ");
-  fprintf(fp_out, "2.5%%    ");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.025)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.025)]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  /* TODO: pretty-fy output */
 
-  /* print line at 97.5% of matrix */
-  fprintf(stdout, "97.5%%   ");
-  fprintf(fp_out, "97.5%%   ");
-  for (i = 0; i < col_count; ++i)
+  if (!binary)
   {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.975)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.975)]);
+    fp = xopen(opt_mcmcfile,"r");
+
+    /* skip line containing header */
+    getnextline(fp);
+    assert(strlen(line) > 4);
+    header = xstrdup(line);
   }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
 
-  /* compute and print HPD 2.5% and 97.5% */
-  for (i = 0; i < col_count; ++i)
-    hpd_interval(matrix[i],opt_samples,hpd025+i,hpd975+i,0.05);
+  /* compute number of columns in the file */
+  long col_count = 0;
 
-  /* print 2.5% HPD */
-  fprintf(stdout, "2.5%%HPD ");
-  fprintf(fp_out, "2.5%%HPD ");
-  for (i = 0; i < col_count; ++i)
+  /* compute number of theta parameters */
+  if (opt_est_theta)
+    for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+      if (stree->nodes[i]->theta >= 0)
+        col_count++;
+
+  /* compute number of tau parameters */
+  for (i = 0; i < stree->inner_count; ++i)
+    if (stree->nodes[stree->tip_count+i]->tau)
+      col_count++;
+
+  if (opt_est_locusrate && opt_print_locusrate)
+    col_count += opt_locus_count;
+
+  if (opt_est_heredity && opt_print_hscalars)
+    col_count += opt_locus_count;
+
+  /* add one more for log-L if usedata is on */
+  if (opt_usedata)
+    col_count++;
+
+  /* columns are summarized in batches that fit in the memory budget, reading
+     the MCMC file once per batch. The budget also covers the FFT scratch
+     space of each thread */
+  size_t col_size = (size_t)opt_samples * sizeof(double);
+  long batch = col_count;
+  if (opt_summary_memory)
   {
-    fprintf(stdout, "  %f", hpd025[i]);
-    fprintf(fp_out, "  %f", hpd025[i]);
+    size_t budget = (size_t)opt_summary_memory*1024*1024;
+    size_t scratch = (size_t)threads_get_count() * eff_ict_scratch(opt_samples);
+
+    budget = (budget > scratch) ? budget - scratch : 0;
+    batch = (long)(budget / col_size);
+    batch = MAX(MIN(batch,col_count),1);
   }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
 
-  /* print 97.5% HPD */
-  fprintf(stdout, "97.5%%HPD");
-  fprintf(fp_out, "97.5%%HPD");
-  for (i = 0; i < col_count; ++i)
+  double ** matrix = (double **)xcalloc((size_t)col_count, sizeof(double *));
+  double ** buffers = (double **)xmalloc((size_t)batch * sizeof(double *));
+  for (i = 0; i < batch; ++i)
+    buffers[i] = (double *)xmalloc(col_size);
+
+  cs.matrix = matrix;
+  cs.mean = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.tint = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.median = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.min = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.max = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.q025 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.q975 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  cs.hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
+
+  for (cs.first = 0; cs.first < col_count; cs.first += batch)
   {
-    fprintf(stdout, "  %f", hpd975[i]);
-    fprintf(fp_out, "  %f", hpd975[i]);
+    long line_count;
+    long count = MIN(batch, col_count - cs.first);
+
+    for (i = 0; i < col_count; ++i)
+      matrix[i] = (i >= cs.first && i < cs.first+count) ?
+                    buffers[i-cs.first] : NULL;
+
+    /* binary files are mapped and copied column-wise into the matrix */
+    if (binary)
+    {
+      free(header);
+      line_count = mcmcbin_load(opt_mcmcfile,
+                                col_count,
+                                opt_samples,
+                                matrix,
+                                &header);
+    }
+    else
+    {
+      if (cs.first)
+      {
+        rewind(fp);
+        getnextline(fp);
+      }
+      line_count = load_columns(fp,col_count,matrix,!cs.first);
+    }
+
+    if (line_count < 0)
+      goto l_unwind;
+    assert(line_count > 0);
+
+    /* columns are independent */
+    threads_parallel_for(count,cb_summarize_column,&cs);
   }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
 
-  /* print ESS */
-  fprintf(stdout, "ESS*    ");
-  fprintf(fp_out, "ESS*    ");
+  fprintf(stdout, "          %s\n", header+4);
+  fprintf(fp_out, "          %s\n", header+4);
+
+  print_row(fp_out, "mean    ", cs.mean, col_count);
+  print_row(fp_out, "median  ", cs.median, col_count);
+  print_row(fp_out, "S.D     ", cs.stdev, col_count);
+  print_row(fp_out, "min     ", cs.min, col_count);
+  print_row(fp_out, "max     ", cs.max, col_count);
+  print_row(fp_out, "2.5%    ", cs.q025, col_count);
+  print_row(fp_out, "97.5%   ", cs.q975, col_count);
+  print_row(fp_out, "2.5%HPD ", cs.hpd025, col_count);
+  print_row(fp_out, "97.5%HPD", cs.hpd975, col_count);
+
+  /* ESS and efficiency */
+  double * ess = (double *)xmalloc((size_t)col_count * sizeof(double));
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", opt_samples/tint[i]);
-    fprintf(fp_out, "  %f", opt_samples/tint[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
-    
-  /* print Eff */
-  fprintf(stdout, "Eff*    ");
-  fprintf(fp_out, "Eff*    ");
+    ess[i] = opt_samples/cs.tint[i];
+  print_row(fp_out, "ESS*    ", ess, col_count);
+
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", 1/tint[i]);
-    fprintf(fp_out, "  %f", 1/tint[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    ess[i] = 1/cs.tint[i];
+  print_row(fp_out, "Eff*    ", ess, col_count);
+  free(ess);
 
   /* success */
   rc = 1;
 
 l_unwind:
-  for (i = 0; i < col_count; ++i)
-    free(matrix[i]);
+  for (j = 0; j < batch; ++j)
+    free(buffers[j]);
+  free(buffers);
   free(matrix);
+  free(header);
 
   if (rc && stree->tip_count > 1)
   {
     /* write figtree file */
-    write_figtree(stree,mean,hpd025,hpd975);
+    write_figtree(stree,cs.mean,cs.hpd025,cs.hpd975);
     fprintf(stdout, "FigTree tree is in FigTree.tre\n");
   }
 
-  free(mean);
-  free(hpd025);
-  free(hpd975);
-  free(tint);
-  free(stdev);
+  free(cs.mean);
+  free(cs.stdev);
+  free(cs.tint);
+  free(cs.median);
+  free(cs.min);
+  free(cs.max);
+  free(cs.q025);
+  free(cs.q975);
+  free(cs.hpd025);
+  free(cs.hpd975);
 
-  fclose(fp);
+  if (fp)
+    fclose(fp);
 
   if (!rc)
     fatal("Error while reading/summarizing %s", opt_mcmcfile);
-
 }
-
@@ -0,0 +1,651 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Standalone microbenchmark of the likelihood kernels (make bench). For
+   synthetic data of varying states, sites and rate categories it times the
+   partial CLV updates (inner-inner, tip-inner, tip-tip), the root
+   log-likelihood and the pmatrix builders on each instruction set that is
+   both compiled in and supported by the processor, and checks that the
+   results agree with the non-vectorized code.
+
+   usage: bpp-bench [seconds per measurement] */
+
+#define BENCH_ALIGN     32
+#define BENCH_TOLERANCE 1e-10
+#define BENCH_RATES_MAX 4
+
+/* globals normally defined in bpp.c and required by util.c/hardware.c */
+long opt_arch = -1;
+long opt_quiet = 0;
+long mmx_present;
+long sse_present;
+long sse2_present;
+long sse3_present;
+long ssse3_present;
+long sse41_present;
+long sse42_present;
+long popcnt_present;
+long avx_present;
+long avx2_present;
+long altivec_present;
+
+typedef struct bench_data_s
+{
+  unsigned int states;
+  unsigned int sites;
+  unsigned int rate_cats;
+  size_t span;
+
+  double * left_clv;
+  double * right_clv;
+  double * parent_clv;
+  double * ref_clv;
+  double * lookup;
+  size_t lookup_size;
+  double * pmatrix[2];
+  unsigned char * left_tipchars;
+  unsigned char * right_tipchars;
+  unsigned int tipmap[ASCII_SIZE];
+  unsigned int tipmap_size;
+
+  double * rates;
+  double * rate_weights;
+  double * frequencies[1];
+  unsigned int * pattern_weights;
+  unsigned int * freqs_indices;
+
+  double * eigenvals[1];
+  double * eigenvecs[1];
+  double * inv_eigenvecs[1];
+} bench_data_t;
+
+static const char * isa_name[] = { "CPU", "SSE", "AVX", "AVX2" };
+static const unsigned int isa_attrib[] = { PLL_ATTRIB_ARCH_CPU,
+                                           PLL_ATTRIB_ARCH_SSE,
+                                           PLL_ATTRIB_ARCH_AVX,
+                                           PLL_ATTRIB_ARCH_AVX2 };
+
+static double min_time = 0.2;
+static long mismatches = 0;
+static unsigned long rng_state = 1;
+
+static double rnd()
+{
+  rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+  return ((rng_state >> 11) + 1) / 9007199254740993.0;
+}
+
+static double bench_clock()
+{
+  struct timespec ts;
+
+#ifndef _WIN32
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  timespec_get(&ts, TIME_UTC);
+#endif
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int isa_present(long isa)
+{
+  switch (isa)
+  {
+    case 0:
+      return 1;
+#ifdef HAVE_SSE3
+    case 1:
+      return (int)sse3_present;
+#endif
+#ifdef HAVE_AVX
+    case 2:
+      return (int)avx_present;
+#endif
+#ifdef HAVE_AVX2
+    case 3:
+      return (int)avx2_present;
+#endif
+  }
+  return 0;
+}
+
+static double * alloc_doubles(size_t count)
+{
+  double * x = (double *)pll_aligned_alloc(count * sizeof(double),
+                                           BENCH_ALIGN);
+  if (!x)
+    fatal("Cannot allocate memory");
+
+  memset(x, 0, count * sizeof(double));
+  return x;
+}
+
+/* orthonormal eigenvectors of the Jukes-Cantor type rate matrix: the first
+   one is constant and the rest form a Helmert basis */
+static void jc_eigen(bench_data_t * d)
+{
+  unsigned int i,j;
+  unsigned int n = d->states;
+  double * v = d->inv_eigenvecs[0];
+
+  for (j = 0; j < n; ++j)
+  {
+    d->eigenvals[0][j] = j ? -(double)n / (n-1) : 0;
+
+    for (i = 0; i < n; ++i)
+    {
+      if (!j)
+        v[i*n+j] = 1 / sqrt(n);
+      else if (i < j)
+        v[i*n+j] = 1 / sqrt((double)j*(j+1));
+      else if (i == j)
+        v[i*n+j] = -(double)j / sqrt((double)j*(j+1));
+      else
+        v[i*n+j] = 0;
+    }
+  }
+
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < n; ++j)
+      d->eigenvecs[0][i*n+j] = v[j*n+i];
+}
+
+static void data_create(bench_data_t * d,
+                        unsigned int states,
+                        unsigned int sites,
+                        unsigned int rate_cats)
+{
+  unsigned int i;
+  double branch_lengths[2] = {0.05, 0.2};
+  unsigned int matrix_indices[2] = {0, 1};
+  unsigned int param_indices[BENCH_RATES_MAX] = {0};
+
+  memset(d, 0, sizeof(bench_data_t));
+  d->states = states;
+  d->sites = sites;
+  d->rate_cats = rate_cats;
+  d->span = (size_t)sites * rate_cats * states;
+
+  d->left_clv = alloc_doubles(d->span);
+  d->right_clv = alloc_doubles(d->span);
+  d->parent_clv = alloc_doubles(d->span);
+  d->ref_clv = alloc_doubles(d->span);
+
+  for (i = 0; i < d->span; ++i)
+  {
+    d->left_clv[i] = rnd();
+    d->right_clv[i] = rnd();
+  }
+
+  /* tip characters: state bitmasks for 4x4 kernels, otherwise indices into
+     the tipmap with the last entry denoting a fully ambiguous state */
+  d->left_tipchars = (unsigned char *)xmalloc(sites);
+  d->right_tipchars = (unsigned char *)xmalloc(sites);
+  if (states == 4)
+  {
+    d->tipmap_size = 16;
+    for (i = 0; i < 16; ++i)
+      d->tipmap[i] = i;
+    for (i = 0; i < sites; ++i)
+    {
+      d->left_tipchars[i] = (unsigned char)(rnd() < 0.9 ?
+                              1 << (int)(rnd()*4) : 1 + (int)(rnd()*15));
+      d->right_tipchars[i] = (unsigned char)(rnd() < 0.9 ?
+                              1 << (int)(rnd()*4) : 1 + (int)(rnd()*15));
+    }
+  }
+  else
+  {
+    d->tipmap_size = states+1;
+    for (i = 0; i < states; ++i)
+      d->tipmap[i] = 1u << i;
+    d->tipmap[states] = (1u << states) - 1;
+    for (i = 0; i < sites; ++i)
+    {
+      d->left_tipchars[i] = (unsigned char)(rnd() * (states+1));
+      d->right_tipchars[i] = (unsigned char)(rnd() * (states+1));
+    }
+  }
+
+  unsigned int l2_maxstates = (unsigned int)ceil(log2(d->tipmap_size));
+  d->lookup_size = MAX((size_t)1024 * rate_cats,
+                       ((size_t)1 << (2*l2_maxstates)) * states * rate_cats);
+  d->lookup = alloc_doubles(d->lookup_size);
+
+  /* model */
+  d->rates = (double *)xmalloc(rate_cats * sizeof(double));
+  d->rate_weights = (double *)xmalloc(rate_cats * sizeof(double));
+  d->freqs_indices = (unsigned int *)xcalloc(rate_cats, sizeof(unsigned int));
+  for (i = 0; i < rate_cats; ++i)
+  {
+    d->rates[i] = rate_cats == 1 ? 1 : 0.25 + 1.5*i/(rate_cats-1);
+    d->rate_weights[i] = 1.0 / rate_cats;
+  }
+
+  d->frequencies[0] = alloc_doubles(states);
+  for (i = 0; i < states; ++i)
+    d->frequencies[0][i] = 1.0 / states;
+
+  d->pattern_weights = (unsigned int *)xmalloc(sites * sizeof(unsigned int));
+  for (i = 0; i < sites; ++i)
+    d->pattern_weights[i] = 1 + (unsigned int)(rnd()*3);
+
+  d->eigenvals[0] = alloc_doubles(states);
+  d->eigenvecs[0] = alloc_doubles(states*states);
+  d->inv_eigenvecs[0] = alloc_doubles(states*states);
+  jc_eigen(d);
+
+  d->pmatrix[0] = alloc_doubles(states*states*rate_cats);
+  d->pmatrix[1] = alloc_doubles(states*states*rate_cats);
+  pll_core_update_pmatrix(d->pmatrix,
+                          states,
+                          rate_cats,
+                          d->rates,
+                          branch_lengths,
+                          matrix_indices,
+                          param_indices,
+                          d->eigenvals,
+                          d->eigenvecs,
+                          d->inv_eigenvecs,
+                          2,
+                          0);
+}
+
+static void data_destroy(bench_data_t * d)
+{
+  pll_aligned_free(d->left_clv);
+  pll_aligned_free(d->right_clv);
+  pll_aligned_free(d->parent_clv);
+  pll_aligned_free(d->ref_clv);
+  pll_aligned_free(d->lookup);
+  pll_aligned_free(d->pmatrix[0]);
+  pll_aligned_free(d->pmatrix[1]);
+  pll_aligned_free(d->frequencies[0]);
+  pll_aligned_free(d->eigenvals[0]);
+  pll_aligned_free(d->eigenvecs[0]);
+  pll_aligned_free(d->inv_eigenvecs[0]);
+  free(d->left_tipchars);
+  free(d->right_tipchars);
+  free(d->rates);
+  free(d->rate_weights);
+  free(d->freqs_indices);
+  free(d->pattern_weights);
+}
+
+static double max_relative_error(const double * x, const double * ref, size_t n)
+{
+  size_t i;
+  double maxerr = 0;
+
+  for (i = 0; i < n; ++i)
+  {
+    double err = fabs(x[i] - ref[i]) / MAX(fabs(ref[i]), DBL_MIN);
+    if (err > maxerr)
+      maxerr = err;
+  }
+
+  return maxerr;
+}
+
+#define KERNEL_II   0
+#define KERNEL_TI   1
+#define KERNEL_TT   2
+#define KERNEL_ROOT 3
+
+static const char * kernel_name[] = { "partial_ii", "partial_ti",
+                                      "partial_tt", "root_logl" };
+
+static double run_kernel(bench_data_t * d, long kernel, unsigned int attrib)
+{
+  switch (kernel)
+  {
+    case KERNEL_II:
+      pll_core_update_partial_ii(d->states,
+                                 d->sites,
+                                 d->rate_cats,
+                                 d->parent_clv,
+                                 NULL,
+                                 d->left_clv,
+                                 d->right_clv,
+                                 d->pmatrix[0],
+                                 d->pmatrix[1],
+                                 NULL,
+                                 NULL,
+                                 attrib);
+      break;
+    case KERNEL_TI:
+      pll_core_update_partial_ti(d->states,
+                                 d->sites,
+                                 d->rate_cats,
+                                 d->parent_clv,
+                                 NULL,
+                                 d->left_tipchars,
+                                 d->right_clv,
+                                 d->pmatrix[0],
+                                 d->pmatrix[1],
+                                 NULL,
+                                 d->tipmap,
+                                 d->tipmap_size,
+                                 attrib);
+      break;
+    case KERNEL_TT:
+      pll_core_update_partial_tt(d->states,
+                                 d->sites,
+                                 d->rate_cats,
+                                 d->parent_clv,
+                                 NULL,
+                                 d->left_tipchars,
+                                 d->right_tipchars,
+                                 d->tipmap,
+                                 d->tipmap_size,
+                                 d->lookup,
+                                 attrib);
+      break;
+    case KERNEL_ROOT:
+      return pll_core_root_loglikelihood(d->states,
+                                         d->sites,
+                                         d->rate_cats,
+                                         d->left_clv,
+                                         NULL,
+                                         d->frequencies,
+                                         d->rate_weights,
+                                         d->pattern_weights,
+                                         d->freqs_indices,
+                                         NULL,
+                                         attrib);
+  }
+
+  return 0;
+}
+
+/* nominal floating point operations and bytes moved per site */
+static void kernel_cost(bench_data_t * d,
+                        long kernel,
+                        double * flops,
+                        double * bytes)
+{
+  double s = d->states;
+  double r = d->rate_cats;
+
+  switch (kernel)
+  {
+    case KERNEL_II:
+      *flops = r*s*(4*s + 1);
+      *bytes = 3*r*s*sizeof(double);
+      break;
+    case KERNEL_TI:
+      *flops = r*s*(2*s + 1);
+      *bytes = 2*r*s*sizeof(double) + 1;
+      break;
+    case KERNEL_TT:
+      *flops = 0;
+      *bytes = r*s*sizeof(double) + 2;
+      break;
+    default:
+      *flops = r*(2*s + 1) + 2;
+      *bytes = r*s*sizeof(double) + sizeof(unsigned int);
+  }
+}
+
+/* time a kernel by doubling the repetitions until min_time is reached */
+static double time_kernel(bench_data_t * d, long kernel, unsigned int attrib)
+{
+  long i;
+  long reps = 1;
+  double elapsed;
+
+  while (1)
+  {
+    double start = bench_clock();
+    for (i = 0; i < reps; ++i)
+      run_kernel(d, kernel, attrib);
+    elapsed = bench_clock() - start;
+
+    if (elapsed >= min_time)
+      break;
+    reps *= 2;
+  }
+
+  return elapsed / reps;
+}
+
+static void bench_kernels(bench_data_t * d)
+{
+  long isa,kernel;
+
+  for (kernel = 0; kernel < 4; ++kernel)
+  {
+    double ref_logl = 0;
+
+    for (isa = 0; isa < 4; ++isa)
+    {
+      double err;
+      double flops, bytes;
+      unsigned int attrib = isa_attrib[isa];
+
+      if (!isa_present(isa)) continue;
+
+      /* the tip-tip lookup table layout is specific to the instruction set */
+      if (kernel == KERNEL_TT)
+      {
+        memset(d->lookup, 0, d->lookup_size * sizeof(double));
+        pll_core_create_lookup(d->states,
+                               d->rate_cats,
+                               d->lookup,
+                               d->pmatrix[0],
+                               d->pmatrix[1],
+                               d->tipmap,
+                               d->tipmap_size,
+                               attrib);
+      }
+
+      /* check against the non-vectorized result */
+      if (kernel == KERNEL_ROOT)
+      {
+        double logl = run_kernel(d, kernel, attrib);
+        if (!isa)
+          ref_logl = logl;
+        err = fabs(logl - ref_logl) / fabs(ref_logl);
+      }
+      else
+      {
+        memset(d->parent_clv, 0, d->span * sizeof(double));
+        run_kernel(d, kernel, attrib);
+        if (!isa)
+          memcpy(d->ref_clv, d->parent_clv, d->span * sizeof(double));
+        err = max_relative_error(d->parent_clv, d->ref_clv, d->span);
+      }
+
+      double t = time_kernel(d, kernel, attrib);
+      kernel_cost(d, kernel, &flops, &bytes);
+
+      printf("%6u %7u %4u  %-10s %-4s %12.3f %9.3f %9.3f %10.1f %10.2e%s\n",
+             d->states,
+             d->sites,
+             d->rate_cats,
+             kernel_name[kernel],
+             isa_name[isa],
+             t * 1e6,
+             flops * d->sites / t / 1e9,
+             bytes * d->sites / t / 1e9,
+             bytes,
+             err,
+             err > BENCH_TOLERANCE ? "  MISMATCH" : "");
+
+      if (err > BENCH_TOLERANCE)
+        ++mismatches;
+    }
+  }
+}
+
+/* the pmatrix builders are not vectorized; time them once per setting */
+static void bench_pmatrix(bench_data_t * d)
+{
+  long i,reps;
+  double elapsed;
+  double branch_lengths[2] = {0.05, 0.2};
+  unsigned int matrix_indices[2] = {0, 1};
+  unsigned int param_indices[BENCH_RATES_MAX] = {0};
+  long jc = (d->states == 4);
+
+  for (; jc >= 0; --jc)
+  {
+    for (reps = 1; ; reps *= 2)
+    {
+      double start = bench_clock();
+      for (i = 0; i < reps; ++i)
+      {
+        if (jc)
+          pll_core_update_pmatrix_4x4_jc69(d->pmatrix,
+                                           d->states,
+                                           d->rate_cats,
+                                           d->rates,
+                                           branch_lengths,
+                                           matrix_indices,
+                                           param_indices,
+                                           2,
+                                           0);
+        else
+          pll_core_update_pmatrix(d->pmatrix,
+                                  d->states,
+                                  d->rate_cats,
+                                  d->rates,
+                                  branch_lengths,
+                                  matrix_indices,
+                                  param_indices,
+                                  d->eigenvals,
+                                  d->eigenvecs,
+                                  d->inv_eigenvecs,
+                                  2,
+                                  0);
+      }
+      elapsed = bench_clock() - start;
+      if (elapsed >= min_time) break;
+    }
+
+    /* two matrices per call */
+    printf("%6u %7s %4u  %-10s %-4s %12.3f %9.3f\n",
+           d->states,
+           "-",
+           d->rate_cats,
+           jc ? "pmat_jc69" : "pmat_eigen",
+           "CPU",
+           elapsed / reps / 2 * 1e6,
+           (jc ? 10.0 : 2.0*d->states*d->states*d->states) *
+             d->rate_cats * 2 * reps / elapsed / 1e9);
+  }
+
+  /* the specialized JC69 builder must agree with the general one; it
+     ignores the category rates, hence the comparison uses unit rates */
+  if (d->states == 4)
+  {
+    double * jc69[2];
+    double * eigen[2];
+    double ones[BENCH_RATES_MAX] = {1,1,1,1};
+    size_t size = d->states * d->states * d->rate_cats;
+
+    jc69[0] = alloc_doubles(size);
+    jc69[1] = alloc_doubles(size);
+    eigen[0] = alloc_doubles(size);
+    eigen[1] = alloc_doubles(size);
+    pll_core_update_pmatrix_4x4_jc69(jc69,
+                                     d->states,
+                                     d->rate_cats,
+                                     ones,
+                                     branch_lengths,
+                                     matrix_indices,
+                                     param_indices,
+                                     2,
+                                     0);
+    pll_core_update_pmatrix(eigen,
+                            d->states,
+                            d->rate_cats,
+                            ones,
+                            branch_lengths,
+                            matrix_indices,
+                            param_indices,
+                            d->eigenvals,
+                            d->eigenvecs,
+                            d->inv_eigenvecs,
+                            2,
+                            0);
+    double err = MAX(max_relative_error(jc69[0], eigen[0], size),
+                     max_relative_error(jc69[1], eigen[1], size));
+    if (err > BENCH_TOLERANCE)
+    {
+      printf("pmat_jc69 differs from pmat_eigen (%.2e)  MISMATCH\n", err);
+      ++mismatches;
+    }
+    pll_aligned_free(jc69[0]);
+    pll_aligned_free(jc69[1]);
+    pll_aligned_free(eigen[0]);
+    pll_aligned_free(eigen[1]);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i,j,k;
+  unsigned int states[] = {4, 20};
+  unsigned int sites[] = {100, 1000, 10000};
+  unsigned int rate_cats[] = {1, 4};
+  bench_data_t d;
+
+  if (argc > 1 && (min_time = atof(argv[1])) <= 0)
+    fatal("usage: %s [seconds per measurement]", argv[0]);
+
+  cpu_features_detect();
+  cpu_features_show();
+
+  printf("\nGFLOP/s are nominal counts of the non-vectorized algorithm, "
+         "bytes/site counts\nCLV traffic, and relerr is the maximum relative "
+         "difference to the CPU result\n\n");
+  printf("%6s %7s %4s  %-10s %-4s %12s %9s %9s %10s %10s\n",
+         "states", "sites", "cats", "kernel", "isa", "usec/call", "GFLOP/s",
+         "GB/s", "bytes/site", "relerr");
+
+  for (i = 0; i < sizeof(states)/sizeof(unsigned int); ++i)
+  {
+    for (k = 0; k < sizeof(rate_cats)/sizeof(unsigned int); ++k)
+    {
+      for (j = 0; j < sizeof(sites)/sizeof(unsigned int); ++j)
+      {
+        data_create(&d, states[i], sites[j], rate_cats[k]);
+        bench_kernels(&d);
+        if (j == 0)
+          bench_pmatrix(&d);
+        data_destroy(&d);
+      }
+    }
+  }
+
+  if (mismatches)
+  {
+    printf("\n%ld results differ between instruction sets\n", mismatches);
+    return EXIT_FAILURE;
+  }
+
+  printf("\nAll instruction sets agree\n");
+  return EXIT_SUCCESS;
+}
@@ -37,10 +37,14 @@ __THREAD char bpp_errmsg[200] = {0};
 long opt_arch;
 long opt_burnin;
 long opt_checkpoint;
+long opt_checkpoint_clv;
 long opt_checkpoint_current;
+long opt_checkpoint_fork;
 long opt_checkpoint_initial;
+long opt_checkpoint_interval;
 long opt_checkpoint_step;
 long opt_cleandata;
+long opt_datacache;
 long opt_debug;
 long opt_delimit_prior;
 long opt_diploid_size;
@@ -53,12 +57,17 @@ long opt_finetune_reset;
 long opt_help;
 long opt_locus_count;
 long opt_max_species_count;
+long opt_gtree_container;
+long opt_mcmc_binary;
 long opt_method;
 long opt_onlysummary;
+long opt_perfcounters;
 long opt_print_genetrees;
 long opt_print_hscalars;
 long opt_print_locusrate;
 long opt_print_samples;
+long opt_profile;
+long opt_profile_step;
 long opt_quiet;
 long opt_revolutionary_spr_method;
 long opt_revolutionary_spr_debug;
@@ -67,6 +76,13 @@ long opt_samplefreq;
 long opt_samples;
 long opt_scaling;
 long opt_seed;
+long opt_simulate;
+long opt_simulate_sites;
+long opt_status_interval;
+long opt_summary_memory;
+long opt_threads;
+long opt_trace_from;
+long opt_trace_to;
 long opt_usedata;
 long opt_version;
 double opt_bfbeta;
@@ -94,6 +110,8 @@ char * opt_locusrate_filename;
 char * opt_mapfile;
 char * opt_msafile;
 char * opt_mcmcfile;
+char * opt_gtree_extract;
+char * opt_mcmc2text;
 char * opt_outfile;
 char * opt_reorder;
 char * opt_resume;
@@ -121,6 +139,13 @@ static struct option long_options[] =
   {"exp_method", required_argument, 0, 0 },  /* 5 */
   {"exp_debug",  no_argument,       0, 0 },  /* 6 */
   {"resume",     required_argument, 0, 0 },  /* 7 */
+  {"mcmc2text",  required_argument, 0, 0 },  /* 8 */
+  {"gtree_extract", required_argument, 0, 0 },  /* 9 */
+  {"simulate",   required_argument, 0, 0 },  /* 10 */
+  {"perfcounters", no_argument,     0, 0 },  /* 11 */
+  {"profile",    optional_argument, 0, 0 },  /* 12 */
+  {"trace",      required_argument, 0, 0 },  /* 13 */
+  {"status",     required_argument, 0, 0 },  /* 14 */
   { 0, 0, 0, 0 }
 };
 
@@ -162,10 +187,14 @@ void args_init(int argc, char ** argv)
   opt_cfile = NULL;
 
   opt_checkpoint = 0;
+  opt_checkpoint_clv = 0;
   opt_checkpoint_initial = 0;
   opt_checkpoint_current = 0;
+  opt_checkpoint_fork = 0;
+  opt_checkpoint_interval = 0;
   opt_checkpoint_step = 0;
   opt_cleandata = 0;
+  opt_datacache = 0;
   opt_debug = 0;
   opt_delimit_prior = BPP_SPECIES_PRIOR_UNIFORM;
   opt_diploid = NULL;
@@ -198,12 +227,19 @@ void args_init(int argc, char ** argv)
   opt_locus_count = 0;
   opt_mapfile = NULL;
   opt_max_species_count = 0;
+  opt_gtree_container = 0;
+  opt_mcmc_binary = 0;
   opt_mcmcfile = NULL;
+  opt_mcmc2text = NULL;
+  opt_gtree_extract = NULL;
   opt_method = -1;
   opt_msafile = NULL;
   opt_onlysummary = 0;
+  opt_perfcounters = 0;
   opt_outfile = NULL;
   opt_print_genetrees = 0;
+  opt_profile = 0;
+  opt_profile_step = 0;
   opt_print_hscalars = 0;
   opt_print_locusrate = 0;
   opt_print_samples = 1;
@@ -217,8 +253,15 @@ void args_init(int argc, char ** argv)
   opt_samples = 0;
   opt_scaling = 0;
   opt_seed = (long)time(NULL);
+  opt_simulate = 0;
+  opt_simulate_sites = 0;
+  opt_status_interval = 0;
   opt_sp_seqcount = NULL;
   opt_streenewick = NULL;
+  opt_summary_memory = 1024;
+  opt_threads = 1;
+  opt_trace_from = 0;
+  opt_trace_to = 0;
   opt_tau_alpha = 0;
   opt_tau_beta = 0;
   opt_theta_alpha = 0;
@@ -243,6 +286,8 @@ void args_init(int argc, char ** argv)
         break;
 
       case 3:
+        if (opt_simulate)
+          fatal("More than one command specified");
         opt_cfile = xstrdup(optarg);
         break;
 
@@ -271,6 +316,43 @@ void args_init(int argc, char ** argv)
         opt_resume = optarg;
         break;
 
+      case 8:
+        opt_mcmc2text = optarg;
+        break;
+
+      case 9:
+        opt_gtree_extract = optarg;
+        break;
+
+      case 10:
+        /* the simulation parameters are given as a control file */
+        if (opt_cfile)
+          fatal("More than one command specified");
+        opt_cfile = xstrdup(optarg);
+        opt_simulate = 1;
+        break;
+
+      case 11:
+        opt_perfcounters = 1;
+        break;
+
+      case 12:
+        opt_profile = 1;
+        if (optarg && (opt_profile_step = args_getlong(optarg)) <= 0)
+          fatal("Option --profile expects a positive step");
+        break;
+
+      case 13:
+        if (sscanf(optarg, "%ld:%ld", &opt_trace_from, &opt_trace_to) != 2 ||
+            opt_trace_from <= 0 || opt_trace_to < opt_trace_from)
+          fatal("Option --trace expects FROM:TO with 0 < FROM <= TO");
+        break;
+
+      case 14:
+        if ((opt_status_interval = args_getlong(optarg)) <= 0)
+          fatal("Option --status expects a positive number of seconds");
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -293,6 +375,10 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_resume)
     commands++;
+  if (opt_mcmc2text)
+    commands++;
+  if (opt_gtree_extract)
+    commands++;
 
   /* if more than one independent command, fail */
   if (commands > 1)
@@ -333,7 +419,17 @@ void cmd_help()
           "  --quiet            only output warnings and fatal errors to stderr\n"
           "  --cfile FILENAME   run analysis for the specified control file\n"
           "  --resume FILENAME  resume analysis from a specified checkpoint file\n"
+          "  --mcmc2text FILENAME\n"
+          "                     convert binary MCMC sample file to text\n"
+          "  --gtree_extract FILENAME\n"
+          "                     write per-locus gene tree files from a container\n"
+          "  --simulate FILENAME\n"
+          "                     simulate data as specified in a control file\n"
           "  --arch SIMD        force specific vector instruction set (default: auto)\n"
+          "  --perfcounters     report hardware counters of likelihood kernels (Linux)\n"
+          "  --profile[=STEP]   profile MCMC moves (as 'profile = 1 STEP')\n"
+          "  --trace FROM:TO    write a timeline of steps FROM to TO (as 'trace')\n"
+          "  --status SECONDS   update a JSON status file (as 'status')\n"
           "\n"
          );
 
@@ -341,6 +437,30 @@ void cmd_help()
   /*         01234567890123456789012345678901234567890123456789012345678901234567890123456789 */
 }
 
+void cmd_mcmc2text()
+{
+  char * s = NULL;
+
+  xasprintf(&s, "%s.txt", opt_mcmc2text);
+  FILE * fp = xopen(s,"w");
+
+  printf("Converting %s...", opt_mcmc2text);
+  mcmcbin_export(opt_mcmc2text, fp);
+  printf(" Done\n");
+  printf("Text samples written to %s\n", s);
+
+  fclose(fp);
+  free(s);
+}
+
+void cmd_gtree_extract()
+{
+  printf("Extracting gene trees from %s...", opt_gtree_extract);
+  long count = gtreefile_extract(opt_gtree_extract);
+  printf(" Done\n");
+  printf("Gene trees of %ld loci written to %s.L*\n", count, opt_gtree_extract);
+}
+
 void getentirecommandline(int argc, char * argv[])
 {
   int len = 0;
@@ -400,10 +520,22 @@ int main (int argc, char * argv[])
   {
     ;
   }
+  else if (opt_simulate)
+  {
+    cmd_simulate();
+  }
   else if (opt_resume || opt_cfile)
   {
     cmd_run();
   }
+  else if (opt_mcmc2text)
+  {
+    cmd_mcmc2text();
+  }
+  else if (opt_gtree_extract)
+  {
+    cmd_gtree_extract();
+  }
 
   dealloc_switches();
   free(cmdline);
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <sys/stat.h>
@@ -50,6 +51,16 @@
 #include <unistd.h>
 #endif
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+/* binary files must not be opened in text mode on Windows */
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 /* platform specific */
 
 #if (defined(__BORLANDC__) || defined(_MSC_VER))
@@ -88,7 +99,15 @@
 #define VERSION_PATCH 3
 
 /* checkpoint version */
-#define VERSION_CHKP 1
+#define VERSION_CHKP 2
+
+/* checkpoint locus data alignment, trailer magic and tip encodings */
+#define CHK_ALIGN         64
+#define CHK_TRAILER_MAGIC "BPPC"
+#define CHK_TIPS_CLV      0
+#define CHK_TIPS_STATES   1
+
+#define HASH_FNV_INIT 14695981039346656037UL
 
 #define PROG_VERSION "v" PLL_C2S(VERSION_MAJOR) "." PLL_C2S(VERSION_MINOR) "." \
         PLL_C2S(VERSION_PATCH)
@@ -200,6 +219,27 @@
 #define METHOD_10       2
 #define METHOD_11       3
 
+/* moves timed by the profiler */
+
+#define PROF_GTAGE      0
+#define PROF_GTSPR      1
+#define PROF_THETA      2
+#define PROF_TAU        3
+#define PROF_MIX        4
+#define PROF_LRHT       5
+#define PROF_RJ         6
+#define PROF_SSPR       7
+#define PROF_SAMPLE     8
+#define PROF_COUNT      9
+
+/* kernels measured with --perfcounters */
+#define PERFCNT_PARTIAL_TT  0
+#define PERFCNT_PARTIAL_TI  1
+#define PERFCNT_PARTIAL_II  2
+#define PERFCNT_ROOT_LOGL   3
+#define PERFCNT_ROOT_VECTOR 4
+#define PERFCNT_COUNT       5
+
 /* other */
 #define MUTRATE_ESTIMATE        1
 #define MUTRATE_FROMFILE        2
@@ -277,6 +317,7 @@ typedef struct snode_s
   double * t2h;                     /* per-locus precomputed t2h */
   double * old_t2h;                 /* storage space for rollback */
   double t2h_sum;                   /* t2h sum for all loci */
+  double old_t2h_sum;               /* storage space for rollback */
   long event_count_sum;             /* sum of coalencent events count */
   double notheta_logpr_contrib;     /* MSC density contribution from pop */
   double notheta_old_logpr_contrib; /* storage space for rollback */
@@ -294,6 +335,12 @@ typedef struct stree_s
 
   int ** pptable;
 
+  /* lcatable[i][j] is the index of the most recent common ancestral population
+     of populations i and j, and pdepth[i] the number of ancestral populations
+     of population i */
+  int ** lcatable;
+  int * pdepth;
+
   snode_t * root;
 
   double root_age;
@@ -432,15 +479,23 @@ typedef struct fasta
 } fasta_t;
 
 
+/* contents of a whole file (see mapfile_open) */
+typedef struct mapfile_s
+{
+  const char * data;
+  size_t size;
+  size_t pos;
+  int mapped;
+} mapfile_t;
+
 /* Simple structure for handling PHYLIP parsing */
 
 typedef struct phylip_s
 {
-  FILE * fp;
+  mapfile_t map;                /* file contents */
   char * line;
   size_t line_size;
   size_t line_maxsize;
-  char buffer[LINEALLOC];
   const unsigned int * chrstatus;
   long no;
   long filesize;
@@ -488,6 +543,57 @@ typedef struct pair_s
   void * data;
 } pair_t;
 
+/* state of hash_fnv_data over data given in pieces of arbitrary size */
+typedef struct hash_fnv_stream_s
+{
+  unsigned long hash;
+  BYTE tail[sizeof(unsigned long)];
+  size_t tail_len;
+} hash_fnv_stream_t;
+
+/* flat tree used by the summary of sampled species trees */
+typedef struct nnode_s
+{
+  long left;                    /* child indices or -1 for tips */
+  long right;
+  long label;                   /* label index (tips only) */
+  double length;
+
+  size_t key;                   /* offset and length of sort key */
+  size_t key_len;
+} nnode_t;
+
+typedef struct ntree_s
+{
+  nnode_t * nodes;
+  long node_count;
+  long node_maxcount;
+  long tip_count;
+  long root;
+
+  /* label dictionary */
+  char ** labels;
+  long label_count;
+  long label_maxcount;
+  hashtable_t * ht_labels;
+  char * label_buffer;
+  size_t label_buffer_size;
+
+  /* sort keys */
+  char * keys;
+  size_t keys_size;
+  size_t keys_maxsize;
+} ntree_t;
+
+/* formats a deferred record of the background writer into fp */
+typedef void (*writer_cb_t)(FILE * fp, const void * data, size_t size);
+
+/* appends node information to a growable newick buffer */
+typedef size_t (*stree_newick_cb_t)(const snode_t * node,
+                                    char ** buffer,
+                                    size_t * maxsize,
+                                    size_t pos);
+
 /* macros */
 
 #ifndef MIN
@@ -529,6 +635,7 @@ typedef struct pair_s
 #define FLAG_BRANCH_UPDATE              4
 #define FLAG_MISC                       8
 #define FLAG_PARTIAL_UPDATE           128
+#define FLAG_CLV_DIRTY                512
 
 
 /* options */
@@ -536,10 +643,14 @@ typedef struct pair_s
 extern long opt_arch;
 extern long opt_burnin;
 extern long opt_checkpoint;
+extern long opt_checkpoint_clv;
 extern long opt_checkpoint_current;
+extern long opt_checkpoint_fork;
 extern long opt_checkpoint_initial;
+extern long opt_checkpoint_interval;
 extern long opt_checkpoint_step;
 extern long opt_cleandata;
+extern long opt_datacache;
 extern long opt_debug;
 extern long opt_delimit_prior;
 extern long opt_diploid_size;
@@ -554,18 +665,30 @@ extern long opt_finetune_reset;
 extern long opt_help;
 extern long opt_locus_count;
 extern long opt_max_species_count;
+extern long opt_gtree_container;
+extern long opt_mcmc_binary;
 extern long opt_method;
 extern long opt_onlysummary;
+extern long opt_perfcounters;
 extern long opt_print_genetrees;
 extern long opt_print_hscalars;
 extern long opt_print_locusrate;
 extern long opt_print_samples;
+extern long opt_profile;
+extern long opt_profile_step;
 extern long opt_quiet;
 extern long opt_rjmcmc_method;
 extern long opt_samplefreq;
 extern long opt_samples;
 extern long opt_scaling;
 extern long opt_seed;
+extern long opt_simulate;
+extern long opt_simulate_sites;
+extern long opt_status_interval;
+extern long opt_summary_memory;
+extern long opt_threads;
+extern long opt_trace_from;
+extern long opt_trace_to;
 extern long opt_usedata;
 extern long opt_version;
 extern double opt_bfbeta;
@@ -592,6 +715,8 @@ extern char * opt_cfile;
 extern char * opt_heredity_filename;
 extern char * opt_mapfile;
 extern char * opt_mcmcfile;
+extern char * opt_gtree_extract;
+extern char * opt_mcmc2text;
 extern char * opt_msafile;
 extern char * opt_locusrate_filename;
 extern char * opt_outfile;
@@ -640,8 +765,23 @@ char * xstrdup(const char * s);
 char * xstrndup(const char * s, size_t len);
 long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
+int mapfile_open(mapfile_t * m, const char * filename);
+void mapfile_close(mapfile_t * m);
+const void * mapfile_take(mapfile_t * m, size_t size);
+int mapfile_read(mapfile_t * m, void * x, size_t size);
 void * pll_aligned_alloc(size_t size, size_t alignment);
 void pll_aligned_free(void * ptr);
+size_t xbuf_append(char ** buffer,
+                   size_t * maxsize,
+                   size_t pos,
+                   const char * s,
+                   size_t len);
+size_t xbuf_printf(char ** buffer,
+                   size_t * maxsize,
+                   size_t pos,
+                   const char * format,
+                   ...);
+size_t xbuf_double(char ** buffer, size_t * maxsize, size_t pos, double x);
 
 /* functions in bpp.c */
 
@@ -649,6 +789,10 @@ void args_init(int argc, char ** argv);
 
 void cmd_help(void);
 
+void cmd_mcmc2text(void);
+
+void cmd_gtree_extract(void);
+
 void getentirecommandline(int argc, char * argv[]);
 
 void fillheader(void);
@@ -688,6 +832,12 @@ void stree_show_ascii(const snode_t * root, int options);
 char * stree_export_newick(const snode_t * root,
                            char * (*cb_serialize)(const snode_t *));
 
+size_t stree_export_newick_append(const snode_t * root,
+                                  stree_newick_cb_t cb_append,
+                                  char ** buffer,
+                                  size_t * maxsize,
+                                  size_t pos);
+
 int stree_traverse(snode_t * root,
                    int traversal,
                    int (*cbtrav)(snode_t *),
@@ -719,6 +869,10 @@ void reset_gene_leaves_count(stree_t * stree);
 
 void stree_reset_pptable(stree_t * stree);
 
+void stree_update_pptable(stree_t * stree, snode_t * node);
+
+snode_t * stree_lca(stree_t * stree, snode_t * a, snode_t * b);
+
 long stree_propose_spr(stree_t ** streeptr,
                        gtree_t *** gtree_list_ptr,
                        stree_t ** scloneptr,
@@ -752,6 +906,14 @@ uint64_t arch_get_memtotal(void);
 
 long arch_get_cores(void);
 
+/* functions in threads.c */
+
+long threads_get_count(void);
+
+void threads_parallel_for(long count,
+                          void (*cb)(long index, void * data),
+                          void * data);
+
 /* functions in msa.c */
 
 void msa_print_phylip(FILE * fp, msa_t ** msa, long count);
@@ -811,6 +973,16 @@ unsigned long hash_djb2a(char * s);
 
 unsigned long hash_fnv(char * s);
 
+unsigned long hash_fnv_data(unsigned long hash, const void * data, size_t size);
+
+void hash_fnv_stream_init(hash_fnv_stream_t * s);
+
+void hash_fnv_stream_update(hash_fnv_stream_t * s,
+                            const void * data,
+                            size_t size);
+
+unsigned long hash_fnv_stream_final(const hash_fnv_stream_t * s);
+
 int hashtable_insert(hashtable_t * ht,
                      void * x,
                      unsigned long hash,
@@ -833,6 +1005,8 @@ double legacy_rndbeta (double p, double q);
 double legacy_rndgamma (double a);
 unsigned int get_legacy_rndu_status(void);
 void set_legacy_rndu_status(unsigned int x);
+void sim_rndu_init(long seed, long stream);
+double sim_rndu(void);
 
 /* functions in gtree.c */
 
@@ -843,9 +1017,35 @@ gtree_t ** gtree_init(stree_t * stree,
                       list_t * maplist,
                       int msa_count);
 
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         double (*rndu)(void));
+
+void gtree_simulate_init(stree_t * stree, list_t * maplist);
+
+void gtree_simulate_fini(stree_t * stree);
+
 char * gtree_export_newick(const gnode_t * root,
                            char * (*cb_serialize)(const gnode_t *));
 
+size_t gtree_export_newick_append(const gnode_t * root,
+                                  char * (*cb_serialize)(const gnode_t *),
+                                  char ** buffer,
+                                  size_t * maxsize,
+                                  size_t pos);
+
+size_t gtree_snapshot_size(const gtree_t * gtree);
+
+void gtree_snapshot(const gtree_t * gtree, void * buffer);
+
+size_t gtree_snapshot_newick(const void * snapshot,
+                             char ** buffer,
+                             size_t * maxsize,
+                             size_t pos);
+
+void gtree_snapshot_print(FILE * fp, const void * buffer, size_t size);
+
 void gtree_destroy(gtree_t * tree, void (*cb_destroy)(void *));
 
 int gtree_traverse(gnode_t * root,
@@ -867,11 +1067,20 @@ double gtree_logprob(stree_t * stree, double heredity, long msa_index);
 double gtree_update_logprob_contrib(snode_t * snode, double heredity, long msa_index);
 //double gtree_update_logprob_contrib_notheta(snode_t * snode, double heredity, long msa_index);
 void logprob_revert_notheta(snode_t * snode, long msa_index);
+double gtree_scale_logprob_contrib(snode_t * snode, double c, long msa_count);
 double gtree_propose_spr(locus_t ** locus, gtree_t ** gtree, stree_t * stree);
 double reflect(double t, double minage, double maxage);
-gnode_t ** gtree_return_partials(gnode_t * root,
-                                 unsigned int msa_index,
-                                 unsigned int * trav_size);
+gnode_t ** gtree_return_dirty_partials(gtree_t * gtree,
+                                       gnode_t ** bl_list,
+                                       unsigned int bl_count,
+                                       unsigned int msa_index,
+                                       unsigned int * trav_size);
+void gtree_all_partials(gnode_t * root,
+                        gnode_t ** travbuffer,
+                        unsigned int * trav_size);
+void gtree_swap_clv_indices(gtree_t * gtree,
+                            gnode_t ** nodes,
+                            unsigned int count);
 void unlink_event(gnode_t * node, int msa_index);
 
 double prop_locusrate_and_heredity(gtree_t ** gtree, stree_t * stree, locus_t ** locus);
@@ -970,16 +1179,36 @@ void allfixed_summary(FILE * fp_out, stree_t * stree);
 
 void bipartitions_init(char ** species, long species_count);
 
-void bipartitions_update(stree_t * stree);
+void bipartitions_update(const ntree_t * t);
 
 void summary_dealloc_hashtables(void);
 
+void stree_summary_init(const stree_t * stree);
+
+void stree_summary_add(const stree_t * stree);
+
+void stree_summary_dump(FILE * fp);
+
+void stree_summary_load(FILE * fp, const stree_t * stree);
+
+void stree_summary_snapshot(FILE * fp, long max_count);
+
 void stree_summary(FILE * fp_out, char ** species_names, long species_count);
 
 long getlinecount(const char * filename);
 
 /* functions in summary11.c */
 
+void mixed_summary_init(void);
+
+void mixed_summary_add(const stree_t * stree, long ndspecies);
+
+void mixed_summary_dump(FILE * fp);
+
+void mixed_summary_load(FILE * fp);
+
+void mixed_summary_snapshot(FILE * fp, long max_count);
+
 void mixed_summary(FILE * fp_out);
 
 /* functions in hardware.c */
@@ -1005,6 +1234,183 @@ unsigned long ** diploid_resolve(stree_t * stree,
                                  int msa_count,
                                  const unsigned int * map);
 
+void diploid_update_maplist(stree_t * stree, list_t * maplist);
+
+/* functions in datacache.c */
+
+int datacache_usable(stree_t * stree);
+
+uint64_t datacache_key(stree_t * stree);
+
+FILE * datacache_create(uint64_t key, long msa_count);
+
+void datacache_write_msa(FILE * fp,
+                         msa_t ** msa_list,
+                         unsigned int ** weights,
+                         long msa_count);
+
+void datacache_write_phased(FILE * fp,
+                            msa_t ** msa_list,
+                            unsigned long ** resolution_count,
+                            unsigned long ** mapping,
+                            int * unphased_length,
+                            long msa_count);
+
+void datacache_close(FILE * fp);
+
+int datacache_load(uint64_t key,
+                   msa_t *** msa_list,
+                   unsigned int *** weights,
+                   msa_t *** phased_list,
+                   unsigned long *** resolution_count,
+                   unsigned long *** mapping,
+                   long * msa_count);
+
+/* functions in mcmcbin.c */
+
+void mcmcbin_init(FILE * fp, char ** labels, long cols);
+
+void mcmcbin_resume(long cols);
+
+void mcmcbin_append(long stream, long gen, const double * values);
+
+void mcmcbin_flush(long stream);
+
+void mcmcbin_fini(long stream);
+
+int mcmcbin_detect(const char * filename);
+
+long mcmcbin_samplecount(const char * filename);
+
+long mcmcbin_load(const char * filename,
+                  long cols,
+                  long max_rows,
+                  double ** matrix,
+                  char ** header);
+
+void mcmcbin_export(const char * filename, FILE * fp);
+
+/* functions in gtreefile.c */
+
+void gtreefile_header(FILE * fp, long locus_count);
+
+void gtreefile_append(long stream, long sample, gtree_t ** gtree, long count);
+
+void gtreefile_fini(void);
+
+long gtreefile_extract(const char * filename);
+
+/* functions in ntree.c */
+
+ntree_t * ntree_create(char ** labels, long count);
+
+void ntree_destroy(ntree_t * t);
+
+const char * ntree_parse(ntree_t * t, const char * s);
+
+void ntree_import_stree(ntree_t * t, const stree_t * stree);
+
+void ntree_sort(ntree_t * t);
+
+size_t ntree_export_topology(const ntree_t * t, char ** buffer, size_t * maxsize);
+
+/* functions in writer.c */
+
+void writer_init(void);
+
+long writer_open(FILE * fp);
+
+void writer_write(long stream, const void * data, size_t size);
+
+void writer_printf(long stream, const char * format, ...);
+
+void * writer_reserve(long stream, writer_cb_t cb, size_t size);
+
+void writer_commit(void);
+
+void writer_sync(void);
+
+long writer_tell(long stream);
+
+void writer_fini(void);
+
+/* functions in prof.c */
+
+extern long prof_active;
+extern long prof_logl_count;
+extern long prof_partials_count;
+
+void prof_init(locus_t ** locus, long locus_count);
+
+void prof_begin(void);
+
+void prof_end(long move);
+
+void prof_locus_begin(void);
+
+void prof_locus_end(long index, long move, long proposed, long accepted);
+
+void prof_step(unsigned long step);
+
+void prof_print(FILE * fp);
+
+void prof_fini(void);
+
+void prof_run_start(void);
+
+void prof_run_first(unsigned long step);
+
+void prof_run_print(FILE * fp, unsigned long step);
+
+int64_t prof_clock(void);
+
+/* functions in perfcnt.c */
+
+void perfcnt_init(void);
+
+int64_t perfcnt_begin(void);
+
+void perfcnt_end(long kernel,
+                 int64_t start,
+                 unsigned int states,
+                 unsigned int sites,
+                 unsigned int rate_cats);
+
+void perfcnt_print(FILE * fp);
+
+void perfcnt_fini(void);
+
+/* functions in status.c */
+
+void status_init(unsigned long step, unsigned long total);
+
+void status_checkpoint(int64_t nsec);
+
+void status_update(unsigned long step,
+                   const double * pjump,
+                   long pjump_count,
+                   double pjump_rj,
+                   double pjump_sspr,
+                   double mean_logl,
+                   int final);
+
+/* functions in trace.c */
+
+void trace_init(void);
+
+void trace_thread(const char * name);
+
+void trace_step(unsigned long step);
+
+int64_t trace_begin(void);
+
+void trace_end(const char * name,
+               int64_t start,
+               const char * arg_name,
+               long arg);
+
+void trace_fini(void);
+
 /* functions in dump.c */
 
 int checkpoint_dump(stree_t * stree,
@@ -1031,6 +1437,10 @@ int checkpoint_dump(stree_t * stree,
                     long mean_tau_count,
                     long mean_theta_count);
 
+void checkpoint_wait(void);
+
+size_t chk_write(const void * data, size_t size, size_t n, FILE * fp);
+
 /* functions in load.c */
 
 int checkpoint_load(gtree_t *** gtreep,
@@ -1058,6 +1468,8 @@ int checkpoint_load(gtree_t *** gtreep,
 
 void checkpoint_truncate(const char * filename, long mcmc_offset);
 
+size_t chk_read(void * data, size_t size, size_t n, FILE * fp);
+
 /* functions in core_partials.c */
 
 void pll_core_update_partial_tt_4x4(unsigned int sites,
@@ -1207,6 +1619,10 @@ void revolutionary_spr_tselect_logl(gnode_t * mnode,
 
 void cmd_run(void);
 
+/* functions in simulate.c */
+
+void cmd_simulate(void);
+
 ///* functions in method_00.c */
 //
 //void cmd_a00(void);
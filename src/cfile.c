@@ -353,6 +353,64 @@ l_unwind:
   return ret;
 }
 
+/* profile = 0|1 [step] */
+static long parse_profile(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  count = get_long(p, &opt_profile);
+  if (!count || (opt_profile != 0 && opt_profile != 1)) goto l_unwind;
+
+  p += count;
+
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  count = get_long(p, &opt_profile_step);
+  if (!count || opt_profile_step <= 0) goto l_unwind;
+
+  p += count;
+
+  if (is_emptyline(p)) ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
+/* trace = from to */
+static long parse_trace(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  count = get_long(p, &opt_trace_from);
+  if (!count || opt_trace_from <= 0) goto l_unwind;
+
+  p += count;
+
+  count = get_long(p, &opt_trace_to);
+  if (!count || opt_trace_to < opt_trace_from) goto l_unwind;
+
+  p += count;
+
+  if (is_emptyline(p)) ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
 static long parse_speciesdelimitation(const char * line)
 {
   long ret = 0;
@@ -905,6 +963,10 @@ static void check_validity()
   if (opt_burnin < 0)
     fatal("Option 'burnin' must be a positive integer or zero");
 
+  if (opt_mcmc_binary && opt_method != METHOD_00)
+    fatal("Option 'mcmcbinary' is only available for fixed species trees "
+          "without species delimitation");
+
   /* species delimitation specific checks */
   if (opt_method == METHOD_10)          /* species delimitation */
   {
@@ -930,6 +992,37 @@ static void check_validity()
   }
 }
 
+/* checks for control files given to --simulate */
+static void check_simulate_validity()
+{
+  long i;
+
+  if (!opt_streenewick)
+    fatal("Species tree newick format is required in 'species&tree'");
+
+  if (!opt_msafile)
+    fatal("Option 'seqfile' is required");
+
+  if (species_count > 1 && !opt_mapfile)
+    fatal("Option 'Imapfile' is required");
+
+  if (opt_locus_count < 1)
+    fatal("Option 'nloci' must be a positive integer greater than zero");
+
+  if (!opt_simulate_sites)
+    fatal("Option 'nsites' is required");
+
+  if (opt_theta_alpha <= 1)
+    fatal("Alpha value of Inv-Gamma(a,b) of thetaprior must be > 1");
+
+  if (opt_theta_beta <= 0)
+    fatal("Beta value of Inv-Gamma(a,b) of thetaprior must be > 0");
+
+  for (i = 0; opt_diploid && i < opt_diploid_size; ++i)
+    if (opt_diploid[i])
+      fatal("Simulation of diploid sequences is not supported");
+}
+
 void load_cfile()
 {
   FILE * fp;
@@ -995,6 +1088,13 @@ void load_cfile()
                 line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"trace",5))
+      {
+        if (!parse_trace(value))
+          fatal("Option 'trace' expects two positive integers, the first and "
+                "last step of the traced window (line %ld)", line_count);
+        valid = 1;
+      }
       else if (!strncasecmp(token,"print",5))
       {
         if (!parse_print(value))
@@ -1019,16 +1119,44 @@ void load_cfile()
                  line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"status",6))
+      {
+        if (!parse_long(value,&opt_status_interval) || opt_status_interval <= 0)
+          fatal("Option 'status' expects a positive number of seconds "
+                "(line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"nsites",6))
+      {
+        if (!parse_long(value,&opt_simulate_sites) || opt_simulate_sites <= 0)
+          fatal("Option 'nsites' expects a positive integer (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 7)
     {
-      if (!strncasecmp(token,"diploid",7))
+      if (!strncasecmp(token,"profile",7))
+      {
+        if (!parse_profile(value))
+          fatal("Option 'profile' expects value 0 or 1, optionally followed "
+                "by a positive step interval (line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"diploid",7))
       {
         if (!parse_diploid(value))
           fatal("Option %s expects values 0 or 1 for each species (line %ld)",
                 token,line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"threads",7))
+      {
+        if (!parse_long(value,&opt_threads) || opt_threads < 0)
+          fatal("Option 'threads' expects a positive integer or zero (line %ld)",
+                line_count);
+        valid = 1;
+      }
       else if (!strncasecmp(token,"seqfile",7))
       {
         if (!get_string(value, &opt_msafile))
@@ -1108,7 +1236,15 @@ void load_cfile()
     }
     else if (token_len == 9)
     {
-      if (!strncasecmp(token,"cleandata",9))
+      if (!strncasecmp(token,"datacache",9))
+      {
+        if (!parse_long(value,&opt_datacache) ||
+            (opt_datacache != 0 && opt_datacache != 1))
+          fatal("Option 'datacache' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"cleandata",9))
       {
         if (!parse_long(value,&opt_cleandata) ||
             (opt_cleandata != 0 && opt_cleandata != 1))
@@ -1132,6 +1268,14 @@ void load_cfile()
                 line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"mcmcbinary",10))
+      {
+        if (!parse_long(value,&opt_mcmc_binary) ||
+            (opt_mcmc_binary != 0 && opt_mcmc_binary != 1))
+          fatal("Option 'mcmcbinary' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
       else if (!strncasecmp(token,"checkpoint",10))
       {
         if (!parse_checkpoint(value))
@@ -1201,6 +1345,49 @@ void load_cfile()
         fatal("Not implemented (%s)", token);
         valid = 1;
       }
+      else if (!strncasecmp(token,"summarymemory",13))
+      {
+        if (!parse_long(value,&opt_summary_memory) || opt_summary_memory < 0)
+          fatal("Option 'summarymemory' expects a positive integer (MB) or "
+                "zero (line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"checkpointclv",13))
+      {
+        if (!parse_long(value,&opt_checkpoint_clv) ||
+            (opt_checkpoint_clv != 0 && opt_checkpoint_clv != 1))
+          fatal("Option 'checkpointclv' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
+    }
+    else if (token_len == 14)
+    {
+      if (!strncasecmp(token,"checkpointtime",14))
+      {
+        if (!parse_long(value,&opt_checkpoint_interval) ||
+            opt_checkpoint_interval <= 0)
+          fatal("Option 'checkpointtime' expects a positive integer "
+                "(seconds) (line %ld)", line_count);
+        opt_checkpoint = 1;
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"checkpointfork",14))
+      {
+        if (!parse_long(value,&opt_checkpoint_fork) ||
+            (opt_checkpoint_fork != 0 && opt_checkpoint_fork != 1))
+          fatal("Option 'checkpointfork' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"gtreecontainer",14))
+      {
+        if (!parse_long(value,&opt_gtree_container) ||
+            (opt_gtree_container != 0 && opt_gtree_container != 1))
+          fatal("Option 'gtreecontainer' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 15)
     {
@@ -1252,7 +1439,10 @@ void load_cfile()
   else
     opt_method = METHOD_11;
 
-  check_validity();
+  if (opt_simulate)
+    check_simulate_validity();
+  else
+    check_validity();
 
   if (opt_diploid)
     update_sp_seqcount();
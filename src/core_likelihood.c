@@ -21,17 +21,17 @@
 
 #include "bpp.h"
 
-double pll_core_root_loglikelihood(unsigned int states,
-                                   unsigned int sites,
-                                   unsigned int rate_cats,
-                                   const double * clv,
-                                   const unsigned int * scaler,
-                                   double * const * frequencies,
-                                   const double * rate_weights,
-                                   const unsigned int * pattern_weights,
-                                   const unsigned int * freqs_indices,
-                                   double * persite_lnl,
-                                   unsigned int attrib)
+static double root_loglikelihood(unsigned int states,
+                                 unsigned int sites,
+                                 unsigned int rate_cats,
+                                 const double * clv,
+                                 const unsigned int * scaler,
+                                 double * const * frequencies,
+                                 const double * rate_weights,
+                                 const unsigned int * pattern_weights,
+                                 const unsigned int * freqs_indices,
+                                 double * persite_lnl,
+                                 unsigned int attrib)
 {
   unsigned int i,j,k;
   double logl = 0;
@@ -178,17 +178,48 @@ double pll_core_root_loglikelihood(unsigned int states,
   return logl;
 }
 
-void pll_core_root_likelihood_vector(unsigned int states,
-                                     unsigned int sites,
-                                     unsigned int rate_cats,
-                                     const double * clv,
-                                     const unsigned int * scaler,
-                                     double * const * frequencies,
-                                     const double * rate_weights,
-                                     const unsigned int * pattern_weights,
-                                     const unsigned int * freqs_indices,
-                                     double * persite_lh,
-                                     unsigned int attrib)
+double pll_core_root_loglikelihood(unsigned int states,
+                                   unsigned int sites,
+                                   unsigned int rate_cats,
+                                   const double * clv,
+                                   const unsigned int * scaler,
+                                   double * const * frequencies,
+                                   const double * rate_weights,
+                                   const unsigned int * pattern_weights,
+                                   const unsigned int * freqs_indices,
+                                   double * persite_lnl,
+                                   unsigned int attrib)
+{
+  int64_t start = perfcnt_begin();
+
+  double logl = root_loglikelihood(states,
+                                   sites,
+                                   rate_cats,
+                                   clv,
+                                   scaler,
+                                   frequencies,
+                                   rate_weights,
+                                   pattern_weights,
+                                   freqs_indices,
+                                   persite_lnl,
+                                   attrib);
+
+  perfcnt_end(PERFCNT_ROOT_LOGL,start,states,sites,rate_cats);
+
+  return logl;
+}
+
+static void root_likelihood_vector(unsigned int states,
+                                   unsigned int sites,
+                                   unsigned int rate_cats,
+                                   const double * clv,
+                                   const unsigned int * scaler,
+                                   double * const * frequencies,
+                                   const double * rate_weights,
+                                   const unsigned int * pattern_weights,
+                                   const unsigned int * freqs_indices,
+                                   double * persite_lh,
+                                   unsigned int attrib)
 {
   unsigned int i,j,k;
   //double logl = 0;
@@ -340,3 +371,32 @@ void pll_core_root_likelihood_vector(unsigned int states,
   }
 }
 
+void pll_core_root_likelihood_vector(unsigned int states,
+                                     unsigned int sites,
+                                     unsigned int rate_cats,
+                                     const double * clv,
+                                     const unsigned int * scaler,
+                                     double * const * frequencies,
+                                     const double * rate_weights,
+                                     const unsigned int * pattern_weights,
+                                     const unsigned int * freqs_indices,
+                                     double * persite_lh,
+                                     unsigned int attrib)
+{
+  int64_t start = perfcnt_begin();
+
+  root_likelihood_vector(states,
+                         sites,
+                         rate_cats,
+                         clv,
+                         scaler,
+                         frequencies,
+                         rate_weights,
+                         pattern_weights,
+                         freqs_indices,
+                         persite_lh,
+                         attrib);
+
+  perfcnt_end(PERFCNT_ROOT_VECTOR,start,states,sites,rate_cats);
+}
+
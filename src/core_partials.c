@@ -79,17 +79,17 @@ void pll_core_update_partial_tt_4x4(unsigned int sites,
   }
 }
 
-void pll_core_update_partial_tt(unsigned int states,
-                                unsigned int sites,
-                                unsigned int rate_cats,
-                                double * parent_clv,
-                                unsigned int * parent_scaler,
-                                const unsigned char * left_tipchars,
-                                const unsigned char * right_tipchars,
-                                const unsigned int * tipmap,
-                                unsigned int tipmap_size,
-                                const double * lookup,
-                                unsigned int attrib)
+static void update_partial_tt(unsigned int states,
+                              unsigned int sites,
+                              unsigned int rate_cats,
+                              double * parent_clv,
+                              unsigned int * parent_scaler,
+                              const unsigned char * left_tipchars,
+                              const unsigned char * right_tipchars,
+                              const unsigned int * tipmap,
+                              unsigned int tipmap_size,
+                              const double * lookup,
+                              unsigned int attrib)
 {
   unsigned int j,k,n;
   const double * offset;
@@ -199,6 +199,35 @@ void pll_core_update_partial_tt(unsigned int states,
   }
 }
 
+void pll_core_update_partial_tt(unsigned int states,
+                                unsigned int sites,
+                                unsigned int rate_cats,
+                                double * parent_clv,
+                                unsigned int * parent_scaler,
+                                const unsigned char * left_tipchars,
+                                const unsigned char * right_tipchars,
+                                const unsigned int * tipmap,
+                                unsigned int tipmap_size,
+                                const double * lookup,
+                                unsigned int attrib)
+{
+  int64_t start = perfcnt_begin();
+
+  update_partial_tt(states,
+                    sites,
+                    rate_cats,
+                    parent_clv,
+                    parent_scaler,
+                    left_tipchars,
+                    right_tipchars,
+                    tipmap,
+                    tipmap_size,
+                    lookup,
+                    attrib);
+
+  perfcnt_end(PERFCNT_PARTIAL_TT,start,states,sites,rate_cats);
+}
+
 void pll_core_update_partial_ti_4x4(unsigned int sites,
                                     unsigned int rate_cats,
                                     double * parent_clv,
@@ -351,19 +380,19 @@ void pll_core_update_partial_ti_4x4(unsigned int sites,
   }
 }
 
-void pll_core_update_partial_ti(unsigned int states,
-                                unsigned int sites,
-                                unsigned int rate_cats,
-                                double * parent_clv,
-                                unsigned int * parent_scaler,
-                                const unsigned char * left_tipchars,
-                                const double * right_clv,
-                                const double * left_matrix,
-                                const double * right_matrix,
-                                const unsigned int * right_scaler,
-                                const unsigned int * tipmap,
-                                unsigned int tipmap_size,
-                                unsigned int attrib)
+static void update_partial_ti(unsigned int states,
+                              unsigned int sites,
+                              unsigned int rate_cats,
+                              double * parent_clv,
+                              unsigned int * parent_scaler,
+                              const unsigned char * left_tipchars,
+                              const double * right_clv,
+                              const double * left_matrix,
+                              const double * right_matrix,
+                              const unsigned int * right_scaler,
+                              const unsigned int * tipmap,
+                              unsigned int tipmap_size,
+                              unsigned int attrib)
 {
   int scaling;
   unsigned int i,j,k,n;
@@ -507,18 +536,51 @@ void pll_core_update_partial_ti(unsigned int states,
   }
 }
 
-void pll_core_update_partial_ii(unsigned int states,
+void pll_core_update_partial_ti(unsigned int states,
                                 unsigned int sites,
                                 unsigned int rate_cats,
                                 double * parent_clv,
                                 unsigned int * parent_scaler,
-                                const double * left_clv,
+                                const unsigned char * left_tipchars,
                                 const double * right_clv,
                                 const double * left_matrix,
                                 const double * right_matrix,
-                                const unsigned int * left_scaler,
                                 const unsigned int * right_scaler,
+                                const unsigned int * tipmap,
+                                unsigned int tipmap_size,
                                 unsigned int attrib)
+{
+  int64_t start = perfcnt_begin();
+
+  update_partial_ti(states,
+                    sites,
+                    rate_cats,
+                    parent_clv,
+                    parent_scaler,
+                    left_tipchars,
+                    right_clv,
+                    left_matrix,
+                    right_matrix,
+                    right_scaler,
+                    tipmap,
+                    tipmap_size,
+                    attrib);
+
+  perfcnt_end(PERFCNT_PARTIAL_TI,start,states,sites,rate_cats);
+}
+
+static void update_partial_ii(unsigned int states,
+                              unsigned int sites,
+                              unsigned int rate_cats,
+                              double * parent_clv,
+                              unsigned int * parent_scaler,
+                              const double * left_clv,
+                              const double * right_clv,
+                              const double * left_matrix,
+                              const double * right_matrix,
+                              const unsigned int * left_scaler,
+                              const unsigned int * right_scaler,
+                              unsigned int attrib)
 {
   unsigned int i,j,k,n;
 
@@ -662,6 +724,37 @@ void pll_core_update_partial_ii(unsigned int states,
   }
 }
 
+void pll_core_update_partial_ii(unsigned int states,
+                                unsigned int sites,
+                                unsigned int rate_cats,
+                                double * parent_clv,
+                                unsigned int * parent_scaler,
+                                const double * left_clv,
+                                const double * right_clv,
+                                const double * left_matrix,
+                                const double * right_matrix,
+                                const unsigned int * left_scaler,
+                                const unsigned int * right_scaler,
+                                unsigned int attrib)
+{
+  int64_t start = perfcnt_begin();
+
+  update_partial_ii(states,
+                    sites,
+                    rate_cats,
+                    parent_clv,
+                    parent_scaler,
+                    left_clv,
+                    right_clv,
+                    left_matrix,
+                    right_matrix,
+                    left_scaler,
+                    right_scaler,
+                    attrib);
+
+  perfcnt_end(PERFCNT_PARTIAL_II,start,states,sites,rate_cats);
+}
+
 void pll_core_create_lookup_4x4(unsigned int rate_cats,
                                 double * lookup,
                                 const double * left_matrix,
@@ -0,0 +1,426 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Preprocessed-data cache. The file <seqfile>.bppcache holds the compressed
+   alignments (A1) with their pattern weights and, if diploid sequences are
+   used, the phased alignments (A3) with the A1->A2 resolution counts and
+   A2->A3 mappings. It is keyed by a hash of the sequence and Imap file
+   contents and of all options that affect preprocessing.
+
+   Layout: magic, version, sizeof(int/long), key, locus count, A1 section,
+   phased flag, and optionally the A3 section */
+
+#define CACHE_MAGIC   "BPPC"
+#define CACHE_VERSION 1
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+static uint64_t fnv_update(uint64_t hash, const void * data, size_t size)
+{
+  size_t i;
+  const unsigned char * p = (const unsigned char *)data;
+
+  for (i = 0; i < size; ++i)
+  {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static uint64_t fnv_update_file(uint64_t hash, const char * filename)
+{
+  size_t n;
+  char buffer[65536];
+  FILE * fp = xopen(filename,"rb");
+
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)))
+    hash = fnv_update(hash, buffer, n);
+
+  fclose(fp);
+
+  return hash;
+}
+
+static char * cache_filename()
+{
+  char * s = NULL;
+
+  xasprintf(&s, "%s.bppcache", opt_msafile);
+
+  return s;
+}
+
+static int is_regular_file(const char * filename)
+{
+  struct stat st;
+
+  return !stat(filename,&st) && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+/* the key is computed from the contents of the input files before they are
+   parsed, hence the cache cannot be used when they are pipes or FIFOs */
+int datacache_usable(stree_t * stree)
+{
+  if (is_regular_file(opt_msafile) &&
+      (stree->tip_count == 1 || is_regular_file(opt_mapfile)))
+    return 1;
+
+  fprintf(stderr, "WARNING: Data cache is disabled, as the sequence or Imap "
+          "file is not a regular file\n");
+  return 0;
+}
+
+uint64_t datacache_key(stree_t * stree)
+{
+  unsigned int i;
+  long version = CACHE_VERSION;
+  uint64_t hash = FNV_OFFSET;
+
+  hash = fnv_update(hash, &version, sizeof(long));
+
+  /* input files */
+  hash = fnv_update_file(hash, opt_msafile);
+  if (stree->tip_count > 1)
+    hash = fnv_update_file(hash, opt_mapfile);
+
+  /* options affecting preprocessing */
+  hash = fnv_update(hash, &opt_cleandata, sizeof(long));
+  hash = fnv_update(hash, &opt_locus_count, sizeof(long));
+  for (i = 0; i < stree->tip_count; ++i)
+  {
+    hash = fnv_update(hash,
+                      stree->nodes[i]->label,
+                      strlen(stree->nodes[i]->label)+1);
+    hash = fnv_update(hash,
+                      &(stree->nodes[i]->diploid),
+                      sizeof(stree->nodes[i]->diploid));
+  }
+
+  return hash;
+}
+
+FILE * datacache_create(uint64_t key, long msa_count)
+{
+  BYTE size_type;
+  int version = CACHE_VERSION;
+  char * filename = cache_filename();
+  char * tmpname = NULL;
+
+  /* write to a temporary file and rename it once complete */
+  xasprintf(&tmpname, "%s.tmp", filename);
+  FILE * fp = fopen(tmpname, "wb");
+  free(filename);
+  free(tmpname);
+
+  if (!fp)
+    return NULL;
+
+  DUMP(CACHE_MAGIC,4,fp);
+  DUMP(&version,1,fp);
+  size_type = (BYTE)sizeof(int);
+  DUMP(&size_type,1,fp);
+  size_type = (BYTE)sizeof(long);
+  DUMP(&size_type,1,fp);
+  DUMP(&key,1,fp);
+  DUMP(&msa_count,1,fp);
+
+  return fp;
+}
+
+static void write_alignment(FILE * fp, msa_t * msa)
+{
+  int i;
+
+  DUMP(&(msa->count),1,fp);
+  DUMP(&(msa->length),1,fp);
+  DUMP(&(msa->original_length),1,fp);
+  DUMP(&(msa->amb_sites_count),1,fp);
+
+  for (i = 0; i < msa->count; ++i)
+  {
+    int len = (int)strlen(msa->label[i]);
+    DUMP(&len,1,fp);
+    DUMP(msa->label[i],len,fp);
+  }
+  for (i = 0; i < msa->count; ++i)
+    DUMP(msa->sequence[i],msa->length,fp);
+}
+
+void datacache_write_msa(FILE * fp,
+                         msa_t ** msa_list,
+                         unsigned int ** weights,
+                         long msa_count)
+{
+  long i;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    write_alignment(fp,msa_list[i]);
+    DUMP(weights[i],msa_list[i]->length,fp);
+  }
+}
+
+void datacache_write_phased(FILE * fp,
+                            msa_t ** msa_list,
+                            unsigned long ** resolution_count,
+                            unsigned long ** mapping,
+                            int * unphased_length,
+                            long msa_count)
+{
+  long i,j;
+  BYTE phased = 1;
+
+  DUMP(&phased,1,fp);
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    size_t sites_a2 = 0;
+
+    write_alignment(fp,msa_list[i]);
+
+    /* resolution count (A1 -> A2) and mapping (A2 -> A3) */
+    for (j = 0; j < unphased_length[i]; ++j)
+      sites_a2 += resolution_count[i][j];
+
+    DUMP(resolution_count[i],unphased_length[i],fp);
+    DUMP(mapping[i],sites_a2,fp);
+  }
+}
+
+void datacache_close(FILE * fp)
+{
+  char * filename = cache_filename();
+  char * tmpname = NULL;
+
+  xasprintf(&tmpname, "%s.tmp", filename);
+
+  if (fclose(fp) || rename(tmpname,filename))
+  {
+    fprintf(stderr, "WARNING: Unable to write data cache %s\n", filename);
+    remove(tmpname);
+  }
+
+  free(filename);
+  free(tmpname);
+}
+
+static msa_t * read_alignment(mapfile_t * rd)
+{
+  int i,len;
+  const char * p;
+
+  msa_t * msa = (msa_t *)xcalloc(1,sizeof(msa_t));
+
+  if (!mapfile_read(rd,&msa->count,sizeof(int)) ||
+      !mapfile_read(rd,&msa->length,sizeof(int)) ||
+      !mapfile_read(rd,&msa->original_length,sizeof(int)) ||
+      !mapfile_read(rd,&msa->amb_sites_count,sizeof(int)) ||
+      msa->count <= 0 || msa->length < 0)
+  {
+    free(msa);
+    return NULL;
+  }
+
+  msa->label = (char **)xcalloc((size_t)(msa->count),sizeof(char *));
+  msa->sequence = (char **)xcalloc((size_t)(msa->count),sizeof(char *));
+
+  for (i = 0; i < msa->count; ++i)
+  {
+    if (!mapfile_read(rd,&len,sizeof(int)) || len < 0 ||
+        !(p = mapfile_take(rd,(size_t)len)))
+    {
+      msa_destroy(msa);
+      return NULL;
+    }
+    msa->label[i] = (char *)xmalloc((size_t)(len+1)*sizeof(char));
+    memcpy(msa->label[i],p,(size_t)len);
+    msa->label[i][len] = 0;
+  }
+
+  for (i = 0; i < msa->count; ++i)
+  {
+    if (!(p = mapfile_take(rd,(size_t)(msa->length))))
+    {
+      msa_destroy(msa);
+      return NULL;
+    }
+    msa->sequence[i] = (char *)xmalloc((size_t)(msa->length+1)*sizeof(char));
+    memcpy(msa->sequence[i],p,(size_t)(msa->length));
+    msa->sequence[i][msa->length] = 0;
+  }
+
+  return msa;
+}
+
+static int load_sections(mapfile_t * rd,
+                         long msa_count,
+                         msa_t ** msa_list,
+                         unsigned int ** weights,
+                         msa_t *** phased_list,
+                         unsigned long *** resolution_count,
+                         unsigned long *** mapping)
+{
+  long i,j;
+  const void * p;
+
+  /* compressed alignments and pattern weights */
+  for (i = 0; i < msa_count; ++i)
+  {
+    if (!(msa_list[i] = read_alignment(rd)))
+      return 0;
+
+    size_t size = msa_list[i]->length*sizeof(unsigned int);
+    if (!(p = mapfile_take(rd,size)))
+      return 0;
+    weights[i] = (unsigned int *)xmalloc(size);
+    memcpy(weights[i],p,size);
+  }
+
+  /* phased alignments follow a marker byte, if present */
+  if (!(p = mapfile_take(rd,1)))
+    return 1;
+  if (*(const BYTE *)p != 1)
+    return 0;
+
+  *phased_list = (msa_t **)xcalloc((size_t)msa_count,sizeof(msa_t *));
+  *resolution_count = (unsigned long **)xcalloc((size_t)msa_count,
+                                                sizeof(unsigned long *));
+  *mapping = (unsigned long **)xcalloc((size_t)msa_count,
+                                       sizeof(unsigned long *));
+  for (i = 0; i < msa_count; ++i)
+  {
+    size_t sites_a2 = 0;
+    size_t size = msa_list[i]->length*sizeof(unsigned long);
+
+    if (!((*phased_list)[i] = read_alignment(rd)))
+      return 0;
+
+    if (!(p = mapfile_take(rd,size)))
+      return 0;
+    (*resolution_count)[i] = (unsigned long *)xmalloc(size);
+    memcpy((*resolution_count)[i],p,size);
+
+    for (j = 0; j < msa_list[i]->length; ++j)
+      sites_a2 += (*resolution_count)[i][j];
+
+    size = sites_a2*sizeof(unsigned long);
+    if (!(p = mapfile_take(rd,size)))
+      return 0;
+    (*mapping)[i] = (unsigned long *)xmalloc(size);
+    memcpy((*mapping)[i],p,size);
+  }
+
+  return 1;
+}
+
+/* Restore preprocessed data from the cache file if it exists and its key
+   matches. Returns 0 (and leaves all output parameters untouched) otherwise */
+int datacache_load(uint64_t key,
+                   msa_t *** msa_list,
+                   unsigned int *** weights,
+                   msa_t *** phased_list,
+                   unsigned long *** resolution_count,
+                   unsigned long *** mapping,
+                   long * msa_count)
+{
+  long i;
+  long count;
+  int version;
+  uint64_t filekey;
+  mapfile_t rd;
+  const char * p;
+  char * filename = cache_filename();
+
+  msa_t ** msa = NULL;
+  unsigned int ** w = NULL;
+  msa_t ** phased = NULL;
+  unsigned long ** rc = NULL;
+  unsigned long ** map = NULL;
+
+  int ok = mapfile_open(&rd,filename);
+  free(filename);
+  if (!ok || rd.size < 26)
+  {
+    mapfile_close(&rd);
+    return 0;
+  }
+
+  /* header */
+  p = mapfile_take(&rd,4+sizeof(int)+2);
+  memcpy(&version,p+4,sizeof(int));
+  if (memcmp(p,CACHE_MAGIC,4) || version != CACHE_VERSION ||
+      p[4+sizeof(int)] != sizeof(int) || p[5+sizeof(int)] != sizeof(long))
+    goto l_unwind;
+
+  if (!mapfile_read(&rd,&filekey,sizeof(uint64_t)) || filekey != key)
+    goto l_unwind;
+
+  if (!mapfile_read(&rd,&count,sizeof(long)) || count <= 0)
+    goto l_unwind;
+
+  msa = (msa_t **)xcalloc((size_t)count,sizeof(msa_t *));
+  w = (unsigned int **)xcalloc((size_t)count,sizeof(unsigned int *));
+
+  if (!load_sections(&rd,count,msa,w,&phased,&rc,&map) ||
+      !opt_diploid != !phased || rd.pos != rd.size)
+    goto l_unwind;
+
+  mapfile_close(&rd);
+
+  *msa_list = msa;
+  *weights = w;
+  *phased_list = phased;
+  *resolution_count = rc;
+  *mapping = map;
+  *msa_count = count;
+
+  return 1;
+
+l_unwind:
+  if (msa)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      if (msa[i]) msa_destroy(msa[i]);
+      free(w[i]);
+      if (phased)
+      {
+        if (phased[i]) msa_destroy(phased[i]);
+        free(rc[i]);
+        free(map[i]);
+      }
+    }
+    free(msa);
+    free(w);
+    free(phased);
+    free(rc);
+    free(map);
+  }
+  mapfile_close(&rd);
+  return 0;
+}
@@ -31,6 +31,7 @@ static double * prior_A11 = NULL;
 
 static snode_t ** trav = NULL;
 static int trav_size = 0;
+static char * dmodel_key = NULL;
 
 const char * const * bs_last_addr = NULL;
 
@@ -547,6 +548,7 @@ long delimitations_init(stree_t * stree)
   for (i = 0; i < dmodels_count; ++i)
     dmodels[i] = (char *)xmalloc((trav_size+1)*sizeof(char));
   hist = (long *)xmalloc(dmodels_count * sizeof(long));
+  dmodel_key = (char *)xmalloc((trav_size+1)*sizeof(char));
 
   dprior = (double *)xmalloc(dmodels_count * sizeof(double));
 
@@ -631,6 +633,7 @@ void delimitations_fini()
       free(dmodels[i]);
     free(dmodels);
     free(hist);
+    free(dmodel_key);
     free(dprior);
   }
 
@@ -661,45 +664,54 @@ static double binomial(double n, int k, double * scale)
 
 }
 
-static int fill_lr(snode_t * node, int * lr)
+/* returns the number of speciation events (inner nodes with tau > 0) in the
+   subtree rooted at snode, and multiplies n by the number of ways their
+   ranking interleaves with that of the sister subtree */
+static long histories_recursive(snode_t * snode, double * n)
 {
-  unsigned int i = node->node_index;
-  int rc = 0;
+  long l,r;
+  double y;
 
-  if (lr[i] != -1)
-    return rc;
+  if (!snode->left || snode->tau == 0)
+    return 0;
 
-  if (!node->left || node->tau == 0) 
-  {
-    lr[i] = 0;
-    rc = 1;
-  }
-  else if (lr[node->left->node_index] != -1 && lr[node->right->node_index] != -1)
+  l = histories_recursive(snode->left,n);
+  r = histories_recursive(snode->right,n);
+
+  if (l && r)
   {
-    lr[i] = lr[node->left->node_index] + lr[node->right->node_index] + 1;
-    rc = 1;
+    *n *= binomial(l + r, l, &y);
+    if (y)
+      fatal("y not expected");
   }
 
-  return rc;
+  return l+r+1;
 }
 
-static int histories_recursive(snode_t * snode, int * lr)
+/* For A10 the guide tree is fixed and the labelled histories of every
+   delimitation model are tabulated in delimitations_init, so the count is
+   looked up using the delimitation string of the current model */
+static long histories_cached(stree_t * stree)
 {
-  int rc = 0;
-
-  if (!snode->left)
-    return rc;
+  long i;
+  char ** model;
 
-  rc |= histories_recursive(snode->left,lr);
-  rc |= histories_recursive(snode->right,lr);
+  if (opt_method != METHOD_10 || !hist || trav[0] != stree->root)
+    return histories(stree);
 
-  if (!snode->tau)
-    return rc;
+  for (i = 0; i < trav_size; ++i)
+    dmodel_key[i] = trav[i]->tau > 0 ? '1' : '0';
+  dmodel_key[trav_size] = 0;
 
-  rc |= fill_lr(snode->left,lr);
-  rc |= fill_lr(snode->right,lr);
+  model = (char **)bsearch(dmodel_key,
+                           dmodels,
+                           dmodels_count,
+                           sizeof(char *),
+                           (int(*)(const void *, const void*))cb_strcmp);
+  if (!model)
+    return histories(stree);
 
-  return rc;
+  return hist[model - dmodels];
 }
 
 double lnprior_species_model(stree_t * stree)
@@ -715,7 +727,7 @@ double lnprior_species_model(stree_t * stree)
 
     case BPP_SPECIES_PRIOR_SUNIFORM:
     case BPP_SPECIES_PRIOR_UNIFORM:
-      p = 1.0 / histories(stree);
+      p = 1.0 / histories_cached(stree);
       break;
 
     default:
@@ -743,40 +755,9 @@ double lnprior_species_model(stree_t * stree)
 
 long histories(stree_t * stree)
 {
-  unsigned int i,j,k;
   double n = 1;
-  double y;
-
-  int * lr = (int *)xmalloc((size_t)(stree->tip_count + stree->inner_count) * 
-                            sizeof(int));
-
-  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
-    lr[i] = -1;
-
-  for (i = 0; i < stree->tip_count; ++i)
-  {
-    if (!histories_recursive(stree->root,lr))
-      break;
-  }
-
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
-  {
-    if (stree->nodes[i]->tau == 0) continue;
 
-    j = stree->nodes[i]->left->node_index;
-    k = stree->nodes[i]->right->node_index;
+  histories_recursive(stree->root,&n);
 
-    if (lr[j] == -1 || lr[k] == -1)
-      fatal("Internal error when computing delimitation histories");
-
-    if (lr[j] && lr[k])
-    {
-      n *= binomial(lr[j] + lr[k], lr[j], &y);
-      if (y)
-        fatal("y not expected");
-    }
-
-  }
-  free(lr);
   return (long)n;
 }
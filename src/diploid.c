@@ -616,3 +616,16 @@ unsigned long ** diploid_resolve(stree_t * stree,
 
   return resolution_count;
 }
+
+/* add the phased labels of diploid individuals to the map list without
+   resolving any alignment, i.e. when the phased alignments were restored from
+   the preprocessed-data cache */
+void diploid_update_maplist(stree_t * stree, list_t * maplist)
+{
+  if (stree->tip_count == 1)
+    return;
+
+  diploid_resolution_init(stree,maplist);
+  update_map_list(maplist);
+  diploid_resolution_fini();
+}
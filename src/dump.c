@@ -23,10 +23,75 @@
 
 #define PROP_COUNT 5
 
-#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+#define DUMP(x,n,fp) chk_write((const void *)(x),sizeof(*(x)),n,fp)
 
 static BYTE dummy[256] = {0};
 
+#ifndef _WIN32
+/* process writing the last checkpoint in the background */
+static pid_t checkpoint_pid = 0;
+#endif
+
+/* start offsets and checksums of checkpoint sections, listed in the trailer:
+   header, sections 1-3, one section per locus, and the summary. The checksum
+   of the current section is updated as its data is written */
+static long * section_offset = NULL;
+static unsigned long * section_checksum = NULL;
+static long section_count = 0;
+static long section_maxcount = 0;
+static hash_fnv_stream_t section_hash;
+
+/* write n elements of the given size to the checkpoint */
+size_t chk_write(const void * data, size_t size, size_t n, FILE * fp)
+{
+  size_t count = fwrite(data,size,n,fp);
+
+  hash_fnv_stream_update(&section_hash,data,size*count);
+
+  return count;
+}
+
+/* end the current section (if any) and start a new one */
+static void section_mark(FILE * fp)
+{
+  if (section_count == section_maxcount)
+  {
+    section_maxcount = MAX(2*section_maxcount, 16);
+    section_offset = (long *)xrealloc(section_offset,
+                                      (size_t)section_maxcount*sizeof(long));
+    section_checksum = (unsigned long *)xrealloc(section_checksum,
+                                                 (size_t)section_maxcount *
+                                                 sizeof(unsigned long));
+  }
+  if (section_count)
+    section_checksum[section_count-1] = hash_fnv_stream_final(&section_hash);
+
+  section_offset[section_count++] = ftell(fp);
+  hash_fnv_stream_init(&section_hash);
+}
+
+/* append the table of section offsets, sizes and checksums */
+static void dump_chk_trailer(FILE * fp)
+{
+  long i;
+
+  /* mark end of last section */
+  section_mark(fp);
+
+  for (i = 0; i < section_count-1; ++i)
+  {
+    long size = section_offset[i+1] - section_offset[i];
+
+    DUMP(section_offset+i,1,fp);
+    DUMP(&size,1,fp);
+    DUMP(section_checksum+i,1,fp);
+  }
+
+  long count = section_count-1;
+  DUMP(&count,1,fp);
+  DUMP(CHK_TRAILER_MAGIC,4,fp);
+}
+
 static void dump_chk_header(FILE * fp, stree_t * stree)
 {
   long i;
@@ -126,7 +191,8 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
   size_section += sizeof(unsigned long);              /* MCMC file offset */
   size_section += sizeof(unsigned long);              /* output file offset */
   if (opt_print_genetrees)
-     size_section += opt_locus_count*sizeof(long);    /* gtree file offsets */
+     size_section += (opt_gtree_container ? 1 : opt_locus_count) *
+                     sizeof(long);                    /* gtree file offsets */
 
   size_t pjump_size = PROP_COUNT + (opt_est_locusrate || opt_est_heredity);
 
@@ -145,6 +211,7 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
   size_section += sizeof(double);                     /* opt_heredity_alpha */
   size_section += sizeof(double);                     /* opt_heredity_beta */
   size_section += 4*sizeof(long);                     /* opt_print_* */
+  size_section += sizeof(long);                       /* gtree container */
   if (opt_est_locusrate || opt_est_heredity)
     size_section += sizeof(double);                   /* locusrate finetune */
 
@@ -205,6 +272,9 @@ static void dump_chk_section_1(FILE * fp,
   DUMP(&opt_checkpoint_current,1,fp);
   DUMP(&opt_checkpoint_initial,1,fp);
   DUMP(&opt_checkpoint_step,1,fp);
+  DUMP(&opt_checkpoint_interval,1,fp);
+  DUMP(&opt_checkpoint_fork,1,fp);
+  DUMP(&opt_checkpoint_clv,1,fp);
 
   /* write speciesdelimitation */
   DUMP(&opt_est_delimit,1,fp);
@@ -246,6 +316,7 @@ static void dump_chk_section_1(FILE * fp,
   DUMP(&opt_print_locusrate,1,fp);
   DUMP(&opt_print_hscalars,1,fp);
   DUMP(&opt_print_genetrees,1,fp);
+  DUMP(&opt_gtree_container,1,fp);
 
   /* write theta prior */
   DUMP(&opt_theta_alpha,1,fp);
@@ -306,7 +377,7 @@ static void dump_chk_section_1(FILE * fp,
 
   /* write gtree file offset if available*/
   if (opt_print_genetrees)
-    DUMP(gtree_offset,opt_locus_count,fp);
+    DUMP(gtree_offset,opt_gtree_container ? 1 : opt_locus_count,fp);
 
   DUMP(&dparam_count,1,fp);
 
@@ -453,10 +524,53 @@ static void dump_gene_tree(FILE * fp, gtree_t * gtree)
     DUMP(&(gtree->nodes[i]->mark),1,fp);
 }
 
-static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
+/* pad the file with zeros up to the next CHK_ALIGN boundary */
+static void dump_align(FILE * fp)
 {
+  long pad = (CHK_ALIGN - ftell(fp) % CHK_ALIGN) % CHK_ALIGN;
 
-  long i;
+  DUMP(dummy,pad,fp);
+}
+
+/* check whether the tip CLVs consist of 0/1 entries identical across rate
+   categories, such that each site can be stored as a bitmask of states */
+static int tips_encodable(gtree_t * gtree, locus_t * locus)
+{
+  long i,j,k;
+  long span_site = locus->rate_cats * locus->states_padded;
+
+  if (locus->states > 8) return 0;
+
+  for (i = 0; i < locus->tips; ++i)
+  {
+    const double * clv = locus->clv[gtree->nodes[i]->clv_index];
+
+    for (j = 0; j < locus->sites; ++j)
+    {
+      const double * site = clv + j*span_site;
+
+      for (k = 0; k < locus->states; ++k)
+        if (site[k] != 0 && site[k] != 1)
+          return 0;
+
+      for (k = locus->states; k < locus->states_padded; ++k)
+        if (site[k] != 0)
+          return 0;
+
+      for (k = locus->states_padded; k < span_site; ++k)
+        if (site[k] != site[k % locus->states_padded])
+          return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
+{
+  long i,j,k;
+  long span_site = locus->rate_cats * locus->states_padded;
+  long span = locus->sites * span_site;
 
   /* write number of sites */
   DUMP(&(locus->sites),1,fp);
@@ -515,13 +629,72 @@ static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
     DUMP(locus->pattern_weights,locus->sites,fp);
   }
 
-  /* write tip CLVs */
-  for (i = 0; i < locus->tips; ++i)
+  /* write tips either as per-site state masks or as full CLVs */
+  BYTE tip_encoding = tips_encodable(gtree,locus) ?
+                        CHK_TIPS_STATES : CHK_TIPS_CLV;
+  DUMP(&tip_encoding,1,fp);
+
+  /* write whether inner CLVs, scalers and pmatrices follow */
+  BYTE inner = opt_checkpoint_clv ? 1 : 0;
+  DUMP(&inner,1,fp);
+
+  if (tip_encoding == CHK_TIPS_STATES)
   {
-    unsigned int clv_index = gtree->nodes[i]->clv_index;
-    long span = locus->sites * locus->states * locus->rate_cats;
-    
-    DUMP(locus->clv[clv_index],span,fp);
+    BYTE * mask = (BYTE *)xmalloc(locus->sites * sizeof(BYTE));
+
+    for (i = 0; i < locus->tips; ++i)
+    {
+      const double * clv = locus->clv[gtree->nodes[i]->clv_index];
+
+      for (j = 0; j < locus->sites; ++j)
+      {
+        mask[j] = 0;
+        for (k = 0; k < locus->states; ++k)
+          if (clv[j*span_site+k] == 1)
+            mask[j] |= 1 << k;
+      }
+      DUMP(mask,locus->sites,fp);
+    }
+    free(mask);
+  }
+  else
+  {
+    for (i = 0; i < locus->tips; ++i)
+    {
+      dump_align(fp);
+      DUMP(locus->clv[gtree->nodes[i]->clv_index],span,fp);
+    }
+  }
+
+  if (!inner) return;
+
+  /* write CLVs and scalers of inner nodes, and pmatrices of all branches */
+  for (i = locus->tips; i < gtree->tip_count + gtree->inner_count; ++i)
+  {
+    dump_align(fp);
+    DUMP(locus->clv[gtree->nodes[i]->clv_index],span,fp);
+  }
+
+  if (locus->scale_buffers)
+  {
+    size_t scaler_size = (locus->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           locus->sites * locus->rate_cats : locus->sites;
+
+    for (i = locus->tips; i < gtree->tip_count + gtree->inner_count; ++i)
+    {
+      dump_align(fp);
+      DUMP(locus->scale_buffer[gtree->nodes[i]->scaler_index],scaler_size,fp);
+    }
+  }
+
+  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
+  {
+    if (gtree->nodes[i] == gtree->root) continue;
+
+    dump_align(fp);
+    DUMP(locus->pmatrix[gtree->nodes[i]->pmatrix_index],
+         locus->states * locus->states_padded * locus->rate_cats,
+         fp);
   }
 }
 
@@ -542,11 +715,14 @@ static void dump_chk_section_4(FILE * fp,
 {
   long i;
 
+  /* each locus is a separate section with its data starting at an aligned
+     offset */
   for (i = 0; i < msa_count; ++i)
   {
+    section_mark(fp);
+    dump_align(fp);
     dump_locus(fp,gtree_list[i], locus_list[i]);
   }
-
 }
 
 int checkpoint_dump(stree_t * stree,
@@ -575,24 +751,64 @@ int checkpoint_dump(stree_t * stree,
 {
   FILE * fp;
   char * s = NULL;
+  char * tmp = NULL;
+  int child = 0;
 
   xasprintf(&s, "%s.%ld.chk", opt_outfile, ++opt_checkpoint_current);
+  xasprintf(&tmp, "%s.tmp", s);
 
   fprintf(stdout,"\n\nWriting checkpoint file %s\n\n",s);
 
-  fp = fopen(s,"w");
-  free(s);
+  #ifndef _WIN32
+  /* write from a copy-on-write snapshot of the process, such that sampling
+     continues while the checkpoint is written */
+  if (opt_checkpoint_fork)
+  {
+    checkpoint_wait();
+
+    /* buffered output would otherwise be written by both processes */
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid > 0)
+    {
+      checkpoint_pid = pid;
+      free(s);
+      free(tmp);
+      return 1;
+    }
+
+    if (pid == 0)
+      child = 1;
+    else
+      fprintf(stderr, "WARNING: Cannot fork, writing checkpoint in the "
+                      "foreground\n");
+  }
+  #endif
+
+  /* write to a temporary file and rename it when complete, such that a
+     checkpoint file is never partially written */
+  fp = fopen(tmp,"wb");
   if (!fp)
   {
-    fprintf(stderr, "Cannot open file %s for checkpointing...",s);
+    fprintf(stderr, "Cannot open file %s for checkpointing...",tmp);
+    free(s);
+    free(tmp);
+    if (child)
+      _exit(1);
     return 0;
   }
+  setvbuf(fp, NULL, _IOFBF, 1024*1024);
+
 
+  section_count = 0;
 
   /* write checkpoint header */
+  section_mark(fp);
   dump_chk_header(fp,stree);
 
   /* write section 1 */
+  section_mark(fp);
   dump_chk_section_1(fp,
                      stree,
                      pjump,
@@ -617,15 +833,54 @@ int checkpoint_dump(stree_t * stree,
                      mean_theta_count);
 
   /* write section 2 */
+  section_mark(fp);
   dump_chk_section_2(fp,stree);
 
   /* write section 3 */
+  section_mark(fp);
   dump_chk_section_3(fp,gtree_list,stree->locus_count);
 
   /* write section 4 */
   dump_chk_section_4(fp,gtree_list,locus_list,stree->locus_count);
 
-  fclose(fp);
-  
-  return 1;
+  /* write summary of sampled species trees */
+  section_mark(fp);
+  if (opt_est_stree && !opt_est_delimit)
+    stree_summary_dump(fp);
+  else if (opt_est_stree && opt_est_delimit)
+    mixed_summary_dump(fp);
+
+  dump_chk_trailer(fp);
+
+  int rc = !ferror(fp);
+  if (fclose(fp) || !rc || rename(tmp,s))
+  {
+    fprintf(stderr, "Cannot write checkpoint file %s...", s);
+    rc = 0;
+  }
+
+  free(s);
+  free(tmp);
+
+  /* exit without running atexit handlers or flushing inherited streams */
+  if (child)
+    _exit(rc ? 0 : 1);
+
+  return rc;
+}
+
+/* wait until a checkpoint written in the background is complete */
+void checkpoint_wait()
+{
+  #ifndef _WIN32
+  int status;
+
+  if (!checkpoint_pid) return;
+
+  if (waitpid(checkpoint_pid,&status,0) == -1 ||
+      !WIFEXITED(status) || WEXITSTATUS(status))
+    fprintf(stderr, "WARNING: Background checkpoint writing failed\n");
+
+  checkpoint_pid = 0;
+  #endif
 }
@@ -47,14 +47,6 @@ static double * sortbuffer = NULL;
 
 static gnode_t *** travbuffer = NULL;
 
-#if 0
-
-/* 
-   This functions are purely for debugging. I use them to update all partials
-   (even if not necessary) and to reset the 'leaves' property of gene tree
-   nodes, in order to ensure that computations are correct
-*/
-
 static void all_partials_recursive(gnode_t * node,
                                    unsigned int * trav_size,
                                    gnode_t ** outbuffer)
@@ -69,9 +61,10 @@ static void all_partials_recursive(gnode_t * node,
   *trav_size = *trav_size + 1;
 }
 
-static void gtree_all_partials(gnode_t * root,
-                               gnode_t ** travbuffer,
-                               unsigned int * trav_size)
+/* fill travbuffer with all inner nodes of the gene tree in post-order */
+void gtree_all_partials(gnode_t * root,
+                        gnode_t ** travbuffer,
+                        unsigned int * trav_size)
 {
   *trav_size = 0;
   if (!root->left) return;
@@ -79,6 +72,14 @@ static void gtree_all_partials(gnode_t * root,
   all_partials_recursive(root, trav_size, travbuffer);
 }
 
+#if 0
+
+/* 
+   This functions are purely for debugging. I use them to reset the 'leaves'
+   property of gene tree nodes, in order to ensure that computations are
+   correct
+*/
+
 static void gtree_reset_leaves_recursive(gnode_t * node)
 {
   if (!node->left) return;
@@ -113,41 +114,66 @@ void gtree_reset_leaves(gnode_t * node)
   node->leaves = node->left->leaves + node->right->leaves;
 }
 
-static int return_partials_recursive(gnode_t * node,
+static void dirty_partials_recursive(gnode_t * node,
                                      unsigned int * trav_size,
                                      gnode_t ** outbuffer)
 {
-  int mark = 0;
-
-  if (!node->left)
-    return node->mark & FLAG_PARTIAL_UPDATE;   /* TODO - SHOULD THIS BE 0 ? */
+  if (node->left->mark & FLAG_CLV_DIRTY)
+    dirty_partials_recursive(node->left, trav_size, outbuffer);
+  if (node->right->mark & FLAG_CLV_DIRTY)
+    dirty_partials_recursive(node->right, trav_size, outbuffer);
 
-  mark |= return_partials_recursive(node->left,  trav_size, outbuffer);
-  mark |= return_partials_recursive(node->right, trav_size, outbuffer);
-
-  if ((node->mark & FLAG_PARTIAL_UPDATE) || mark)
-  {
-    outbuffer[*trav_size] = node;
-    *trav_size = *trav_size + 1;
-  }
-
-  return (node->mark & FLAG_PARTIAL_UPDATE) | mark;
+  node->mark &= ~FLAG_CLV_DIRTY;
+  outbuffer[*trav_size] = node;
+  *trav_size = *trav_size + 1;
 }
 
-gnode_t ** gtree_return_partials(gnode_t * root,
-                                 unsigned int msa_index,
-                                 unsigned int * trav_size)
+/* Return, in post-order, the inner nodes whose CLVs are invalidated by
+   updating the transition matrices of the nodes in bl_list, i.e. the union of
+   the root-paths starting from the parents of bl_list. Each path is climbed
+   only until it meets an already visited node, so the cost is proportional to
+   the number of returned nodes rather than the size of the tree. bl_list may
+   point into the returned buffer */
+gnode_t ** gtree_return_dirty_partials(gtree_t * gtree,
+                                       gnode_t ** bl_list,
+                                       unsigned int bl_count,
+                                       unsigned int msa_index,
+                                       unsigned int * trav_size)
 {
+  unsigned int i;
+  gnode_t * node;
   gnode_t ** trav = travbuffer[msa_index];
 
-  *trav_size = 0;
-  if (!root->left) return NULL;
+  for (i = 0; i < bl_count; ++i)
+    for (node = bl_list[i]->parent;
+         node && !(node->mark & FLAG_CLV_DIRTY);
+         node = node->parent)
+      node->mark |= FLAG_CLV_DIRTY;
 
-  return_partials_recursive(root, trav_size, trav);
+  *trav_size = 0;
+  if (gtree->root->mark & FLAG_CLV_DIRTY)
+    dirty_partials_recursive(gtree->root, trav_size, trav);
 
   return trav;
 }
 
+/* flip the CLV (and scaler) buffers of a list of inner nodes. Called once
+   before recomputing their partials, and once more to roll back on rejection */
+void gtree_swap_clv_indices(gtree_t * gtree,
+                            gnode_t ** nodes,
+                            unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i)
+  {
+    nodes[i]->clv_index = SWAP_CLV_INDEX(gtree->tip_count,nodes[i]->clv_index);
+    if (opt_scaling)
+      nodes[i]->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,
+                                                 nodes[i]->scaler_index);
+  }
+}
+
 
 static void gtree_traverse_postorder(gnode_t * node,
                                      int (*cbtrav)(gnode_t *),
@@ -259,122 +285,190 @@ void gtree_destroy(gtree_t * tree,
   free(tree);
 }
 
-static char * export_newick_recursive(const gnode_t * root,
-                                      char * (*cb_serialize)(const gnode_t *))
+/* append the node's label and branch length, or the string returned by the
+   serialization callback */
+static size_t export_newick_node(const gnode_t * node,
+                                 char * (*cb_serialize)(const gnode_t *),
+                                 char ** buffer,
+                                 size_t * maxsize,
+                                 size_t pos)
+{
+  if (cb_serialize)
+  {
+    char * temp = cb_serialize(node);
+    pos = xbuf_append(buffer, maxsize, pos, temp, strlen(temp));
+    free(temp);
+    return pos;
+  }
+
+  if (node->label)
+    pos = xbuf_append(buffer, maxsize, pos, node->label, strlen(node->label));
+  pos = xbuf_append(buffer, maxsize, pos, ":", 1);
+  return xbuf_double(buffer, maxsize, pos, node->length);
+}
+
+static size_t export_newick_recursive(const gnode_t * root,
+                                      char * (*cb_serialize)(const gnode_t *),
+                                      char ** buffer,
+                                      size_t * maxsize,
+                                      size_t pos)
 {
-  char * newick;
-  long size_alloced;
   assert(root != NULL);
 
-  if (!(root->left) || !(root->right))
+  if (root->left && root->right)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    pos = xbuf_append(buffer, maxsize, pos, "(", 1);
+    pos = export_newick_recursive(root->left,cb_serialize,buffer,maxsize,pos);
+    pos = xbuf_append(buffer, maxsize, pos, ",", 1);
+    pos = export_newick_recursive(root->right,cb_serialize,buffer,maxsize,pos);
+    pos = xbuf_append(buffer, maxsize, pos, ")", 1);
   }
-  else
-  {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%f",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed.");
+  return export_newick_node(root,cb_serialize,buffer,maxsize,pos);
+}
 
-  return newick;
+/* append the newick string of the tree rooted at root to a growable buffer
+   at position pos and return the new end position */
+size_t gtree_export_newick_append(const gnode_t * root,
+                                  char * (*cb_serialize)(const gnode_t *),
+                                  char ** buffer,
+                                  size_t * maxsize,
+                                  size_t pos)
+{
+  pos = export_newick_recursive(root,cb_serialize,buffer,maxsize,pos);
+
+  /* terminate inner root unless a callback is used */
+  if (root->left && root->right && !cb_serialize)
+    pos = xbuf_append(buffer, maxsize, pos, ";", 1);
+
+  return pos;
 }
 
 char * gtree_export_newick(const gnode_t * root,
                            char * (*cb_serialize)(const gnode_t *))
 {
-  char * newick;
-  long size_alloced;
+  char * newick = NULL;
+  size_t maxsize = 0;
+
   if (!root) return NULL;
 
-  if (!(root->left) || !(root->right))
+  gtree_export_newick_append(root,cb_serialize,&newick,&maxsize,0);
+
+  return newick;
+}
+
+/* compact copy of a gene tree used to defer newick output to the writer
+   thread. Labels are copied into a string area following the nodes, as the
+   gene trees of species tree inference free and reallocate them */
+typedef struct gsnap_node_s
+{
+  long label;                   /* offset in string area or -1 */
+  double length;
+  int left;
+  int right;
+} gsnap_node_t;
+
+size_t gtree_snapshot_size(const gtree_t * gtree)
+{
+  unsigned int i;
+  unsigned int count = gtree->tip_count + gtree->inner_count;
+  size_t size = 2*sizeof(long) + count*sizeof(gsnap_node_t);
+
+  for (i = 0; i < count; ++i)
+    if (gtree->nodes[i]->label)
+      size += strlen(gtree->nodes[i]->label)+1;
+
+  return size;
+}
+
+void gtree_snapshot(const gtree_t * gtree, void * buffer)
+{
+  unsigned int i;
+  unsigned int count = gtree->tip_count + gtree->inner_count;
+  long * hdr = (long *)buffer;
+  gsnap_node_t * snap = (gsnap_node_t *)(hdr+2);
+  char * strings = (char *)(snap+count);
+  long offset = 0;
+
+  hdr[0] = gtree->root->node_index;
+  hdr[1] = count;
+  for (i = 0; i < count; ++i)
   {
-    if (cb_serialize)
+    const gnode_t * node = gtree->nodes[i];
+
+    if (node->label)
     {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
+      size_t len = strlen(node->label)+1;
+      memcpy(strings+offset, node->label, len);
+      snap[i].label = offset;
+      offset += (long)len;
     }
     else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+      snap[i].label = -1;
+
+    snap[i].length = node->length;
+    snap[i].left   = node->left ? (int)(node->left->node_index) : -1;
+    snap[i].right  = node->right ? (int)(node->right->node_index) : -1;
   }
-  else
-  {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-      fatal("Unable to allocate enough memory.");
+}
 
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-      fatal("Unable to allocate enough memory.");
+static size_t snapshot_newick_recursive(const gsnap_node_t * snap,
+                                        const char * strings,
+                                        long index,
+                                        char ** buffer,
+                                        size_t * maxsize,
+                                        size_t pos)
+{
+  const gsnap_node_t * node = snap+index;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%f;",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
+  if (node->left >= 0 && node->right >= 0)
+  {
+    pos = xbuf_append(buffer, maxsize, pos, "(", 1);
+    pos = snapshot_newick_recursive(snap,strings,node->left,buffer,maxsize,pos);
+    pos = xbuf_append(buffer, maxsize, pos, ",", 1);
+    pos = snapshot_newick_recursive(snap,strings,node->right,buffer,maxsize,pos);
+    pos = xbuf_append(buffer, maxsize, pos, ")", 1);
   }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed");
 
-  return newick;
+  if (node->label >= 0)
+  {
+    const char * label = strings+node->label;
+    pos = xbuf_append(buffer, maxsize, pos, label, strlen(label));
+  }
+
+  pos = xbuf_append(buffer, maxsize, pos, ":", 1);
+  return xbuf_double(buffer, maxsize, pos, node->length);
+}
+
+/* append the snapshot as a newick line in the format of gtree_export_newick
+   to a growable buffer at position pos. Returns the new end position */
+size_t gtree_snapshot_newick(const void * snapshot,
+                             char ** buffer,
+                             size_t * maxsize,
+                             size_t pos)
+{
+  const long * hdr = (const long *)snapshot;
+  const gsnap_node_t * snap = (const gsnap_node_t *)(hdr+2);
+  const char * strings = (const char *)(snap+hdr[1]);
+  long root = hdr[0];
+
+  pos = snapshot_newick_recursive(snap,strings,root,buffer,maxsize,pos);
+  if (snap[root].left >= 0 && snap[root].right >= 0)
+    pos = xbuf_append(buffer, maxsize, pos, ";", 1);
+
+  return xbuf_append(buffer, maxsize, pos, "\n", 1);
+}
+
+/* writer callback printing a snapshot; runs on the writer thread only */
+void gtree_snapshot_print(FILE * fp, const void * buffer, size_t size)
+{
+  static char * line = NULL;
+  static size_t line_maxsize = 0;
+
+  (void)size;
+
+  size_t len = gtree_snapshot_newick(buffer,&line,&line_maxsize,0);
+  fwrite(line, 1, len, fp);
 }
 
 static void fill_nodes_recursive(gnode_t * node, gnode_t ** array)
@@ -645,7 +739,12 @@ static int cb_trav_full(snode_t * x)
   return 1;
 }
 
-static gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
+/* simulate a gene tree drawing uniform variates from rndu (legacy_rndu for
+   the MCMC, sim_rndu for --simulate) */
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         double (*rndu)(void))
 {
   int lineage_count = 0;
   int scaler_index = 0;
@@ -813,7 +912,7 @@ static gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
         break;
 
       /* generate random waiting time from exponential distribution */
-      t += legacy_rndexp(1/sum);
+      t += -(1/sum)*log(rndu());
 
       /* if the generated time is larger than the current epoch, and we are not
          yet at the root of the species tree, then break and, subsequently, 
@@ -827,7 +926,7 @@ static gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
 
       /* select an available population at random using the poisson rates as
          weights */
-      double r = legacy_rndu()*sum;
+      double r = rndu()*sum;
       double tmp = 0;
       for (j = 0; j < pop_count; ++j)
       {
@@ -839,7 +938,7 @@ static gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
 
       /* now choose two lineages from selected population j in exactly the same
          way as the original BPP */
-      k = pop[j].seq_count * (pop[j].seq_count-1) * legacy_rndu();
+      k = pop[j].seq_count * (pop[j].seq_count-1) * rndu();
 
       unsigned int k1 = k / (pop[j].seq_count-1);
       unsigned int k2 = k % (pop[j].seq_count-1);
@@ -1033,15 +1132,43 @@ void gtree_alloc_internals(gtree_t ** gtree, long msa_count)
              1  2 3  4
 
        father moving to 3 or 4, in whih case we need to update 4 CLVs
+
+       Also, the gene tree SPR collects all lineages crossing a time point,
+       which can be as many as the number of tips
     */
 
-    minsize = MAX(gtree[i]->inner_count,4);
+    minsize = MAX(gtree[i]->tip_count,4);
     
     travbuffer[i] = (gnode_t **)xmalloc(minsize*sizeof(gnode_t *));
   }
 
 }
 
+/* set up the hash tables used by gtree_simulate for simulating gene trees
+   outside gtree_init. Once set up, loci can be simulated concurrently */
+void gtree_simulate_init(stree_t * stree, list_t * maplist)
+{
+  if (stree->tip_count == 1)
+  {
+    sht = NULL;
+    mht = NULL;
+  }
+  else
+  {
+    sht = species_hash(stree);
+    mht = maplist_hash(maplist,sht);
+  }
+}
+
+void gtree_simulate_fini(stree_t * stree)
+{
+  if (stree->tip_count > 1)
+  {
+    hashtable_destroy(sht,NULL);
+    hashtable_destroy(mht,cb_dealloc_pairlabel);
+  }
+}
+
 gtree_t ** gtree_init(stree_t * stree,
                       msa_t ** msalist,
                       list_t * maplist,
@@ -1055,29 +1182,16 @@ gtree_t ** gtree_init(stree_t * stree,
   gtree = (gtree_t **)xmalloc((size_t)msa_count*sizeof(gtree_t *));
 
   /* create mapping hash tables */
-  if (stree->tip_count == 1)
-  {
-    sht = NULL;
-    mht = NULL;
-  }
-  else
-  {
-    sht = species_hash(stree);
-    mht = maplist_hash(maplist,sht);
-  }
+  gtree_simulate_init(stree,maplist);
 
   /* generate random starting gene trees for each alignment */
   printf("Generating gene trees....");
   for (i = 0; i < msa_count; ++i)
-    gtree[i] = gtree_simulate(stree, msalist[i],i);
+    gtree[i] = gtree_simulate(stree, msalist[i],i,legacy_rndu);
   printf(" Done\n");
 
   /* destroy the hash tables */
-  if (stree->tip_count > 1)
-  {
-    hashtable_destroy(sht,NULL);
-    hashtable_destroy(mht,cb_dealloc_pairlabel);
-  }
+  gtree_simulate_fini(stree);
 
   /* allocate static internal arrays sortbuffer and travbuffer */
   gtree_alloc_internals(gtree,msa_count);
@@ -1120,6 +1234,19 @@ void logprob_revert_notheta(snode_t * snode, long msa_index)
   snode->notheta_logpr_contrib = snode->notheta_old_logpr_contrib;
 }
 
+static double logprob_notheta_contrib(snode_t * snode)
+{
+  /* MSC density contribution of population snode over all loci when theta is
+     integrated out analytically */
+  if (snode->event_count_sum)
+    return opt_theta_alpha*log(opt_theta_beta) - lgamma(opt_theta_alpha) -
+           (opt_theta_alpha + snode->event_count_sum) *
+           log(opt_theta_beta + snode->t2h_sum) +
+           lgamma(opt_theta_alpha + snode->event_count_sum);
+
+  return -opt_theta_alpha * log(1 + snode->t2h_sum / opt_theta_beta);
+}
+
 double gtree_update_logprob_contrib(snode_t * snode,
                                     double heredity,
                                     long msa_index)
@@ -1199,13 +1326,7 @@ double gtree_update_logprob_contrib(snode_t * snode,
       snode->t2h_sum += snode->t2h[msa_index];
       
 
-      if (snode->event_count_sum)
-        logpr += opt_theta_alpha*log(opt_theta_beta) - lgamma(opt_theta_alpha) -
-                 (opt_theta_alpha + snode->event_count_sum) *
-                 log(opt_theta_beta + snode->t2h_sum) +
-                 lgamma(opt_theta_alpha + snode->event_count_sum);
-      else
-        logpr -= opt_theta_alpha * log(1 + snode->t2h_sum / opt_theta_beta);
+      logpr = logprob_notheta_contrib(snode);
 
       /* TODO: this always updates the 'notheta_old_logpr_contrib'. Sometimes we
          do not want to this update because there could be multiple changes on
@@ -1235,6 +1356,48 @@ double gtree_logprob(stree_t * stree, double heredity, long msa_index)
   return logpr;
 }
 
+/* Update the MSC density contribution of population snode for all loci when
+   all coalescent times, taus and thetas are multiplied by the same factor c
+   (mixing step). As the ratios T2h/theta remain unchanged, the per-locus
+   contribution changes by -event_count*log(c) when thetas are estimated, and
+   only T2h needs to be rescaled when thetas are integrated out. Hence, no
+   sorting of coalescent times is necessary. The function returns the change
+   in the MSC density summed over all loci */
+double gtree_scale_logprob_contrib(snode_t * snode, double c, long msa_count)
+{
+  long i;
+  double lnc = log(c);
+  double delta = 0;
+
+  if (opt_est_theta)
+  {
+    for (i = 0; i < msa_count; ++i)
+    {
+      snode->old_logpr_contrib[i] = snode->logpr_contrib[i];
+      if (!snode->event_count[i]) continue;
+
+      snode->logpr_contrib[i] -= snode->event_count[i]*lnc;
+      delta -= snode->event_count[i]*lnc;
+    }
+  }
+  else
+  {
+    for (i = 0; i < msa_count; ++i)
+    {
+      snode->old_t2h[i] = snode->t2h[i];
+      snode->t2h[i] *= c;
+    }
+    snode->old_t2h_sum = snode->t2h_sum;
+    snode->t2h_sum *= c;
+
+    snode->notheta_old_logpr_contrib = snode->notheta_logpr_contrib;
+    snode->notheta_logpr_contrib = logprob_notheta_contrib(snode);
+    delta = snode->notheta_logpr_contrib - snode->notheta_old_logpr_contrib;
+  }
+
+  return delta;
+}
+
 double reflect(double x, double a, double b)
 {
   int side = 0;
@@ -1297,7 +1460,7 @@ void unlink_event(gnode_t * node, int msa_index)
 
 static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int msa_index)
 {
-  unsigned int i,k,j;
+  unsigned int i,k;
   long accepted = 0;
   double lnacceptance;
   double tnew,minage,maxage,oldage;
@@ -1305,6 +1468,7 @@ static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int
   double logl;
   snode_t * pop;
   snode_t * oldpop;
+  snode_t * lca;
 
   /* TODO: Instead of traversing the gene tree nodes this way, traverse the
      coalescent events for each population in the species tree instead. This
@@ -1318,23 +1482,12 @@ static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int
     /* find minimum children age */
     minage = MAX(node->left->time,node->right->time);
 
+    /* most recent ancestral population to the two child populations */
+    lca = node->left->pop;
     if (node->left->pop != node->right->pop)
     {
-      snode_t * lpop = NULL;
-      snode_t * rpop = NULL;
-
-      /* find most recent ancestral population to the two child populations */
-      /* TODO: Speed this up by using a lookup table */
-      for (lpop = node->left->pop; lpop; lpop = lpop->parent)
-      {
-        for (rpop = node->right->pop; rpop; rpop = rpop->parent)
-          if (rpop == lpop) break;
-        if (rpop == lpop) break;
-      }
-
-      assert(rpop == lpop && rpop != NULL);
-
-      minage = MAX(minage,lpop->tau);
+      lca = stree_lca(stree,node->left->pop,node->right->pop);
+      minage = MAX(minage,lca->tau);
     }
 
     /* compute max age. TODO: 999 is placed for compatibility with old bpp */
@@ -1345,10 +1498,10 @@ static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int
     tnew = node->time + opt_finetune_gtage * legacy_rnd_symmetrical();
     tnew = reflect(tnew, minage, maxage);
 
-    /* find the first ancestral pop with age higher than the proposed tnew */
-    /* TODO: Improvement: probably this can start from lpop/rpop (LCA of
-        populations of two daughter nodes) */
-    for (pop = node->left->pop; pop->parent; pop = pop->parent)
+    /* find the first ancestral pop with age higher than the proposed tnew.
+       Since tnew is older than the LCA of the populations of the two daughter
+       nodes, we can start the search from there */
+    for (pop = lca; pop->parent; pop = pop->parent)
       if (pop->parent->tau > tnew)
         break;
 
@@ -1462,26 +1615,18 @@ static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int
     #endif
 
     /* now update branch lengths and prob matrices */
-    gnode_t * temp;
     k = 0;
     travbuffer[msa_index][k++] = node->left;
     travbuffer[msa_index][k++] = node->right;
     if (node->parent)
       travbuffer[msa_index][k++] = node;
     locus_update_matrices_jc69(locus,travbuffer[msa_index],k);
-      
-
-    /* fill traversal buffer with root-path starting from current node */
-    for (k=0, temp = node; temp; temp = temp->parent)
-    {
-      travbuffer[msa_index][k++] = temp;
 
-      /* swap clv index to compute partials in a new location. This is useful
-         when the proposal gets rejected, as we only have swap clv indices */
-      temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-      if (opt_scaling)
-        temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-    }
+    /* retrieve the root-path starting from current node and swap clv indices
+       to compute partials in a new location. This is useful when the proposal
+       gets rejected, as we only have swap clv indices */
+    gtree_return_dirty_partials(gtree,travbuffer[msa_index],k,msa_index,&k);
+    gtree_swap_clv_indices(gtree,travbuffer[msa_index],k);
 
     /* update partials */
     locus_update_partials(locus,travbuffer[msa_index],k);
@@ -1519,13 +1664,7 @@ static long propose_ages(locus_t * locus, gtree_t * gtree, stree_t * stree, int
       /* rejected */
 
       /* need to reset clv indices to point to the old clv buffer */
-      for (j = 0; j < k; ++j)
-      {
-        temp = travbuffer[msa_index][j];
-        temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-        if (opt_scaling)
-          temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-      }
+      gtree_swap_clv_indices(gtree,travbuffer[msa_index],k);
       
       /* now reset branch lengths and pmatrices */
       node->time = oldage;
@@ -1609,12 +1748,18 @@ double gtree_propose_ages(locus_t ** locus, gtree_t ** gtree, stree_t * stree)
   unsigned int i;
   long proposal_count = 0;
   long accepted = 0;
+  long locus_accepted;
 
   for (i = 0; i < stree->locus_count; ++i)
   {
     /* TODO: Fix this to account mcmc.moveinnode in original bpp */
     proposal_count += gtree[i]->inner_count;
-    accepted += propose_ages(locus[i],gtree[i],stree,i);
+
+    prof_locus_begin();
+    locus_accepted = propose_ages(locus[i],gtree[i],stree,i);
+    prof_locus_end(i,PROF_GTAGE,gtree[i]->inner_count,locus_accepted);
+
+    accepted += locus_accepted;
   }
 
   if (!accepted)
@@ -1771,18 +1916,62 @@ void gtree_fini(int msa_count)
   free(travbuffer);
 }
 
+static int cb_cmp_gnode_index(const void * a, const void * b)
+{
+  const gnode_t * x = *(gnode_t * const *)a;
+  const gnode_t * y = *(gnode_t * const *)b;
+
+  if (x->node_index > y->node_index) return 1;
+
+  return -1;
+}
+
+/* Find the gene tree branches that cross time t inside population pop, i.e.
+   nodes p with p->time <= t < p->parent->time and pop ancestral to p->pop. The
+   gene tree is descended from node, and only the subtrees of nodes older than t
+   whose population is ancestral to pop are visited, since no other lineage can
+   be in pop at time t. The cost is therefore proportional to the number of
+   gene tree nodes in ancestral populations that are older than t, rather than
+   to the gene tree size. If outbuffer is NULL the branches are only counted */
+static void crossing_branches_recursive(stree_t * stree,
+                                        gnode_t * node,
+                                        snode_t * pop,
+                                        double t,
+                                        gnode_t ** outbuffer,
+                                        unsigned int * count)
+{
+  gnode_t * child;
+  int i;
+
+  for (i = 0; i < 2; ++i)
+  {
+    child = i ? node->right : node->left;
+
+    if (child->time <= t)
+    {
+      if (stree->pptable[child->pop->node_index][pop->node_index])
+      {
+        if (outbuffer)
+          outbuffer[*count] = child;
+        *count = *count + 1;
+      }
+    }
+    else if (stree->pptable[pop->node_index][child->pop->node_index])
+      crossing_branches_recursive(stree,child,pop,t,outbuffer,count);
+  }
+}
+
 static long propose_spr(locus_t * locus,
                         gtree_t * gtree,
                         stree_t * stree,
                         int msa_index)
 {
-  unsigned int i,j,k,m,n;
+  unsigned int i,j,k;
   unsigned int source_count, target_count;
   long accepted = 0;
   gnode_t * curnode;
   gnode_t * sibling;
   gnode_t * father;
-  gnode_t * p;
   double minage,maxage,tnew;
   double lnacceptance;
   double logpr;
@@ -1826,16 +2015,23 @@ static long propose_spr(locus_t * locus,
     tnew = father->time + opt_finetune_gtspr*legacy_rnd_symmetrical();
     tnew = reflect(tnew,minage,maxage);
 
-    for (pop = curnode->pop; pop->parent; pop = pop->parent)
+    /* tnew is not younger than pop->tau, hence its population is pop or one
+       of its ancestors */
+    for (; pop->parent; pop = pop->parent)
       if (pop->parent->tau > tnew) break;
 
     snode_t * pop_target = pop;
 
+    /* the older and the younger of the populations of father before and after
+       the move; populations in between change their incoming lineages */
+    snode_t * pop_old = stree_lca(stree,father->pop,pop_target);
+    snode_t * pop_young = (pop_old == pop_target) ? father->pop : pop_target;
+    int seqin_delta = (pop_old == pop_target) ? 1 : -1;
+
     /* identify target branches on which we can attach the pruned tree */
     /* TODO: We process the root node first to keep backwards compatibility with
        old bpp results */
 
-    n = pop_target->node_index;
     target_count = 0;
     if (tnew >= gtree->root->time)
     {
@@ -1843,29 +2039,43 @@ static long propose_spr(locus_t * locus,
     }
     else
     {
-      for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      gnode_t ** targets = travbuffer[msa_index];
+
+      k = 0;
+      crossing_branches_recursive(stree,
+                                  gtree->root,
+                                  pop_target,
+                                  tnew,
+                                  targets,
+                                  &k);
+
+      /* keep the order of gene tree node indices, such that targets are
+         sampled identically to a linear scan over all nodes */
+      qsort(targets,k,sizeof(gnode_t *),cb_cmp_gnode_index);
+
+      /* exclude the pruned node and replace its father by sibling */
+      for (j = 0; j < k; ++j)
       {
-        p = gtree->nodes[j];
-        m = p->pop->node_index;
-        if (p != curnode && p != gtree->root && p->time <= tnew &&
-            p->parent->time > tnew && stree->pptable[m][n])
-          travbuffer[msa_index][target_count++] = (p == father) ? sibling : p;
+        if (targets[j] == curnode) continue;
+        targets[target_count++] = (targets[j] == father) ? sibling : targets[j];
       }
     }
 
+    /* count the branches that cross the age of father (excluding father) in
+       its population, i.e. the number of targets of the reverse move */
     source_count = 1;
     if (father != gtree->root)
     {
-      n = father->pop->node_index;
-      for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
-      {
-        p = gtree->nodes[j];
-        m = p->pop->node_index;
-        if (p != curnode && p != gtree->root && p != sibling && p != father &&
-            p->time <= father->time && p->parent->time > father->time &&
-            stree->pptable[m][n])
-          source_count++;
-      }
+      k = 0;
+      crossing_branches_recursive(stree,
+                                  gtree->root,
+                                  father->pop,
+                                  father->time,
+                                  NULL,
+                                  &k);
+
+      /* father itself is always counted */
+      source_count += k - 1;
     }
 
     assert(target_count);
@@ -1904,23 +2114,11 @@ static long propose_spr(locus_t * locus,
       if (!opt_est_theta)
         father->pop->event_count_sum++;
 
-      /* increase or decrease the number of incoming lineages to all populations
-         in the path from old population to the new population, depending on the
-         case  */
-      if (tnew > oldage)
-      {
-        /* increase the number of incoming lineages to all populations in the
-           path from old population (excluding) to the new population */
-        for (pop = oldpop; pop != father->pop; pop = pop->parent)
-          pop->parent->seqin_count[msa_index]++;
-      }
-      else
-      {
-        /* decrease the number of incoming lineages to all populations in the
-           path from new population (excluding) to the old population */
-        for (pop = father->pop; pop != oldpop; pop = pop->parent)
-          pop->parent->seqin_count[msa_index]--;
-      }
+      /* increase the number of incoming lineages to all populations in the
+         path from the younger (excluding) to the older population if father
+         moved to an older population, or decrease it otherwise */
+      for (pop = pop_young; pop != pop_old; pop = pop->parent)
+        pop->parent->seqin_count[msa_index] += seqin_delta;
     }
     
     int spr_required = (target != sibling && target != father);
@@ -1952,20 +2150,7 @@ static long propose_spr(locus_t * locus,
     }
     else
     {
-      snode_t * start;
-      snode_t * end;
-
-      if (tnew > oldage)
-      {
-        start = oldpop;
-        end   = father->pop->parent;
-      }
-      else
-      {
-        start = father->pop;
-        end   = oldpop->parent;
-      }
-      for (pop = start; pop != end; pop = pop->parent)
+      for (pop = pop_young; pop != pop_old->parent; pop = pop->parent)
       {
         if (opt_est_theta)
           logpr -= pop->logpr_contrib[msa_index];
@@ -1985,63 +2170,12 @@ static long propose_spr(locus_t * locus,
       travbuffer[msa_index][k++] = sibling;
     locus_update_matrices_jc69(locus,travbuffer[msa_index],k);
 
-    /* locate all nodes  whose CLV need to be updated */
-    k = 0;
-    if (!spr_required)
-    {
-      /* fill traversal buffer with root-path starting from father */
-      gnode_t * temp;
-      for (k=0, temp = father; temp; temp = temp->parent)
-      {
-        travbuffer[msa_index][k++] = temp;
-
-        /* swap clv index to compute partials in a new location. This is useful
-           when the proposal gets rejected, as we only have swap clv indices */
-        temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-        if (opt_scaling)
-          temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-      }
-    }
-    else
-    {
-      /* if an SPR was done, we have two root-paths; one starting from sibling's
-         parent and one from father */
-
-      gnode_t * temp;
-
-      /* mark the root-path starting from father */
-      for (temp = father; temp; temp = temp->parent)
-        temp->mark |= FLAG_MISC;    /* set FLAG_MISC */
-
-      /* fill traversal buffer with nodes on the root-path starting from
-         sibling's parent and stop when the lowest common ancestor is found */
-
-      /* TODO: Should this also check for temp != NULL, in case father was root ? */
-      for (temp=sibling->parent; !(temp->mark & FLAG_MISC); temp=temp->parent)
-      {
-        travbuffer[msa_index][k++] = temp;
-
-        /* swap clv index to compute partials in a new location. This is useful
-           when the proposal gets rejected, as we only have swap clv indices */
-        temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-        if (opt_scaling)
-          temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-      }
-
-      /* now fill the remaining traversal buffer with the root-path starting
-         from father and reset markings */
-      for (temp = father; temp; temp = temp->parent)
-      {
-        temp->mark &= ~FLAG_MISC;   /* unset FLAG_MISC */
-        travbuffer[msa_index][k++] = temp;
-
-        /* swap clv index to compute partials in a new location. This is useful
-           when the proposal gets rejected, as we only have swap clv indices */
-        temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-        if (opt_scaling)
-          temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-      }
-    }
+    /* locate all nodes whose CLV need to be updated, i.e. the root-path
+       starting from father and, if an SPR was done, the root-path starting from
+       sibling's parent, and swap their clv indices to compute partials in a new
+       location */
+    gtree_return_dirty_partials(gtree,travbuffer[msa_index],k,msa_index,&k);
+    gtree_swap_clv_indices(gtree,travbuffer[msa_index],k);
 
     /* update partials */
     locus_update_partials(locus,travbuffer[msa_index],k);
@@ -2081,13 +2215,7 @@ static long propose_spr(locus_t * locus,
       /* rejected */
 
       /* need to reset clv indices to point to the old clv buffer */
-      for (j = 0; j < k; ++j)
-      {
-        gnode_t * temp = travbuffer[msa_index][j];
-        temp->clv_index = SWAP_CLV_INDEX(gtree->tip_count,temp->clv_index);
-        if (opt_scaling)
-          temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,temp->scaler_index);
-      }
+      gtree_swap_clv_indices(gtree,travbuffer[msa_index],k);
       
       /* now reset branch lengths and pmatrices */
 
@@ -2165,32 +2293,14 @@ static long propose_spr(locus_t * locus,
         if (!opt_est_theta)
           father->pop->event_count_sum++;
 
-        /* increase or decrease the number of incoming lineages to all populations in the path
-        from old population to the new population, depending on the case  */
-        if (oldage >= tnew)
-        {
-          /* TODO : Now this is covered here!!! */
-
-          /* increase the number of incoming lineages to all populations in the
-             path from old population (excluding) to the new population */
-          for (pop=oldpop; pop != father->pop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]++;
-        }
-        else
-        {
-          /* decrease the number of incoming lineages to all populations in the
-             path from new population (excluding) to the old population */
-          for (pop = father->pop; pop != oldpop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]--;
-        }
+        /* restore the number of incoming lineages to all populations in the
+           path from the younger (excluding) to the older population */
+        for (pop = pop_young; pop != pop_old; pop = pop->parent)
+          pop->parent->seqin_count[msa_index] -= seqin_delta;
 
         /* now restore the old log gene tree probability contribution for each
            affected species tree node */
-        
-        snode_t * start = (tnew > oldage) ? father->pop :  oldpop;
-        snode_t * end   = (tnew > oldage) ? oldpop->parent : father->pop->parent;
-
-        for (pop = start; pop != end; pop = pop->parent)
+        for (pop = pop_young; pop != pop_old->parent; pop = pop->parent)
         {
           if (opt_est_theta)
             pop->logpr_contrib[msa_index] = pop->old_logpr_contrib[msa_index];
@@ -2208,12 +2318,18 @@ double gtree_propose_spr(locus_t ** locus, gtree_t ** gtree, stree_t * stree)
   unsigned int i;
   long proposal_count = 0;
   long accepted = 0;
+  long locus_accepted;
 
   for (i = 0; i < stree->locus_count; ++i)
   {
     /* TODO: Fix this to account mcmc.moveinnode in original bpp */
     proposal_count += gtree[i]->edge_count;
-    accepted += propose_spr(locus[i],gtree[i],stree,i);
+
+    prof_locus_begin();
+    locus_accepted = propose_spr(locus[i],gtree[i],stree,i);
+    prof_locus_end(i,PROF_GTSPR,gtree[i]->edge_count,locus_accepted);
+
+    accepted += locus_accepted;
   }
 
   if (!accepted)
@@ -2268,29 +2384,17 @@ static long prop_locusrate(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
     /* update selected locus */
     locus_update_all_matrices_jc69(locus[i],gtree[i]);
 
-    gnode_t ** gnodeptr = gtree[i]->nodes;
-    for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-    {
-      gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                              gnodeptr[j]->clv_index);
-      if (opt_scaling)                                              
-        gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                      gnodeptr[j]->scaler_index);
-    }
+    gtree_swap_clv_indices(gtree[i],
+                           gtree[i]->nodes+gtree[i]->tip_count,
+                           gtree[i]->inner_count);
     locus_update_all_partials(locus[i],gtree[i]);
 
     /* update reference locus */
     locus_update_all_matrices_jc69(locus[ref],gtree[ref]);
 
-    gnodeptr = gtree[ref]->nodes;
-    for (j = gtree[ref]->tip_count; j < gtree[ref]->tip_count+gtree[ref]->inner_count; ++j)
-    {
-      gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[ref]->tip_count,
-                                              gnodeptr[j]->clv_index);
-      if (opt_scaling)
-        gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
-                                                      gnodeptr[j]->scaler_index);
-    }
+    gtree_swap_clv_indices(gtree[ref],
+                           gtree[ref]->nodes+gtree[ref]->tip_count,
+                           gtree[ref]->inner_count);
     locus_update_all_partials(locus[ref],gtree[ref]);
 
     unsigned int param_indices[1] = {0};
@@ -2324,26 +2428,14 @@ static long prop_locusrate(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
       locus[ref]->mut_rates[0] = old_refrate;
 
       /* reset selected locus */
-      gnodeptr = gtree[i]->nodes;
-      for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-      {
-        gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                gnodeptr[j]->clv_index);
-        if (opt_scaling)
-          gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                        gnodeptr[j]->scaler_index);
-      }
+      gtree_swap_clv_indices(gtree[i],
+                             gtree[i]->nodes+gtree[i]->tip_count,
+                             gtree[i]->inner_count);
 
       /* reset reference locus */
-      gnodeptr = gtree[ref]->nodes;
-      for (j = gtree[ref]->tip_count; j < gtree[ref]->tip_count+gtree[ref]->inner_count; ++j)
-      {
-        gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[ref]->tip_count,
-                                                gnodeptr[j]->clv_index);
-        if (opt_scaling)
-          gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
-                                                        gnodeptr[j]->scaler_index);
-      }
+      gtree_swap_clv_indices(gtree[ref],
+                             gtree[ref]->nodes+gtree[ref]->tip_count,
+                             gtree[ref]->inner_count);
       
       for (j = 0; j < gtree[ref]->tip_count + gtree[ref]->inner_count; ++j)
         if (refnodes[j]->parent)
@@ -0,0 +1,226 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Gene tree container. All gene trees are written to a single file with one
+   block per sample:
+
+   header:  magic, version, sizeof(long), locus count
+   block:   sample, locus count, codec, data size, end offset of each locus
+            tree in data, data (newick lines of all loci)
+
+   The per-block offsets allow extracting any locus without parsing the
+   trees. Codec 0 (uncompressed) is the only one currently written */
+
+#define GTREEFILE_MAGIC   "BPPG"
+#define GTREEFILE_VERSION 1
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+
+/* snapshots hold longs and doubles */
+#define ALIGN_SNAPSHOT(x) (((x)+7) & ~((size_t)7))
+
+void gtreefile_header(FILE * fp, long locus_count)
+{
+  int version = GTREEFILE_VERSION;
+  BYTE size_type = (BYTE)sizeof(long);
+
+  DUMP(GTREEFILE_MAGIC,4,fp);
+  DUMP(&version,1,fp);
+  DUMP(&size_type,1,fp);
+  DUMP(&locus_count,1,fp);
+}
+
+/* scratch space of the writer thread for formatting blocks */
+static char * buffer = NULL;
+static size_t maxsize = 0;
+static long * ends = NULL;
+static long ends_count = 0;
+
+/* writer callback formatting a sample of all gene trees into a block */
+static void cb_write_block(FILE * fp, const void * data, size_t size)
+{
+  long i;
+  long codec = 0;
+  const long * hdr = (const long *)data;
+  long sample = hdr[0];
+  long count = hdr[1];
+  const size_t * offset = (const size_t *)(hdr+2);
+  size_t pos = 0;
+
+  (void)size;
+
+  if (count > ends_count)
+  {
+    free(ends);
+    ends = (long *)xmalloc((size_t)count*sizeof(long));
+    ends_count = count;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    pos = gtree_snapshot_newick((const char *)data + offset[i],
+                                &buffer,
+                                &maxsize,
+                                pos);
+    ends[i] = (long)pos;
+  }
+
+  long data_size = (long)pos;
+  DUMP(&sample,1,fp);
+  DUMP(&count,1,fp);
+  DUMP(&codec,1,fp);
+  DUMP(&data_size,1,fp);
+  DUMP(ends,count,fp);
+  fwrite(buffer,1,pos,fp);
+}
+
+/* copy all gene trees of a sample into a single writer record */
+void gtreefile_append(long stream, long sample, gtree_t ** gtree, long count)
+{
+  long i;
+  size_t size = 2*sizeof(long) + count*sizeof(size_t);
+
+  for (i = 0; i < count; ++i)
+    size += ALIGN_SNAPSHOT(gtree_snapshot_size(gtree[i]));
+
+  char * record = (char *)writer_reserve(stream,cb_write_block,size);
+  long * hdr = (long *)record;
+  size_t * offset = (size_t *)(hdr+2);
+  size_t pos = 2*sizeof(long) + count*sizeof(size_t);
+
+  hdr[0] = sample;
+  hdr[1] = count;
+  for (i = 0; i < count; ++i)
+  {
+    offset[i] = pos;
+    gtree_snapshot(gtree[i], record+pos);
+    pos += ALIGN_SNAPSHOT(gtree_snapshot_size(gtree[i]));
+  }
+
+  writer_commit();
+}
+
+/* free the scratch space once the writer thread has finished */
+void gtreefile_fini()
+{
+  free(buffer);
+  free(ends);
+  buffer = NULL;
+  ends = NULL;
+  maxsize = 0;
+  ends_count = 0;
+}
+
+/* read the long at offset pos */
+static long read_long(mapfile_t * m, size_t pos, const char * filename)
+{
+  long x;
+
+  m->pos = MIN(pos, m->size);
+  if (!mapfile_read(m,&x,sizeof(long)))
+    fatal("Truncated gene tree file %s", filename);
+
+  return x;
+}
+
+/* write the trees of each locus to <filename>.L<locus>, one file at a time.
+   Returns the number of loci */
+long gtreefile_extract(const char * filename)
+{
+  long i,j;
+  int version;
+  long locus_count;
+  long sample_count = 0;
+  size_t pos;
+  size_t first;
+  mapfile_t m;
+
+  if (!mapfile_open(&m,filename))
+    fatal("Cannot open file %s", filename);
+
+  if (m.size < 4+sizeof(int)+1+sizeof(long) ||
+      memcmp(m.data,GTREEFILE_MAGIC,4))
+    fatal("File %s is not a gene tree container", filename);
+
+  memcpy(&version, m.data+4, sizeof(int));
+  if (version != GTREEFILE_VERSION || m.data[4+sizeof(int)] != sizeof(long))
+    fatal("Incompatible gene tree container %s", filename);
+
+  first = 4+sizeof(int)+1;
+  locus_count = read_long(&m,first,filename);
+  first += sizeof(long);
+
+  /* the end offsets of a block must fit in the file */
+  if (locus_count <= 0 || (size_t)locus_count > (m.size-first)/sizeof(long))
+    fatal("Corrupted gene tree file %s", filename);
+
+  /* validate blocks */
+  for (pos = first; pos < m.size; ++sample_count)
+  {
+    long count = read_long(&m,pos+sizeof(long),filename);
+    long codec = read_long(&m,pos+2*sizeof(long),filename);
+    long data_size = read_long(&m,pos+3*sizeof(long),filename);
+
+    if (count != locus_count || codec != 0 || data_size < 0 ||
+        (size_t)data_size > m.size)
+      fatal("Corrupted block %ld in %s", sample_count+1, filename);
+
+    pos += (4+count)*sizeof(long) + (size_t)data_size;
+    if (pos > m.size)
+      fatal("Truncated gene tree file %s", filename);
+  }
+
+  for (i = 0; i < locus_count; ++i)
+  {
+    char * s = NULL;
+    xasprintf(&s, "%s.L%ld", filename, i+1);
+    FILE * fp = xopen(s,"w");
+    free(s);
+
+    for (j = 0, pos = first; j < sample_count; ++j)
+    {
+      long data_size = read_long(&m,pos+3*sizeof(long),filename);
+      const char * ends = m.data + pos + 4*sizeof(long);
+      const char * data = ends + locus_count*sizeof(long);
+      long start = 0;
+      long end;
+
+      if (i)
+        memcpy(&start, ends+(i-1)*sizeof(long), sizeof(long));
+      memcpy(&end, ends+i*sizeof(long), sizeof(long));
+
+      if (start < 0 || end < start || end > data_size)
+        fatal("Corrupted block %ld in %s", j+1, filename);
+
+      fwrite(data+start, 1, (size_t)(end-start), fp);
+
+      pos += (4+locus_count)*sizeof(long) + (size_t)data_size;
+    }
+
+    fclose(fp);
+  }
+
+  mapfile_close(&m);
+
+  return locus_count;
+}
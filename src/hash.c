@@ -49,6 +49,74 @@ unsigned long hash_fnv(char * s)
   return hash;
 }
 
+/* Fowler-Noll-Vo 1a variant over 64-bit words (trailing bytes are hashed
+   individually), used for checksumming binary data. Data may be hashed in
+   pieces by passing the previous result as hash, provided that all pieces
+   but the last have a size that is a multiple of 8. The initial hash is
+   HASH_FNV_INIT */
+unsigned long hash_fnv_data(unsigned long hash, const void * data, size_t size)
+{
+  size_t i;
+  unsigned long w;
+  const BYTE * p = (const BYTE *)data;
+
+  for (i = 0; i + sizeof(w) <= size; i += sizeof(w))
+  {
+    memcpy(&w, p+i, sizeof(w));
+    hash ^= w;
+    hash *= 1099511628211UL;
+  }
+  for (; i < size; ++i)
+  {
+    hash ^= p[i];
+    hash *= 1099511628211UL;
+  }
+
+  return hash;
+}
+
+void hash_fnv_stream_init(hash_fnv_stream_t * s)
+{
+  s->hash = HASH_FNV_INIT;
+  s->tail_len = 0;
+}
+
+/* hash the next piece of data; bytes that do not complete a 64-bit word are
+   kept until the next piece, such that the result is the same as hashing
+   all data at once */
+void hash_fnv_stream_update(hash_fnv_stream_t * s,
+                            const void * data,
+                            size_t size)
+{
+  size_t n;
+  const BYTE * p = (const BYTE *)data;
+
+  if (s->tail_len)
+  {
+    n = MIN(size, sizeof(s->tail) - s->tail_len);
+    memcpy(s->tail + s->tail_len, p, n);
+    s->tail_len += n;
+    p += n;
+    size -= n;
+
+    if (s->tail_len < sizeof(s->tail)) return;
+
+    s->hash = hash_fnv_data(s->hash, s->tail, sizeof(s->tail));
+    s->tail_len = 0;
+  }
+
+  n = size - size % sizeof(s->tail);
+  s->hash = hash_fnv_data(s->hash, p, n);
+
+  memcpy(s->tail, p+n, size-n);
+  s->tail_len = size-n;
+}
+
+unsigned long hash_fnv_stream_final(const hash_fnv_stream_t * s)
+{
+  return hash_fnv_data(s->hash, s->tail, s->tail_len);
+}
+
 static ht_item_t * hashitem_create(unsigned long key, void * value)
 {
   ht_item_t * hi = (ht_item_t *)xmalloc(sizeof(ht_item_t));
@@ -23,7 +23,11 @@
 
 #define PROP_COUNT 5
 
-#define LOAD(x,n,fp) (fread((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+#define LOAD(x,n,fp) (chk_read((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
+#define READ(x,n,fp) do { if (!LOAD(x,n,fp))                               \
+                         fatal("Truncated checkpoint file %s", opt_resume); \
+                     } while (0)
 
 size_t chk_size_int;
 size_t chk_size_long;
@@ -35,6 +39,65 @@ static stree_t * stree;
 static gtree_t ** gtree;
 static locus_t ** locus;
 
+/* table of section offsets, sizes and checksums from the trailer, and the
+   index of the section being read */
+static long * section_table;
+static long section_count;
+static long section_current;
+
+/* read n elements of the given size from the checkpoint */
+size_t chk_read(void * data, size_t size, size_t n, FILE * fp)
+{
+  return fread(data,size,n,fp);
+}
+
+static int chk_getc(FILE * fp)
+{
+  BYTE c;
+
+  return chk_read(&c,1,1,fp) ? c : EOF;
+}
+
+/* verify that the current section ends at the current position, and start
+   the next section */
+static void section_check(FILE * fp)
+{
+  long * entry = section_table + 3*section_current;
+
+  if (section_current == section_count || ftell(fp) != entry[0]+entry[1])
+    fatal("Checkpoint file %s is corrupted", opt_resume);
+
+  section_current++;
+}
+
+/* verify the checksums of all sections before any of them is parsed, such
+   that corrupted counts and sizes are never used for allocations */
+static void section_verify_all()
+{
+  long i;
+  mapfile_t m;
+  hash_fnv_stream_t h;
+
+  if (!mapfile_open(&m,opt_resume))
+    fatal("Cannot read checkpoint file %s", opt_resume);
+
+  for (i = 0; i < section_count; ++i)
+  {
+    long * entry = section_table + 3*i;
+
+    if ((size_t)(entry[0]+entry[1]) > m.size)
+      fatal("Checkpoint file %s is truncated or corrupted", opt_resume);
+
+    hash_fnv_stream_init(&h);
+    hash_fnv_stream_update(&h,m.data+entry[0],(size_t)entry[1]);
+    if (hash_fnv_stream_final(&h) != (unsigned long)entry[2])
+      fatal("Checksum mismatch in section %ld of checkpoint file %s",
+            i+1, opt_resume);
+  }
+
+  mapfile_close(&m);
+}
+
 static void alloc_gtree()
 {
   long i,j;
@@ -114,7 +177,8 @@ void load_chk_header(FILE * fp)
   if (memcmp(magic,BPP_MAGIC,BPP_MAGIC_BYTES))
     fatal("File %s is not a BPP checkpoint file...", opt_resume);
 
-  if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) || (version_patch != VERSION_PATCH))
+  if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) ||
+      (version_patch != VERSION_PATCH) || (version_chkp != VERSION_CHKP))
     fatal("Incompatible CHKP: Checkpoint file version %ld, BPP version %ld",
           version_chkp, VERSION_CHKP);
 
@@ -164,7 +228,7 @@ int load_string(FILE * fp, char ** buffer)
   char * s = (char *)xmalloc(increment*sizeof(char));
   alloc = increment;
 
-  while ((c=fgetc(fp)) && c != EOF)
+  while ((c=chk_getc(fp)) && c != EOF)
   {
     s[size++] = (char)c;
 
@@ -255,6 +319,12 @@ static void load_chk_section_1(FILE * fp,
     fatal("Cannot read 'checkpoint' tag initial value");
   if (!LOAD(&opt_checkpoint_step,1,fp))
     fatal("Cannot read 'checkpoint' tag step value");
+  if (!LOAD(&opt_checkpoint_interval,1,fp))
+    fatal("Cannot read 'checkpointtime' tag");
+  if (!LOAD(&opt_checkpoint_fork,1,fp))
+    fatal("Cannot read 'checkpointfork' tag");
+  if (!LOAD(&opt_checkpoint_clv,1,fp))
+    fatal("Cannot read 'checkpointclv' tag");
 
   /* read speciesdelimitation */
   if (!LOAD(&opt_est_delimit,1,fp))
@@ -339,6 +409,8 @@ static void load_chk_section_1(FILE * fp,
     fatal("Cannot read print flags");
   if (!LOAD(&opt_print_genetrees,1,fp))
     fatal("Cannot read print flags");
+  if (!LOAD(&opt_gtree_container,1,fp))
+    fatal("Cannot read print flags");
   if (opt_print_samples == 0)
     fatal("Corrupted checkfpoint file, opt_print_samples=0");
 
@@ -457,8 +529,9 @@ static void load_chk_section_1(FILE * fp,
 
   if (opt_print_genetrees)
   {
-    *gtree_offset = (long *)xmalloc((size_t)opt_locus_count*sizeof(long));
-    if (!LOAD(*gtree_offset,opt_locus_count,fp))
+    long gtree_files = opt_gtree_container ? 1 : opt_locus_count;
+    *gtree_offset = (long *)xmalloc((size_t)gtree_files*sizeof(long));
+    if (!LOAD(*gtree_offset,gtree_files,fp))
       fatal("Cannot read gtree file offsets");
   }
 
@@ -584,6 +657,7 @@ static void load_chk_section_1(FILE * fp,
       node->t2h = (double *)xcalloc((size_t)opt_locus_count,sizeof(double));
       node->old_t2h = (double *)xcalloc((size_t)opt_locus_count,sizeof(double));
       node->t2h_sum = 0;
+      node->old_t2h_sum = 0;
       node->event_count_sum = 0;
     }
   }
@@ -591,6 +665,11 @@ static void load_chk_section_1(FILE * fp,
   stree->pptable = (int**)xcalloc(alloc,sizeof(int *));
   for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
     stree->pptable[i] = (int *)xcalloc(alloc,sizeof(int));
+
+  stree->lcatable = (int**)xcalloc(alloc,sizeof(int *));
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+    stree->lcatable[i] = (int *)xcalloc(alloc,sizeof(int));
+  stree->pdepth = (int *)xcalloc(alloc,sizeof(int));
 }
 
 void load_chk_section_2(FILE * fp)
@@ -938,11 +1017,20 @@ static void load_chk_section_3(FILE * fp, long msa_count)
   }
 }
 
-static void load_locus(FILE * fp, long index)
+/* read the padding up to the next aligned offset */
+static void load_align(FILE * fp)
 {
-  long i;
+  long pad = (CHK_ALIGN - ftell(fp) % CHK_ALIGN) % CHK_ALIGN;
 
-  /* load number of sites */
+  if (!LOAD(dummy,pad,fp))
+    fatal("Truncated checkpoint file %s", opt_resume);
+}
+
+/* load locus data. Returns 1 if inner CLVs, scalers and pmatrices were
+   restored */
+static int load_locus(FILE * fp, long index)
+{
+  long i,j,k;
   unsigned int sites;
   unsigned int states;
   unsigned int rate_cats;
@@ -950,41 +1038,23 @@ static void load_locus(FILE * fp, long index)
   unsigned int prob_matrices;
   unsigned int scale_buffers;
   unsigned int attributes;
-  size_t span;
+  BYTE tip_encoding;
+  BYTE inner;
 
   gtree_t * gt = gtree[index];
 
-  if (!LOAD(&sites,1,fp))
-    fatal("Cannot read number of sites");
-
-  /* load number of states */
-  if (!LOAD(&states,1,fp))
-    fatal("Cannot read number of states");
-
-  /* load number of rate categories */
-  if (!LOAD(&rate_cats,1,fp))
-    fatal("Cannot read number of rate categories");
-
-  /* load number of rate matrices */
-  if (!LOAD(&rate_matrices,1,fp))
-    fatal("Cannot read number of rate matrices");
-
-  /* load number of prob matrices */
-  if (!LOAD(&prob_matrices,1,fp))
-    fatal("Cannot read number of rate matrices");
-
-  /* load number of scale buffers */
-  if (!LOAD(&scale_buffers,1,fp))
-    fatal("Cannot read number of rate matrices");
+  READ(&sites,1,fp);
+  READ(&states,1,fp);
+  READ(&rate_cats,1,fp);
+  READ(&rate_matrices,1,fp);
+  READ(&prob_matrices,1,fp);
+  READ(&scale_buffers,1,fp);
 
   /* TODO: Store and load opt_scaling value instead */
   if (scale_buffers)
     opt_scaling = 1;
 
-
-  /* load attributes */
-  if (!LOAD(&attributes,1,fp))
-    fatal("Cannot read attributes");
+  READ(&attributes,1,fp);
 
   locus[index] = locus_create(gt->tip_count,
                               2*gt->inner_count,
@@ -995,93 +1065,185 @@ static void load_locus(FILE * fp, long index)
                               rate_cats,
                               scale_buffers,
                               attributes);
+  locus_t * loc = locus[index];
   
   double frequencies[4] = {0.25, 0.25, 0.25, 0.25};
 
   /* set frequencies for model with index 0 */
-  pll_set_frequencies(locus[index],0,frequencies);
-
-  /* load pattern weights sum */
-  if (!LOAD(&(locus[index]->pattern_weights_sum),1,fp))
-    fatal("Cannot read pattern weights sum");
-
-  /* load mutation rates */
-  if (!LOAD(locus[index]->mut_rates,locus[index]->rate_matrices,fp))
-    fatal("Cannot read locus mutation rates");
+  pll_set_frequencies(loc,0,frequencies);
 
-  /* load heredity scalars */
-  if (!LOAD(locus[index]->heredity,locus[index]->rate_matrices,fp))
-    fatal("Cannot read heredity scalars");
-
-  /* load diploid */
-  if (!LOAD(&(locus[index]->diploid),1,fp))
-    fatal("Cannot read locus %ld diploid", index);
+  READ(&(loc->pattern_weights_sum),1,fp);
+  READ(loc->mut_rates,loc->rate_matrices,fp);
+  READ(loc->heredity,loc->rate_matrices,fp);
+  READ(&(loc->diploid),1,fp);
   
-  if (locus[index]->diploid)
+  if (loc->diploid)
   {
     size_t sites_a2 = 0;
     /* TODO: locus->pattern_weights is allocated in locis_create with a size
        equal to length of A3, but in reality we only need |A1| storage space.
        Free and reallocate here with 'unphased_length' */
 
-    /* load original diploid number of sites */
-    if (!LOAD(&(locus[index]->unphased_length),1,fp))
-      fatal("Cannot read locus %ld unphased length", index);
+    READ(&(loc->unphased_length),1,fp);
     
-    locus[index]->diploid_resolution_count = (unsigned long *)xmalloc((size_t)
-                                             (locus[index]->unphased_length) *
-                                             sizeof(unsigned long));
-    locus[index]->likelihood_vector = (double *)xmalloc((size_t)
-                                      (locus[index]->sites)*sizeof(double));
+    loc->diploid_resolution_count = (unsigned long *)xmalloc((size_t)
+                                    (loc->unphased_length) *
+                                    sizeof(unsigned long));
+    loc->likelihood_vector = (double *)xmalloc((size_t)
+                                      (loc->sites)*sizeof(double));
 
-    /* load diploid resolution count */
-    if (!LOAD(locus[index]->diploid_resolution_count,locus[index]->unphased_length,fp))
-      fatal("Cannot read locus %ld diploid resolution count", index);
+    READ(loc->diploid_resolution_count,loc->unphased_length,fp);
 
     /* load diploid mapping A1 -> A3 */
-    for (i = 0; i < locus[index]->unphased_length; ++i)
-      sites_a2 += locus[index]->diploid_resolution_count[i];
-    locus[index]->diploid_mapping = (unsigned long *)xmalloc(sites_a2 *
-                                              sizeof(unsigned long));
-    if (!LOAD(locus[index]->diploid_mapping,sites_a2,fp))
-      fatal("Cannot read locus %ld diploid mapping", index);
-
+    for (i = 0; i < loc->unphased_length; ++i)
+      sites_a2 += loc->diploid_resolution_count[i];
+    loc->diploid_mapping = (unsigned long *)xmalloc(sites_a2 *
+                                                    sizeof(unsigned long));
+    READ(loc->diploid_mapping,sites_a2,fp);
 
     /* load pattern weights for original diploid A1 alignment */
-    free(locus[index]->pattern_weights);
-    locus[index]->pattern_weights = (unsigned int *)xmalloc((size_t)
-                                    (locus[index]->unphased_length) *
-                                    sizeof(unsigned int));
-    if (!LOAD(locus[index]->pattern_weights,locus[index]->unphased_length,fp))
-      fatal("Cannot read pattern weights");
+    free(loc->pattern_weights);
+    loc->pattern_weights = (unsigned int *)xmalloc((size_t)
+                           (loc->unphased_length) * sizeof(unsigned int));
+    READ(loc->pattern_weights,loc->unphased_length,fp);
   }
   else
   {
-    /* load pattern weights */
-    if (!LOAD(locus[index]->pattern_weights,locus[index]->sites,fp))
-      fatal("Cannot read pattern weights");
+    READ(loc->pattern_weights,loc->sites,fp);
   }
-    
+
+  READ(&tip_encoding,1,fp);
+  READ(&inner,1,fp);
+
+  size_t span_site = loc->rate_cats * loc->states_padded;
+  size_t span = loc->sites * span_site;
 
   /* load tip CLVs */
-  for (i = 0; i < gt->tip_count; ++i)
+  if (tip_encoding == CHK_TIPS_STATES)
+  {
+    BYTE * mask = (BYTE *)xmalloc((size_t)(loc->sites) * sizeof(BYTE));
+
+    for (i = 0; i < gt->tip_count; ++i)
+    {
+      double * clv = loc->clv[gt->nodes[i]->clv_index];
+
+      READ(mask,loc->sites,fp);
+
+      for (j = 0; j < loc->sites; ++j)
+      {
+        double * site = clv + j*span_site;
+
+        for (k = 0; k < loc->states_padded; ++k)
+          site[k] = (k < loc->states) ? (mask[j] >> k) & 1 : 0;
+        for (k = 1; k < loc->rate_cats; ++k)
+          memcpy(site + k*loc->states_padded,
+                 site,
+                 loc->states_padded*sizeof(double));
+      }
+    }
+    free(mask);
+  }
+  else if (tip_encoding == CHK_TIPS_CLV)
+  {
+    for (i = 0; i < gt->tip_count; ++i)
+    {
+      load_align(fp);
+      READ(loc->clv[gt->nodes[i]->clv_index],span,fp);
+    }
+  }
+  else
+    fatal("Unknown tip encoding in locus %ld of checkpoint", index);
+
+  if (!inner) return 0;
+
+  /* load CLVs and scalers of inner nodes, and pmatrices of all branches */
+  for (i = gt->tip_count; i < gt->tip_count + gt->inner_count; ++i)
+  {
+    load_align(fp);
+    READ(loc->clv[gt->nodes[i]->clv_index],span,fp);
+  }
+
+  if (loc->scale_buffers)
+  {
+    size_t scaler_size = (loc->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           loc->sites * loc->rate_cats : loc->sites;
+
+    for (i = gt->tip_count; i < gt->tip_count + gt->inner_count; ++i)
+    {
+      load_align(fp);
+      READ(loc->scale_buffer[gt->nodes[i]->scaler_index],scaler_size,fp);
+    }
+  }
+
+  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
   {
-    unsigned int clv_index = gt->nodes[i]->clv_index;
-    span = locus[index]->sites * locus[index]->states * locus[index]->rate_cats;
+    if (gt->nodes[i] == gt->root) continue;
 
-    if (!LOAD(locus[index]->clv[clv_index],span,fp))
-      fatal("Cannot read gene tree %ld tip CLV", index);
+    load_align(fp);
+    READ(loc->pmatrix[gt->nodes[i]->pmatrix_index],
+         loc->states * loc->states_padded * loc->rate_cats,fp);
   }
+
+  return 1;
 }
 
-void load_chk_section_4(FILE * fp)
+/* load the loci, each of which is a separate section. Sets the entries of
+   warm to 1 for loci whose inner CLVs were restored */
+static void load_chk_section_4(FILE * fp, int * warm)
 {
   long i;
 
   locus = (locus_t **)xmalloc((size_t)opt_locus_count * sizeof(locus_t));
+
   for (i = 0; i < opt_locus_count; ++i)
-    load_locus(fp,i);
+  {
+    load_align(fp);
+    warm[i] = load_locus(fp,i);
+    section_check(fp);
+  }
+}
 
+/* read the table of section offsets, sizes and checksums from the trailer */
+static void load_chk_trailer(FILE * fp)
+{
+  long i;
+  long filesize;
+  long table_size;
+  BYTE magic[4];
+  long trailer_size = (long)sizeof(long) + 4;
+
+  if (fseek(fp,0,SEEK_END) || (filesize = ftell(fp)) < trailer_size ||
+      fseek(fp,filesize-trailer_size,SEEK_SET) ||
+      fread(&section_count,sizeof(long),1,fp) != 1 ||
+      fread(magic,1,4,fp) != 4 || memcmp(magic,CHK_TRAILER_MAGIC,4))
+    fatal("Checkpoint file %s is truncated or corrupted", opt_resume);
+
+  table_size = section_count*3*(long)sizeof(long);
+  if (section_count < 6 || table_size > filesize - trailer_size)
+    fatal("Checkpoint file %s is truncated or corrupted", opt_resume);
+
+  section_table = (long *)xmalloc((size_t)table_size);
+  if (fseek(fp,filesize-trailer_size-table_size,SEEK_SET) ||
+      fread(section_table,sizeof(long),(size_t)(3*section_count),fp) !=
+        (size_t)(3*section_count))
+    fatal("Checkpoint file %s is truncated or corrupted", opt_resume);
+
+  for (i = 0; i < section_count; ++i)
+  {
+    long offset = section_table[3*i];
+    long size = section_table[3*i+1];
+
+    if (offset < 0 || size < 0 ||
+        offset+size > filesize - trailer_size - table_size)
+      fatal("Checkpoint file %s is truncated or corrupted", opt_resume);
+  }
+
+  section_verify_all();
+
+  if (fseek(fp,0,SEEK_SET))
+    fatal("Cannot read checkpoint file %s", opt_resume);
+
+  section_current = 0;
 }
 
 int checkpoint_load(gtree_t *** gtreep,
@@ -1113,13 +1275,17 @@ int checkpoint_load(gtree_t *** gtreep,
   assert(opt_resume);
 
   fprintf(stdout, "Loading checkpoint file %s\n\n", opt_resume);
-  fp = fopen(opt_resume,"r");
+  fp = fopen(opt_resume,"rb");
   if (!fp)
     fatal("Cannot open checkpoint file %s", opt_resume);
 
+  /* read section table and verify the checksums of all sections */
+  load_chk_trailer(fp);
+
   /* read header */
   fprintf(stdout,"HEADER:\n");
   load_chk_header(fp);
+  section_check(fp);
 
   /* load section 1 */
   fprintf(stdout,"SECTION 1:\n");
@@ -1144,27 +1310,47 @@ int checkpoint_load(gtree_t *** gtreep,
                      mean_theta,
                      mean_tau_count,
                      mean_theta_count);
+  section_check(fp);
 
   /* load section 2 */
   load_chk_section_2(fp);
+  section_check(fp);
 
   /* initialize gene trees */
 //  gtree = init_gtrees(opt_locus_count);
 
   /* load section 3 */
   load_chk_section_3(fp,opt_locus_count);
+  section_check(fp);
 
   /* load section 4 */
-  load_chk_section_4(fp);
+  int * warm = (int *)xmalloc((size_t)opt_locus_count * sizeof(int));
+  load_chk_section_4(fp,warm);
+
+  /* load summary of sampled species trees */
+  if (opt_est_stree && !opt_est_delimit)
+    stree_summary_load(fp,stree);
+  else if (opt_est_stree && opt_est_delimit)
+    mixed_summary_load(fp);
+  section_check(fp);
+
+  if (section_current != section_count)
+    fatal("Checkpoint file %s is corrupted", opt_resume);
+  free(section_table);
 
   /* TODO: set tip sequences, charmap etc when using tipchars */
 
-  /* update pmatrices and CLVs */
+  /* update pmatrices and CLVs, unless they were restored */
   for (i = 0; i < opt_locus_count; ++i)
   {
     gtree_reset_leaves(gtree[i]->root);
-    locus_update_matrices_jc69(locus[i],gtree[i]->nodes,gtree[i]->edge_count);
-    locus_update_all_partials(locus[i],gtree[i]);
+    if (!warm[i])
+    {
+      locus_update_matrices_jc69(locus[i],
+                                 gtree[i]->nodes,
+                                 gtree[i]->edge_count);
+      locus_update_all_partials(locus[i],gtree[i]);
+    }
 
     unsigned int param_indices[1] = {0};
     gtree[i]->logl = locus_root_loglikelihood(locus[i],
@@ -1172,6 +1358,7 @@ int checkpoint_load(gtree_t *** gtreep,
                                               param_indices,
                                               NULL);
   }
+  free(warm);
 
   #if 0
   unsigned int param_indices[1] = {0};
@@ -1002,6 +1002,9 @@ static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
   rscaler = (rnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
               NULL : locus->scale_buffer[rnode->scaler_index];
 
+  if (prof_active)
+    prof_partials_count++;
+
   pll_core_update_partial_ii(locus->states,
                              locus->sites,
                              locus->rate_cats,
@@ -1035,6 +1038,9 @@ void locus_update_partials(locus_t * locus, gnode_t ** traversal, unsigned int c
 
   if (!opt_usedata) return;
 
+  if (prof_active)
+    prof_partials_count += count;
+
   for (i = 0; i < count; ++i)
   {
     node  = traversal[i];
@@ -1076,6 +1082,9 @@ double locus_root_loglikelihood(locus_t * locus,
 
   if (!opt_usedata) return 0;
 
+  if (prof_active)
+    prof_logl_count++;
+
   scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
              NULL : locus->scale_buffer[root->scaler_index];
 
@@ -0,0 +1,334 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Binary MCMC sample file (method A00). Samples are buffered in memory and
+   appended in column-major chunks through the background writer:
+
+   header:  magic, version, sizeof(long), sizeof(double), column count,
+            column labels (length-prefixed, including 'Gen')
+   chunk:   row count n, n generation numbers, then n values per column
+
+   A partial chunk is written at every checkpoint so that the file offset
+   stored in the checkpoint always falls on a chunk boundary */
+
+#define MCMCBIN_MAGIC   "BPPS"
+#define MCMCBIN_VERSION 1
+#define MCMCBIN_CHUNK   1024
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+
+static long col_count = 0;
+static long row_count = 0;
+static long * chunk_gen = NULL;
+static double * chunk = NULL;
+
+static void chunk_alloc(long cols)
+{
+  col_count = cols;
+  row_count = 0;
+  chunk_gen = (long *)xmalloc(MCMCBIN_CHUNK * sizeof(long));
+  chunk = (double *)xmalloc((size_t)(cols*MCMCBIN_CHUNK) * sizeof(double));
+}
+
+void mcmcbin_init(FILE * fp, char ** labels, long cols)
+{
+  long i;
+  int version = MCMCBIN_VERSION;
+  BYTE size_type;
+
+  DUMP(MCMCBIN_MAGIC,4,fp);
+  DUMP(&version,1,fp);
+  size_type = (BYTE)sizeof(long);
+  DUMP(&size_type,1,fp);
+  size_type = (BYTE)sizeof(double);
+  DUMP(&size_type,1,fp);
+  DUMP(&cols,1,fp);
+
+  /* labels for the generation column and each value column */
+  for (i = 0; i <= cols; ++i)
+  {
+    const char * s = i ? labels[i-1] : "Gen";
+    long len = (long)strlen(s);
+    DUMP(&len,1,fp);
+    DUMP(s,len,fp);
+  }
+
+  chunk_alloc(cols);
+}
+
+void mcmcbin_resume(long cols)
+{
+  chunk_alloc(cols);
+}
+
+void mcmcbin_flush(long stream)
+{
+  long i;
+
+  if (!row_count) return;
+
+  writer_write(stream,&row_count,sizeof(long));
+  writer_write(stream,chunk_gen,(size_t)row_count*sizeof(long));
+  for (i = 0; i < col_count; ++i)
+    writer_write(stream,
+                 chunk+i*MCMCBIN_CHUNK,
+                 (size_t)row_count*sizeof(double));
+
+  row_count = 0;
+}
+
+void mcmcbin_append(long stream, long gen, const double * values)
+{
+  long i;
+
+  chunk_gen[row_count] = gen;
+  for (i = 0; i < col_count; ++i)
+    chunk[i*MCMCBIN_CHUNK + row_count] = values[i];
+
+  if (++row_count == MCMCBIN_CHUNK)
+    mcmcbin_flush(stream);
+}
+
+void mcmcbin_fini(long stream)
+{
+  mcmcbin_flush(stream);
+
+  free(chunk_gen);
+  free(chunk);
+  chunk_gen = NULL;
+  chunk = NULL;
+  col_count = row_count = 0;
+}
+
+int mcmcbin_detect(const char * filename)
+{
+  char magic[4];
+  FILE * fp = fopen(filename,"rb");
+
+  if (!fp) return 0;
+
+  int rc = fread(magic,1,4,fp) == 4 && !memcmp(magic,MCMCBIN_MAGIC,4);
+  fclose(fp);
+
+  return rc;
+}
+
+static void map_open(const char * filename, mapfile_t * m)
+{
+  if (!mapfile_open(m,filename))
+    fatal("Cannot open file %s", filename);
+}
+
+/* parse header and return labels; leaves the map positioned at the first
+   chunk */
+static char ** read_header(mapfile_t * m,
+                           const char * filename,
+                           long * cols)
+{
+  long i,len;
+  int version;
+  const char * p;
+  char ** labels;
+
+  if (!(p = mapfile_take(m,4+sizeof(int)+2)) || memcmp(p,MCMCBIN_MAGIC,4))
+    fatal("File %s is not a binary MCMC sample file", filename);
+
+  memcpy(&version,p+4,sizeof(int));
+  if (version != MCMCBIN_VERSION ||
+      p[4+sizeof(int)] != sizeof(long) || p[5+sizeof(int)] != sizeof(double))
+    fatal("Incompatible binary MCMC sample file %s", filename);
+
+  if (!mapfile_read(m,cols,sizeof(long)))
+    fatal("Truncated binary MCMC sample file %s", filename);
+  if (*cols < 0)
+    fatal("Corrupted binary MCMC sample file %s", filename);
+
+  labels = (char **)xmalloc((size_t)(*cols+1)*sizeof(char *));
+  for (i = 0; i <= *cols; ++i)
+  {
+    if (!mapfile_read(m,&len,sizeof(long)))
+      fatal("Truncated binary MCMC sample file %s", filename);
+    if (len < 0 || !(p = mapfile_take(m,(size_t)len)))
+      fatal("Truncated binary MCMC sample file %s", filename);
+
+    labels[i] = (char *)xmalloc((size_t)(len+1)*sizeof(char));
+    memcpy(labels[i],p,(size_t)len);
+    labels[i][len] = 0;
+  }
+
+  return labels;
+}
+
+/* return row count of the next chunk and advance past its header, or 0 at
+   the end of file */
+static long next_chunk(mapfile_t * m, const char * filename, long cols)
+{
+  long n;
+
+  if (m->pos == m->size)
+    return 0;
+
+  if (!mapfile_read(m,&n,sizeof(long)))
+    fatal("Truncated binary MCMC sample file %s", filename);
+
+  if (n <= 0 || n > MCMCBIN_CHUNK ||
+      m->size - m->pos < (size_t)n*(sizeof(long) + cols*sizeof(double)))
+    fatal("Truncated binary MCMC sample file %s", filename);
+
+  return n;
+}
+
+static void free_labels(char ** labels, long cols)
+{
+  long i;
+
+  for (i = 0; i <= cols; ++i)
+    free(labels[i]);
+  free(labels);
+}
+
+long mcmcbin_samplecount(const char * filename)
+{
+  long n,cols;
+  long count = 0;
+  mapfile_t m;
+
+  map_open(filename,&m);
+  char ** labels = read_header(&m,filename,&cols);
+
+  while ((n = next_chunk(&m,filename,cols)))
+  {
+    count += n;
+    m.pos += (size_t)n*(sizeof(long) + cols*sizeof(double));
+  }
+
+  free_labels(labels,cols);
+  mapfile_close(&m);
+
+  return count;
+}
+
+/* read at most max_rows samples into the column-major matrix, skipping
+   columns whose matrix entry is NULL. Returns the number of samples read and
+   sets header to the tab-separated labels */
+long mcmcbin_load(const char * filename,
+                  long cols,
+                  long max_rows,
+                  double ** matrix,
+                  char ** header)
+{
+  long i,n;
+  long file_cols;
+  long count = 0;
+  size_t len = 0;
+  mapfile_t m;
+
+  map_open(filename,&m);
+  char ** labels = read_header(&m,filename,&file_cols);
+
+  if (file_cols != cols)
+    fatal("Expected %ld columns in %s but found %ld",
+          cols, filename, file_cols);
+
+  /* build header line */
+  for (i = 0; i <= cols; ++i)
+    len += strlen(labels[i]) + 1;
+  *header = (char *)xmalloc(len*sizeof(char));
+  strcpy(*header,labels[0]);
+  for (i = 1; i <= cols; ++i)
+  {
+    strcat(*header,"\t");
+    strcat(*header,labels[i]);
+  }
+
+  while (count < max_rows && (n = next_chunk(&m,filename,cols)))
+  {
+    long take_rows = MIN(n, max_rows - count);
+
+    /* skip generation numbers */
+    m.pos += (size_t)n*sizeof(long);
+
+    for (i = 0; i < cols; ++i)
+    {
+      if (!matrix[i]) continue;
+
+      memcpy(matrix[i]+count,
+             m.data + m.pos + (size_t)i*n*sizeof(double),
+             (size_t)take_rows*sizeof(double));
+    }
+    m.pos += (size_t)n*cols*sizeof(double);
+    count += take_rows;
+  }
+
+  free_labels(labels,cols);
+  mapfile_close(&m);
+
+  return count;
+}
+
+/* convert a binary sample file to the tab-separated text layout */
+void mcmcbin_export(const char * filename, FILE * fp)
+{
+  long i,j,n;
+  long cols;
+  long gen;
+  double x;
+  mapfile_t m;
+
+  map_open(filename,&m);
+  char ** labels = read_header(&m,filename,&cols);
+
+  fprintf(fp, "%s", labels[0]);
+  for (i = 1; i <= cols; ++i)
+    fprintf(fp, "\t%s", labels[i]);
+  fprintf(fp, "\n");
+
+  /* log-likelihood is printed with fixed precision */
+  int lnl = cols && !strcmp(labels[cols],"lnL");
+
+  while ((n = next_chunk(&m,filename,cols)))
+  {
+    const char * gens = m.data + m.pos;
+    const char * vals = gens + (size_t)n*sizeof(long);
+
+    for (j = 0; j < n; ++j)
+    {
+      memcpy(&gen,gens+j*sizeof(long),sizeof(long));
+      fprintf(fp, "%ld", gen);
+
+      for (i = 0; i < cols; ++i)
+      {
+        memcpy(&x,vals + ((size_t)i*n + j)*sizeof(double),sizeof(double));
+        if (lnl && i == cols-1)
+          fprintf(fp, "\t%.3f", x);
+        else
+          fprintf(fp, "\t%.5g", x);
+      }
+      fprintf(fp, "\n");
+    }
+    m.pos += (size_t)n*(sizeof(long) + cols*sizeof(double));
+  }
+
+  free_labels(labels,cols);
+  mapfile_close(&m);
+}
@@ -28,6 +28,9 @@
 #define MAX_THETA_OUTPUT        3
 #define MAX_TAU_OUTPUT          3
 
+/* number of trees listed in the summary snapshots printed at checkpoints */
+#define SNAPSHOT_TREES          5
+
 const static int rate_matrices = 1;
 
 static double pj_optimum = 0.3;
@@ -111,61 +114,50 @@ static void reset_finetune(double * pjump)
     fprintf(stdout, "\n");
 }
 
-static char * cb_serialize_branch(const snode_t * node)
+static size_t cb_append_branch(const snode_t * node,
+                               char ** buffer,
+                               size_t * maxsize,
+                               size_t pos)
 {
-  char * s = NULL;
+  /* tip label */
+  if (!node->left)
+    pos = xbuf_append(buffer, maxsize, pos, node->label, strlen(node->label));
 
-  /* inner node */
-  if (node->left)
+  if (opt_est_theta && node->theta > 0)
   {
-    if (node->parent)
-    {
-      if (opt_est_theta && node->theta > 0)
-        xasprintf(&s, " #%f: %f", node->theta, node->parent->tau - node->tau);
-      else
-        xasprintf(&s, ": %f", node->parent->tau - node->tau);
-    }
-    else
-    {
-      if (opt_est_theta && node->theta > 0)
-        xasprintf(&s, " #%f", node->theta);
-      else
-      {
-        /* replacement to keep GCC warning from showing up when executing
-           the following:
-           
-           xasprintf(&s, "");
-        */
-
-        s = (char *)xmalloc(sizeof(char));
-        *s = 0;
-
-      }
-    }
-      
+    pos = xbuf_append(buffer, maxsize, pos, " #", 2);
+    pos = xbuf_double(buffer, maxsize, pos, node->theta);
   }
-  else
+
+  /* branch length (root has none) */
+  if (node->parent)
   {
-    if (opt_est_theta && node->theta > 0)
-      xasprintf(&s, "%s #%f: %f",
-               node->label, node->theta, node->parent->tau - node->tau);
-    else
-      xasprintf(&s, "%s: %f", node->label, node->parent->tau - node->tau);
+    pos = xbuf_append(buffer, maxsize, pos, ": ", 2);
+    pos = xbuf_double(buffer, maxsize, pos, node->parent->tau - node->tau);
   }
-    
 
-  return s;
+  return pos;
 }
 
-static void mcmc_printheader(FILE * fp, stree_t * stree)
+/* newick buffer for species tree samples */
+static char * stree_newick = NULL;
+static size_t stree_newick_maxsize = 0;
+
+/* sample buffer for method A00 */
+static double * mcmc_row = NULL;
+
+/* column labels of the MCMC sample file following the generation number */
+static char ** mcmc_labels(stree_t * stree, long * count)
 {
   int print_labels = 1;
   unsigned int i;
+  long n = 0;
 
-  if (opt_method == METHOD_10)          /* species delimitation */
-    fprintf(fp, "Gen\tnp\ttree");
-  else
-    fprintf(fp, "Gen");
+  /* at most one theta and one tau per node, two per locus and lnL */
+  char ** labels = (char **)xmalloc((size_t)(2*(stree->tip_count +
+                                                stree->inner_count) +
+                                             2*opt_locus_count + 1) *
+                                    sizeof(char *));
 
   /* TODO: If number of species > 10 do not print labels */
 
@@ -180,9 +172,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       if (stree->nodes[i]->theta >= 0)
       {
         if (print_labels)
-          fprintf(fp, "\ttheta_%d%s", i+1, stree->nodes[i]->label);
+          xasprintf(labels+n++, "theta_%d%s", i+1, stree->nodes[i]->label);
         else
-          fprintf(fp, "\ttheta_%d", i+1);
+          xasprintf(labels+n++, "theta_%d", i+1);
       }
     }
   }
@@ -193,9 +185,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
     if (stree->nodes[i]->tau)
     {
       if (print_labels)
-        fprintf(fp, "\ttau_%d%s", i+1, stree->nodes[i]->label);
+        xasprintf(labels+n++, "tau_%d%s", i+1, stree->nodes[i]->label);
       else
-        fprintf(fp, "\ttau_%d", i+1);
+        xasprintf(labels+n++, "tau_%d", i+1);
     }
   }
 
@@ -203,31 +195,158 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
   if (opt_est_locusrate && opt_print_locusrate)
   {
     for (i = 0; i < opt_locus_count; ++i)
-      fprintf(fp, "\trate_L%d", i+1);
+      xasprintf(labels+n++, "rate_L%d", i+1);
   }
 
   /* 4. Print mutation rate for each locus */
   if (opt_est_heredity && opt_print_hscalars)
   {
     for (i = 0; i < opt_locus_count; ++i)
-      fprintf(fp, "\theredity_L%d", i+1);
+      xasprintf(labels+n++, "heredity_L%d", i+1);
   }
 
   /* 5. Print log likelihood */
   if (opt_usedata)
-    fprintf(fp, "\tlnL\n"); 
+    labels[n++] = xstrdup("lnL");
+
+  *count = n;
+  return labels;
+}
+
+static void mcmc_printheader(FILE * fp, stree_t * stree)
+{
+  long i,count;
+  char ** labels = mcmc_labels(stree,&count);
+
+  if (opt_method == METHOD_00)
+    mcmc_row = (double *)xmalloc((size_t)count*sizeof(double));
+
+  if (opt_mcmc_binary)
+    mcmcbin_init(fp,labels,count);
   else
+  {
+    if (opt_method == METHOD_10)          /* species delimitation */
+      fprintf(fp, "Gen\tnp\ttree");
+    else
+      fprintf(fp, "Gen");
+
+    for (i = 0; i < count; ++i)
+      fprintf(fp, "\t%s", labels[i]);
     fprintf(fp, "\n");
+  }
+
+  for (i = 0; i < count; ++i)
+    free(labels[i]);
+  free(labels);
+}
+
+/* fill row with the values of a method A00 sample in the column order of
+   the MCMC file and return their number */
+static long mcmc_fill_row(stree_t * stree,
+                          gtree_t ** gtree,
+                          locus_t ** locus,
+                          double * row)
+{
+  unsigned int i;
+  long n = 0;
+
+  /* 1. thetas for tips and then for inner nodes */
+  if (opt_est_theta)
+  {
+    for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+      if (stree->nodes[i]->theta >= 0)
+        row[n++] = stree->nodes[i]->theta;
+  }
+
+  /* 2. taus for inner nodes */
+  for (i = stree->tip_count; i < stree->tip_count+stree->inner_count; ++i)
+    if (stree->nodes[i]->tau)
+      row[n++] = stree->nodes[i]->tau;
+
+  /* 3. mutation rate for each locus */
+  if (opt_est_locusrate && opt_print_locusrate)
+  {
+    for (i = 0; i < opt_locus_count; ++i)
+      row[n++] = locus[i]->mut_rates[0];
+  }
+
+  /* 4. heredity scalar for each locus */
+  if (opt_est_heredity && opt_print_hscalars)
+  {
+    for (i = 0; i < opt_locus_count; ++i)
+      row[n++] = locus[i]->heredity[0];
+  }
+
+  /* 5. log-likelihood if usedata=1 */
+  if (opt_usedata)
+  {
+    double logl = 0;
+
+    for (i = 0; i < stree->locus_count; ++i)
+      logl += gtree[i]->logl;
+
+    row[n++] = logl/opt_bfbeta;
+  }
+
+  return n;
+}
+
+/* format a method A00 sample on the writer thread */
+static void cb_print_row(FILE * fp, const void * data, size_t size)
+{
+  long i;
+  const long * hdr = (const long *)data;
+  const double * row = (const double *)(hdr+2);
+  long n = hdr[1];
+
+  (void)size;
+
+  fprintf(fp, "%ld", hdr[0]);
+
+  /* log-likelihood is the last column if usedata=1 */
+  for (i = 0; i < n - (opt_usedata ? 1 : 0); ++i)
+    fprintf(fp, "\t%.5g", row[i]);
+
+  if (opt_usedata)
+    fprintf(fp, "\t%.3f\n", row[n-1]);
+  else
+    fprintf(fp, "\n");
+}
+
+static void mcmc_logsample_allfixed(long stream,
+                                    int step,
+                                    stree_t * stree,
+                                    gtree_t ** gtree,
+                                    locus_t ** locus)
+{
+  long n = mcmc_fill_row(stree,gtree,locus,mcmc_row);
+
+  if (opt_mcmc_binary)
+  {
+    mcmcbin_append(stream,step,mcmc_row);
+    return;
+  }
+
+  long * hdr = (long *)writer_reserve(stream,
+                                      cb_print_row,
+                                      2*sizeof(long) + n*sizeof(double));
+  hdr[0] = step;
+  hdr[1] = n;
+  memcpy(hdr+2, mcmc_row, n*sizeof(double));
+  writer_commit();
 }
 
 static void mcmc_printinitial(FILE * fp, stree_t * stree)
 {
-  char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-  fprintf(fp, "%s\n", newick);
-  free(newick);
+  stree_export_newick_append(stree->root,
+                             cb_append_branch,
+                             &stree_newick,
+                             &stree_newick_maxsize,
+                             0);
+  fprintf(fp, "%s\n", stree_newick);
 }
 
-static void mcmc_logsample(FILE * fp,
+static void mcmc_logsample(long stream,
                            int step,
                            stree_t * stree,
                            gtree_t ** gtree,
@@ -239,26 +358,40 @@ static void mcmc_logsample(FILE * fp,
 
   if (opt_method == METHOD_01)          /* species tree inference */
   {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s\n", newick);
-    free(newick);
+    size_t len = stree_export_newick_append(stree->root,
+                                            cb_append_branch,
+                                            &stree_newick,
+                                            &stree_newick_maxsize,
+                                            0);
+    stree_newick[len++] = '\n';
+    writer_write(stream, stree_newick, len);
     return;
   }
 
   if (opt_method == METHOD_11)    /* species tree inference and delimitation */
   {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s %ld\n", newick, ndspecies);
-    free(newick);
+    size_t len = stree_export_newick_append(stree->root,
+                                            cb_append_branch,
+                                            &stree_newick,
+                                            &stree_newick_maxsize,
+                                            0);
+    writer_write(stream, stree_newick, len);
+    writer_printf(stream, " %ld\n", ndspecies);
+    return;
+  }
+
+  if (opt_method == METHOD_00)
+  {
+    mcmc_logsample_allfixed(stream,step,stree,gtree,locus);
     return;
   }
 
-  fprintf(fp, "%d", step);
+  writer_printf(stream, "%d", step);
 
   if  (opt_method == METHOD_10)         /* species delimitation */
   {
-    fprintf(fp, "\t%ld", dparam_count);
-    fprintf(fp, "\t%s", delimitation_getparam_string());
+    writer_printf(stream, "\t%ld", dparam_count);
+    writer_printf(stream, "\t%s", delimitation_getparam_string());
   }
 
   /* 1. Print thetas */
@@ -270,7 +403,7 @@ static void mcmc_logsample(FILE * fp,
   {
     for (i = 0; i < stree->tip_count; ++i)
       if (stree->nodes[i]->theta >= 0)
-        fprintf(fp, "\t%.5g", stree->nodes[i]->theta);
+        writer_printf(stream, "\t%.5g", stree->nodes[i]->theta);
   }
 
   /* then for inner nodes */
@@ -278,26 +411,26 @@ static void mcmc_logsample(FILE * fp,
   {
     for (i = stree->tip_count; i < stree->tip_count+stree->inner_count; ++i)
       if (stree->nodes[i]->theta >= 0)
-        fprintf(fp, "\t%.5g", stree->nodes[i]->theta);
+        writer_printf(stream, "\t%.5g", stree->nodes[i]->theta);
   }
 
   /* 2. Print taus for inner nodes */
   for (i = stree->tip_count; i < stree->tip_count+stree->inner_count; ++i)
     if (stree->nodes[i]->tau)
-      fprintf(fp, "\t%.5g", stree->nodes[i]->tau);
+      writer_printf(stream, "\t%.5g", stree->nodes[i]->tau);
 
   /* 3. Print mutation rate for each locus */
   if (opt_est_locusrate && opt_print_locusrate)
   {
     for (i = 0; i < opt_locus_count; ++i)
-      fprintf(fp, "\t%.5g", locus[i]->mut_rates[0]);
+      writer_printf(stream, "\t%.5g", locus[i]->mut_rates[0]);
   }
 
   /* 4. Print mutation rate for each locus */
   if (opt_est_heredity && opt_print_hscalars)
   {
     for (i = 0; i < opt_locus_count; ++i)
-      fprintf(fp, "\t%.5g", locus[i]->heredity[0]);
+      writer_printf(stream, "\t%.5g", locus[i]->heredity[0]);
   }
 
   /* 5. print log-likelihood if usedata=1 */
@@ -308,21 +441,48 @@ static void mcmc_logsample(FILE * fp,
     for (i = 0; i < stree->locus_count; ++i)
       logl += gtree[i]->logl;
 
-    fprintf(fp, "\t%.3f\n", logl/opt_bfbeta);
+    writer_printf(stream, "\t%.3f\n", logl/opt_bfbeta);
   }
   else
-    fprintf(fp, "\n");
+    writer_printf(stream, "\n");
+}
+
+/* number of gene tree files; a single container holds all loci */
+static long gtree_file_count()
+{
+  return opt_gtree_container ? 1 : opt_locus_count;
+}
+
+static char * gtree_filename(long index)
+{
+  char * s = NULL;
+
+  if (opt_gtree_container)
+    xasprintf(&s, "%s.gtree", opt_outfile);
+  else
+    xasprintf(&s, "%s.gtree.L%ld", opt_outfile, index+1);
+
+  return s;
 }
 
-static void print_gtree(FILE ** fp, gtree_t ** gtree)
+/* gene trees are copied and formatted into newick on the writer thread */
+static void print_gtree(long * streams, gtree_t ** gtree, long sample)
 {
   long i;
 
+  if (opt_gtree_container)
+  {
+    gtreefile_append(streams[0], sample, gtree, opt_locus_count);
+    return;
+  }
+
   for (i = 0; i < opt_locus_count; ++i)
   {
-    char * newick = gtree_export_newick(gtree[i]->root,NULL);
-    fprintf(fp[i], "%s\n", newick);
-    free(newick);
+    size_t size = gtree_snapshot_size(gtree[i]);
+    gtree_snapshot(gtree[i], writer_reserve(streams[i],
+                                            gtree_snapshot_print,
+                                            size));
+    writer_commit();
   }
 }
 
@@ -397,14 +557,12 @@ static FILE * resume(stree_t ** ptr_stree,
   if (opt_print_genetrees)
   {
     assert(gtree_offset);
-    gtree_files = (char **)xmalloc((size_t)opt_locus_count*sizeof(char *));
+    gtree_files = (char **)xmalloc((size_t)gtree_file_count()*sizeof(char *));
 
-    for (i = 0; i < opt_locus_count; ++i)
+    for (i = 0; i < gtree_file_count(); ++i)
     {
-      char * s = NULL;
-      xasprintf(&s, "%s.gtree.L%ld", opt_outfile, i+1);
-      gtree_files[i] = s;
-      checkpoint_truncate(s,gtree_offset[i]);
+      gtree_files[i] = gtree_filename(i);
+      checkpoint_truncate(gtree_files[i],gtree_offset[i]);
     }
     free(gtree_offset);
   }
@@ -448,8 +606,23 @@ static FILE * resume(stree_t ** ptr_stree,
   else
     opt_method = METHOD_11;
 
+  /* binary MCMC files are recognized by their magic number */
+  opt_mcmc_binary = mcmcbin_detect(opt_mcmcfile);
+  if (opt_method == METHOD_00)
+  {
+    long count;
+    char ** labels = mcmc_labels(stree,&count);
+    for (i = 0; i < count; ++i)
+      free(labels[i]);
+    free(labels);
+
+    if (opt_mcmc_binary)
+      mcmcbin_resume(count);
+    mcmc_row = (double *)xmalloc((size_t)count*sizeof(double));
+  }
+
   /* open truncated MCMC file for appending */
-  if (!(fp_mcmc = fopen(opt_mcmcfile, "a")))
+  if (!(fp_mcmc = fopen(opt_mcmcfile, opt_mcmc_binary ? "ab" : "a")))
     fatal("Cannot open file %s for appending...", opt_mcmcfile);
   if (!(fp_out = fopen(opt_outfile, "a")))
     fatal("Cannot open file %s for appending...", opt_outfile);
@@ -459,10 +632,12 @@ static FILE * resume(stree_t ** ptr_stree,
   *ptr_fp_gtree = NULL;
   if (opt_print_genetrees)
   {
-    FILE ** fp_gtree = (FILE **)xmalloc((size_t)opt_locus_count*sizeof(FILE *));
-    for (i = 0; i < opt_locus_count; ++i)
+    FILE ** fp_gtree = (FILE **)xmalloc((size_t)gtree_file_count() *
+                                        sizeof(FILE *));
+    for (i = 0; i < gtree_file_count(); ++i)
     {
-      if (!(fp_gtree[i] = fopen(gtree_files[i], "a")))
+      if (!(fp_gtree[i] = fopen(gtree_files[i],
+                                opt_gtree_container ? "ab" : "a")))
         fatal("Cannot open file %s for appending...", gtree_files[i]);
       free(gtree_files[i]);
     }
@@ -516,6 +691,163 @@ static FILE * resume(stree_t ** ptr_stree,
   return fp_mcmc;
 }
 
+/* per-locus data for the parallel startup stages in init */
+typedef struct init_data_s
+{
+  msa_t ** msa_list;
+  unsigned int ** weights;
+  unsigned long ** mapping;
+  unsigned long ** resolution_count;
+  int * unphased_length;
+  stree_t * stree;
+  gtree_t ** gtree;
+  locus_t ** locus;
+  double * locusrate;
+  double * heredity;
+} init_data_t;
+
+static void cb_init_compress(long i, void * data)
+{
+  init_data_t * d = (init_data_t *)data;
+  msa_t * msa = d->msa_list[i];
+
+  /* remove ambiguous sites */
+  if (opt_cleandata)
+  {
+    if (!msa_remove_ambiguous(msa))
+      fatal("All sites in locus %ld contain ambiguous characters",i);
+  }
+  else
+    msa_count_ambiguous_sites(msa, pll_map_amb);
+
+  /* compress it */
+  msa->original_length = msa->length;
+  d->weights[i] = compress_site_patterns(msa->sequence,
+                                         pll_map_nt,
+                                         msa->count,
+                                         &(msa->length),
+                                         COMPRESS_JC69);
+}
+
+static void cb_init_compress_diploid(long i, void * data)
+{
+  init_data_t * d = (init_data_t *)data;
+
+  /* compress again for JC69 and get mappings */
+  d->mapping[i] = compress_site_patterns_diploid(d->msa_list[i]->sequence,
+                                                 pll_map_nt,
+                                                 d->msa_list[i]->count,
+                                                 &(d->msa_list[i]->length),
+                                                 COMPRESS_JC69);
+}
+
+static void cb_init_locus(long i, void * data)
+{
+  long j;
+  init_data_t * d = (init_data_t *)data;
+  msa_t * msa = d->msa_list[i];
+  gtree_t * gtree = d->gtree[i];
+  locus_t * locus;
+  double frequencies[4] = {0.25, 0.25, 0.25, 0.25};
+  unsigned int pmatrix_count = gtree->edge_count;
+
+  unsigned int scale_buffers = opt_scaling ? 2*gtree->inner_count : 0;
+
+  /* if species tree inference or locusrate enabled, activate twice as many
+     transition probability matrices */
+  if (opt_est_stree || opt_est_locusrate || opt_est_heredity)
+    pmatrix_count *= 2;               /* double to account for cloned */
+
+  /* TODO: In the future we can allocate double amount of p-matrices
+     for the other methods as well in order to speedup rollback when
+     rejecting proposals */
+
+  /* create the locus structure */
+  locus = d->locus[i] = locus_create(gtree->tip_count,   /* # tip sequence */
+                                     2*gtree->inner_count, /* # CLV vectors */
+                                     4,                  /* # states */
+                                     msa->length,        /* sequence length */
+                                     rate_matrices,      /* subst matrices (1) */
+                                     pmatrix_count,      /* # prob matrices */
+                                     1,                  /* # rate categories */
+                                     scale_buffers,      /* # scale buffers */
+                                     (unsigned int)opt_arch); /* attributes */
+
+  /* set frequencies for model with index 0 */
+  pll_set_frequencies(locus,0,frequencies);
+
+  if (opt_diploid)
+  {
+    for (j = 0; j < (long)(d->stree->tip_count); ++j)
+      if (d->stree->nodes[j]->diploid)
+      {
+        locus->diploid = 1;
+        break;
+      }
+  }
+
+  /* TODO with more complex mixture models where rate_matrices > 1 we need
+     to revisit this */
+  assert(rate_matrices == 1);
+  locus_set_mut_rates(locus,d->locusrate+i);
+  locus_set_heredity_scalers(locus,d->heredity+i);
+
+  /* set pattern weights and free the weights array */
+  if (locus->diploid)
+  {
+    /* TODO: 1) pattern_weights_sum is not updated here, but it is not used in
+       the program, perhaps remove.
+       2) pattern_weights is allocated in locus_create with a size msa->length
+          equal to length of A3, but in reality we only need |A1| storage
+          space. Free and reallocate here. *UPDATE* Actually |A1| may be larger
+          than |A3| !! */
+
+    free(locus->pattern_weights);
+    locus->pattern_weights = (unsigned int *)xmalloc((size_t)
+                               (d->unphased_length[i])*sizeof(unsigned int));
+
+    locus->diploid_mapping = d->mapping[i];
+    locus->diploid_resolution_count = d->resolution_count[i];
+    /* since PLL does not support diploid sequences we make a small hack */
+    memcpy(locus->pattern_weights,
+           d->weights[i],
+           d->unphased_length[i]*sizeof(unsigned int));
+    free(d->weights[i]);
+    locus->likelihood_vector = (double *)xmalloc((size_t)(msa->length) *
+                                                 sizeof(double));
+    locus->unphased_length = d->unphased_length[i];
+  }
+  else
+  {
+    pll_set_pattern_weights(locus, d->weights[i]);
+    free(d->weights[i]);
+  }
+
+  /* set tip sequences */
+  for (j = 0; j < (int)(gtree->tip_count); ++j)
+    pll_set_tip_states(locus, j, pll_map_nt, msa->sequence[j]);
+
+  /* compute the conditional probabilities for each inner node */
+  locus_update_matrices_jc69(locus,gtree->nodes,gtree->edge_count);
+  locus_update_partials(locus,
+                        gtree->nodes+gtree->tip_count,
+                        gtree->inner_count);
+
+  /* optionally, show root CLV 
+
+  pll_show_clv(locus, gtree->root->clv_index, PLL_SCALE_BUFFER_NONE, 9);
+
+  */
+
+  /* now that we computed the CLVs, calculate the log-likelihood for the
+     current gene tree */
+  unsigned int param_indices[1] = {0};
+  gtree->logl = locus_root_loglikelihood(locus,
+                                         gtree->root,
+                                         param_indices,
+                                         NULL);
+}
+
 /* initialize everything - species tree, gene trees, locus structures etc.
    NOTE: *ALL* parameters of this function are output parameters, therefore
    do not concentrate on them when reading this function - they are filled
@@ -564,16 +896,46 @@ static FILE * init(stree_t ** ptr_stree,
   stree = load_tree();
   printf(" Done\n");
 
-  /* parse the phylip file */
-  phylip_t * fd = phylip_open(opt_msafile, pll_map_fasta);
-  assert(fd);
+  unsigned int ** weights = NULL;
+  int cached = 0;
+  uint64_t cache_key = 0;
+  FILE * fp_cache = NULL;
+  msa_t ** phased_list = NULL;
+  unsigned long ** cached_rc = NULL;
+  unsigned long ** cached_mapping = NULL;
 
-  printf("Parsing phylip file...");
-  msa_list = phylip_parse_multisequential(fd, &msa_count);
-  assert(msa_list);
-  printf(" Done\n");
+  if (opt_datacache && !datacache_usable(stree))
+    opt_datacache = 0;
+
+  /* try to restore preprocessed alignments from the data cache */
+  if (opt_datacache)
+  {
+    cache_key = datacache_key(stree);
+    cached = datacache_load(cache_key,
+                            &msa_list,
+                            &weights,
+                            &phased_list,
+                            &cached_rc,
+                            &cached_mapping,
+                            &msa_count);
+    if (cached)
+      printf("Loaded preprocessed data from cache\n");
+  }
+
+  if (!cached)
+  {
+    /* parse the phylip file */
+    phylip_t * fd = phylip_open(opt_msafile, pll_map_fasta);
+    assert(fd);
+
+    printf("Parsing phylip file...");
+    msa_list = phylip_parse_multisequential(fd, &msa_count);
+    assert(msa_list);
+    printf(" Done\n");
+
+    phylip_close(fd);
+  }
 
-  phylip_close(fd);
   if (opt_locus_count > msa_count)
     fatal("Expected %ld loci but found only %ld", opt_locus_count, msa_count);
 
@@ -585,33 +947,26 @@ static FILE * init(stree_t ** ptr_stree,
   if (opt_locus_count == 1 && opt_est_locusrate)
     fatal("Cannot use option 'locusrate' with only one locus");
 
-  /* remove ambiguous sites */
-  if (opt_cleandata)
-  {
-    printf("Removing sites containing ambiguous characters...");
-    for (i = 0; i < msa_count; ++i)
-      if (!msa_remove_ambiguous(msa_list[i]))
-        fatal("All sites in locus %d contain ambiguous characters",i);
-    printf(" Done\n");
-  }
-  else
-  {
-    for (i = 0; i < msa_count; ++i)
-      msa_count_ambiguous_sites(msa_list[i], pll_map_amb);
-  }
+  init_data_t init_data;
+  init_data.msa_list = msa_list;
+  init_data.stree = stree;
 
-  /* compress it */
-  unsigned int ** weights = (unsigned int **)xmalloc(msa_count *
-                                                     sizeof(unsigned int *));
-  for (i = 0; i < msa_count; ++i)
+  if (!cached)
   {
-    msa_list[i]->original_length = msa_list[i]->length;
-    weights[i] = compress_site_patterns(msa_list[i]->sequence,
-                                        pll_map_nt,
-                                        msa_list[i]->count,
-                                        &(msa_list[i]->length),
-                                        COMPRESS_JC69);
+    /* remove ambiguous sites and compress each locus */
+    if (opt_cleandata)
+      printf("Removing sites containing ambiguous characters...");
+    weights = (unsigned int **)xmalloc(msa_count * sizeof(unsigned int *));
+    init_data.weights = weights;
+    threads_parallel_for(msa_count, cb_init_compress, &init_data);
+    if (opt_cleandata)
+      printf(" Done\n");
+
+    /* A1 must be stored before diploid resolution modifies it in place */
+    if (opt_datacache && (fp_cache = datacache_create(cache_key, msa_count)))
+      datacache_write_msa(fp_cache, msa_list, weights, msa_count);
   }
+
   msa_summary(msa_list,msa_count);
 
   /* parse map file */
@@ -627,8 +982,8 @@ static FILE * init(stree_t ** ptr_stree,
 
   if (!opt_onlysummary)
   {
-    if (!(fp_mcmc = fopen(opt_mcmcfile, "w")))
-      fatal("Cannot open file %s for writing...");
+    if (!(fp_mcmc = fopen(opt_mcmcfile, opt_mcmc_binary ? "wb" : "w")))
+      fatal("Cannot open file %s for writing...", opt_mcmcfile);
   }
 
   if (!(fp_out = fopen(opt_outfile, "w")))
@@ -646,14 +1001,15 @@ static FILE * init(stree_t ** ptr_stree,
   /* if print gtree */
   if (opt_print_genetrees)
   {
-    fp_gtree = (FILE **)xmalloc((size_t)opt_locus_count*sizeof(FILE *));
-    for (i = 0; i < opt_locus_count; ++i)
+    fp_gtree = (FILE **)xmalloc((size_t)gtree_file_count()*sizeof(FILE *));
+    for (i = 0; i < gtree_file_count(); ++i)
     {
-      char * s = NULL;
-      xasprintf(&s, "%s.gtree.L%ld", opt_outfile, i+1);
-      fp_gtree[i] = xopen(s,"w");
+      char * s = gtree_filename(i);
+      fp_gtree[i] = xopen(s, opt_gtree_container ? "wb" : "w");
       free(s);
     }
+    if (opt_gtree_container)
+      gtreefile_header(fp_gtree[0], opt_locus_count);
   }
   else
     fp_gtree = NULL;
@@ -673,37 +1029,60 @@ static FILE * init(stree_t ** ptr_stree,
     for (i = 0; i < msa_count; ++i)
       unphased_length[i] = msa_list[i]->length;
 
-    /* compute and replace msa_list with alignments A3. resolution_count
-       contains the number of resolved sites in A2 for each site in A1,
-       i.e. resolution_count[0][3] contains the number of resolved sites in A2
-       for the fourth site of locus 0 */
-    resolution_count = diploid_resolve(stree,
-                                       msa_list,
-                                       map_list,
-                                       weights,
-                                       msa_count,
-                                       pll_map_nt);
-
-    /* TODO: KEEP WEIGHTS */
-    //for (i = 0; i < msa_count; ++i) free(weights[i]);
+    if (cached)
+    {
+      /* replace msa_list with the cached alignments A3 */
+      for (i = 0; i < msa_count; ++i)
+      {
+        msa_destroy(msa_list[i]);
+        msa_list[i] = phased_list[i];
+      }
+      free(phased_list);
 
-    mapping = (unsigned long **)xmalloc((size_t)msa_count *
-                                        sizeof(unsigned long *));
+      resolution_count = cached_rc;
+      mapping = cached_mapping;
 
-    for (i = 0; i < msa_count; ++i)
+      diploid_update_maplist(stree, map_list);
+    }
+    else
     {
-      /* compress again for JC69 and get mappings */
-      mapping[i] = compress_site_patterns_diploid(msa_list[i]->sequence,
-                                                  pll_map_nt,
-                                                  msa_list[i]->count,
-                                                  &(msa_list[i]->length),
-                                                  COMPRESS_JC69);
+      /* compute and replace msa_list with alignments A3. resolution_count
+         contains the number of resolved sites in A2 for each site in A1,
+         i.e. resolution_count[0][3] contains the number of resolved sites in A2
+         for the fourth site of locus 0 */
+      resolution_count = diploid_resolve(stree,
+                                         msa_list,
+                                         map_list,
+                                         weights,
+                                         msa_count,
+                                         pll_map_nt);
+
+      /* TODO: KEEP WEIGHTS */
+      //for (i = 0; i < msa_count; ++i) free(weights[i]);
+
+      mapping = (unsigned long **)xmalloc((size_t)msa_count *
+                                          sizeof(unsigned long *));
+
+      init_data.mapping = mapping;
+      threads_parallel_for(msa_count, cb_init_compress_diploid, &init_data);
+
+      if (fp_cache)
+        datacache_write_phased(fp_cache,
+                               msa_list,
+                               resolution_count,
+                               mapping,
+                               unphased_length,
+                               msa_count);
     }
+
     fprintf(fp_out, "COMPRESSED ALIGNMENTS AFTER PHASING OF DIPLOID SEQUENCES\n\n");
     msa_print_phylip(fp_out,msa_list,msa_count);
 
   }
 
+  if (fp_cache)
+    datacache_close(fp_cache);
+
   if (opt_method == METHOD_10)          /* species delimitation */
   {
     long dmodels_count = delimitations_init(stree);
@@ -860,112 +1239,23 @@ static FILE * init(stree_t ** ptr_stree,
 
 
   gtree_update_branch_lengths(gtree, msa_count);
-  for (i = 0; i < msa_count; ++i)
-  {
-    msa_t * msa = msa_list[i];
-    double frequencies[4] = {0.25, 0.25, 0.25, 0.25};
-    unsigned int pmatrix_count = gtree[i]->edge_count;
-
-    unsigned int scale_buffers = opt_scaling ?
-                                   2*gtree[i]->inner_count : 0;
-
-    /* if species tree inference or locusrate enabled, activate twice as many
-       transition probability matrices */
-    if (opt_est_stree || opt_est_locusrate || opt_est_heredity)
-      pmatrix_count *= 2;               /* double to account for cloned */
-
-    /* TODO: In the future we can allocate double amount of p-matrices
-       for the other methods as well in order to speedup rollback when
-       rejecting proposals */
-
-    /* create the locus structure */
-    locus[i] = locus_create(gtree[i]->tip_count,        /* # tip sequence */
-                            2*gtree[i]->inner_count,    /* # CLV vectors */
-                            4,                          /* # states */
-                            msa->length,                /* sequence length */
-                            rate_matrices,              /* subst matrices (1) */
-                            pmatrix_count,              /* # prob matrices */
-                            1,                          /* # rate categories */
-                            scale_buffers,              /* # scale buffers */
-                            (unsigned int)opt_arch);    /* attributes */
-
-    /* set frequencies for model with index 0 */
-    pll_set_frequencies(locus[i],0,frequencies);
-
-    if (opt_diploid)
-    {
-      for (j = 0; j < (long)(stree->tip_count); ++j)
-        if (stree->nodes[j]->diploid)
-        {
-          locus[i]->diploid = 1;
-          break;
-        }
-    }
 
-    /* TODO with more complex mixture models where rate_matrices > 1 we need
-       to revisit this */
-    assert(rate_matrices == 1);
-    locus_set_mut_rates(locus[i],locusrate+i);
-    locus_set_heredity_scalers(locus[i],heredity+i);
+  /* create the loci and compute the initial log-likelihoods in parallel */
+  init_data.weights = weights;
+  init_data.gtree = gtree;
+  init_data.locus = locus;
+  init_data.locusrate = locusrate;
+  init_data.heredity = heredity;
+  init_data.mapping = mapping;
+  init_data.resolution_count = resolution_count;
+  init_data.unphased_length = unphased_length;
+  threads_parallel_for(msa_count, cb_init_locus, &init_data);
 
-    /* set pattern weights and free the weights array */
-    if (locus[i]->diploid)
-    {
-      /* TODO: 1) pattern_weights_sum is not updated here, but it is not used in
-         the program, perhaps remove.
-         2) pattern_weights is allocated in locus_create with a size msa->length
-            equal to length of A3, but in reality we only need |A1| storage
-            space. Free and reallocate here. *UPDATE* Actually |A1| may be larger
-            than |A3| !! */
-
-      free(locus[i]->pattern_weights);
-      locus[i]->pattern_weights = (unsigned int *)xmalloc((size_t)
-                                     (unphased_length[i])*sizeof(unsigned int));
-
-      locus[i]->diploid_mapping = mapping[i];
-      locus[i]->diploid_resolution_count = resolution_count[i];
-      /* since PLL does not support diploid sequences we make a small hack */
-      memcpy(locus[i]->pattern_weights,
-             weights[i],
-             unphased_length[i]*sizeof(unsigned int));
-      free(weights[i]);
-      locus[i]->likelihood_vector = (double *)xmalloc((size_t)(msa->length) *
-                                                      sizeof(double));
-      locus[i]->unphased_length = unphased_length[i];
-    }
-    else
-    {
-      pll_set_pattern_weights(locus[i], weights[i]);
-      free(weights[i]);
-    }
-
-    /* set tip sequences */
-    for (j = 0; j < (int)(gtree[i]->tip_count); ++j)
-      pll_set_tip_states(locus[i], j, pll_map_nt, msa_list[i]->sequence[j]);
-
-    /* compute the conditional probabilities for each inner node */
-    locus_update_matrices_jc69(locus[i],gtree[i]->nodes,gtree[i]->edge_count);
-    locus_update_partials(locus[i],
-                          gtree[i]->nodes+gtree[i]->tip_count,
-                          gtree[i]->inner_count);
-
-    /* optionally, show root CLV 
-
-    pll_show_clv(locus[i], gtree[i]->root->clv_index, PLL_SCALE_BUFFER_NONE, 9);
-
-    */
-
-    /* now that we computed the CLVs, calculate the log-likelihood for the
-       current gene tree */
-    unsigned int param_indices[1] = {0};
-    logl = locus_root_loglikelihood(locus[i],
-                                    gtree[i]->root,
-                                    param_indices,
-                                    NULL);
+  for (i = 0; i < msa_count; ++i)
+  {
+    logl = gtree[i]->logl;
     logl_sum += logl;
 
-    /* store current log-likelihood in each gene tree structure */
-    gtree[i]->logl = logl;
     if (opt_est_theta)
     {
       logpr = gtree_logprob(stree,locus[i]->heredity[0],i);
@@ -1020,13 +1310,19 @@ static FILE * init(stree_t ** ptr_stree,
   /* if method 00 or 01 print corresponding header line in MCMC file */
   if (!opt_onlysummary)
   {
+    /* summaries of sampled species trees are accumulated during sampling (and
+       restored from the checkpoint on resume). The initial tree of method 01
+       is part of the sample file and hence of the summary */
     if (opt_method == METHOD_01)
-      mcmc_printinitial(fp_mcmc,stree);
-    else
     {
-      if (opt_method != METHOD_11)
-        mcmc_printheader(fp_mcmc,stree);
+      mcmc_printinitial(fp_mcmc,stree);
+      stree_summary_init(stree);
+      stree_summary_add(stree);
     }
+    else if (opt_method == METHOD_11)
+      mixed_summary_init();
+    else
+      mcmc_printheader(fp_mcmc,stree);
   }
 
   unsigned long total_steps = opt_samples * opt_samplefreq + opt_burnin;
@@ -1124,6 +1420,7 @@ void cmd_run()
 
   unsigned long curstep = 0;
 
+  prof_run_start();
 
   if (opt_resume)
     fp_mcmc = resume(&stree,
@@ -1189,11 +1486,36 @@ void cmd_run()
   }
 
   if (opt_checkpoint && opt_print_genetrees)
-    gtree_offset = (long *)xmalloc((size_t)opt_locus_count*sizeof(long));
+    gtree_offset = (long *)xmalloc((size_t)gtree_file_count()*sizeof(long));
+
+  /* samples and gene trees are written by a background thread while
+     sampling */
+  long mcmc_stream = -1;
+  long * gtree_stream = NULL;
+  if (!opt_onlysummary)
+  {
+    writer_init();
+    mcmc_stream = writer_open(fp_mcmc);
+    if (opt_print_genetrees)
+    {
+      gtree_stream = (long *)xmalloc((size_t)gtree_file_count() *
+                                     sizeof(long));
+      for (j = 0; j < gtree_file_count(); ++j)
+        gtree_stream[j] = writer_open(fp_gtree[j]);
+    }
+  }
+
+  /* hardware counters of the likelihood kernels during MCMC */
+  if (opt_perfcounters)
+    perfcnt_init();
 
   unsigned long total_steps = opt_samples * opt_samplefreq + opt_burnin;
   progress_init("Running MCMC...", total_steps);
 
+  time_t checkpoint_time = time(NULL);
+
+  prof_init(locus,opt_locus_count);
+
   printk = opt_samplefreq * opt_samples;
 
   /* check if summary only was requested (no MCMC) and initialize counter
@@ -1203,9 +1525,18 @@ void cmd_run()
   else
     i = curstep - opt_burnin;
 
+  prof_run_first(curstep);
+  trace_init();
+  if (opt_status_interval)
+    status_init(curstep,total_steps);
+
   /* *** start of MCMC loop *** */
   for (; i < opt_samples*opt_samplefreq; ++i)
   {
+    /* steps are numbered from 1 in the trace window */
+    trace_step(curstep+1);
+    int64_t trace_step_start = trace_begin();
+
     /* update progress bar */
     if (!opt_quiet)
       progress_update(curstep);
@@ -1253,10 +1584,12 @@ if(i>=0 && opt_revolutionary_spr_method)
     /* propose delimitation through merging/splitting of nodes */
     if (opt_est_delimit)        /* species delimitation */
     {
+      prof_begin();
       if (legacy_rndu() < 0.5)
         j = prop_split(gtree,stree,locus,0.5,&dparam_count,&ndspecies);
       else
         j = prop_join(gtree,stree,locus,0.5,&dparam_count,&ndspecies);
+      prof_end(PROF_RJ);
 
       if (j != 2)
       {
@@ -1271,6 +1604,7 @@ if(i>=0 && opt_revolutionary_spr_method)
       if (legacy_rndu() > 0)   /* bpp4 compatible results (RNG to next state) */
       {
         long ret;
+        prof_begin();
         ret = stree_propose_spr(&stree, &gtree, &sclone, &gclones, locus);
         if (ret == 1)
         {
@@ -1281,6 +1615,7 @@ if(i>=0 && opt_revolutionary_spr_method)
           stree_label(stree);
           pjump_slider++;
         }
+        prof_end(PROF_SSPR);
         if (ret != 2)
           ft_round_spr++;
       }
@@ -1289,43 +1624,61 @@ if(i>=0 && opt_revolutionary_spr_method)
     /* perform proposals sequentially */   
 
     /* propose gene tree ages */
+    prof_begin();
     ratio = gtree_propose_ages(locus, gtree, stree);
+    prof_end(PROF_GTAGE);
     pjump[0] = (pjump[0]*(ft_round-1) + ratio) / (double)ft_round;
 
     /* propose gene tree topologies using SPR */
+    prof_begin();
     ratio = gtree_propose_spr(locus,gtree,stree);
+    prof_end(PROF_GTSPR);
     pjump[1] = (pjump[1]*(ft_round-1) + ratio) / (double)ft_round;
 
     /* propose population sizes on species tree */
     if (opt_est_theta)
     {
+      prof_begin();
       ratio = stree_propose_theta(gtree,locus,stree);
+      prof_end(PROF_THETA);
       pjump[2] = (pjump[2]*(ft_round-1) + ratio) / (double)ft_round;
     }
 
     /* propose species tree taus */
     if (stree->tip_count > 1 && stree->root->tau > 0)
     {
+      prof_begin();
       ratio = stree_propose_tau(gtree,stree,locus);
+      prof_end(PROF_TAU);
       pjump[3] = (pjump[3]*(ft_round-1) + ratio) / (double)ft_round;
     }
 
     /* mixing step */
+    prof_begin();
     ratio = proposal_mixing(gtree,stree,locus);
+    prof_end(PROF_MIX);
     pjump[4] = (pjump[4]*(ft_round-1) + ratio) / (double)ft_round;
 
     if (opt_est_locusrate || opt_est_heredity)
     {
+      prof_begin();
       ratio = prop_locusrate_and_heredity(gtree,stree,locus);
+      prof_end(PROF_LRHT);
       pjump[5] = (pjump[5]*(ft_round-1) + ratio) / (double)ft_round;
     }
 
     /* log sample into file (dparam_count is only used in method 10) */
     if (i >= 0 && (i+1)%opt_samplefreq == 0)
     {
-      mcmc_logsample(fp_mcmc,i+1,stree,gtree,locus,dparam_count,ndspecies);
+      prof_begin();
+      mcmc_logsample(mcmc_stream,i+1,stree,gtree,locus,dparam_count,ndspecies);
+      if (opt_method == METHOD_01)
+        stree_summary_add(stree);
+      else if (opt_method == METHOD_11)
+        mixed_summary_add(stree,ndspecies);
       if (opt_print_genetrees)
-        print_gtree(fp_gtree,gtree);
+        print_gtree(gtree_stream,gtree,(i+1)/opt_samplefreq);
+      prof_end(PROF_SAMPLE);
     }
 
     if (opt_method == METHOD_10)
@@ -1483,18 +1836,33 @@ if(i>=0 && opt_revolutionary_spr_method)
 
     curstep++;
 
-    /* Create a checkpoint file... */
+    prof_step(curstep);
+
+    /* Create a checkpoint file at the given steps or when the given time
+       has elapsed since the last one */
     if (opt_checkpoint)
     {
       if (((long)curstep == opt_checkpoint_initial) ||
           (opt_checkpoint_step && ((long)curstep > opt_checkpoint_initial) &&
-           (((long)curstep-opt_checkpoint_initial) % opt_checkpoint_step == 0)))
+           (((long)curstep-opt_checkpoint_initial) % opt_checkpoint_step == 0)) ||
+          (opt_checkpoint_interval &&
+           time(NULL) - checkpoint_time >= opt_checkpoint_interval))
       {
+        int64_t trace_chk_start = trace_begin();
+        int64_t chk_start = prof_clock();
+
+        checkpoint_time = time(NULL);
+
+        /* write buffered binary samples and wait until the writer has
+           flushed all files to obtain consistent offsets */
+        if (opt_mcmc_binary)
+          mcmcbin_flush(mcmc_stream);
+        writer_sync();
 
         /* if gene tree printing is enabled get current file offsets */
         if (opt_print_genetrees)
-          for (j = 0; j < opt_locus_count; ++j)
-            gtree_offset[j] = ftell(fp_gtree[j]);
+          for (j = 0; j < gtree_file_count(); ++j)
+            gtree_offset[j] = writer_tell(gtree_stream[j]);
 
         checkpoint_dump(stree,
                         gtree,
@@ -1503,7 +1871,7 @@ if(i>=0 && opt_revolutionary_spr_method)
                         curstep,
                         ft_round,
                         ndspecies,
-                        ftell(fp_mcmc),
+                        writer_tell(mcmc_stream),
                         ftell(fp_out),
                         gtree_offset,
                         dparam_count,
@@ -1520,13 +1888,53 @@ if(i>=0 && opt_revolutionary_spr_method)
                         mean_theta,
                         mean_tau_count,
                         mean_theta_count);
+
+        status_checkpoint(prof_clock() - chk_start);
+        trace_end("Checkpoint", trace_chk_start, NULL, 0);
+
+        /* progress snapshot of the species tree summary */
+        if (opt_method == METHOD_01)
+          stree_summary_snapshot(stdout,SNAPSHOT_TREES);
+        else if (opt_method == METHOD_11)
+          mixed_summary_snapshot(stdout,SNAPSHOT_TREES);
       }
     }
 
+    /* rewrite the status file periodically and after the last step */
+    if (opt_status_interval)
+      status_update(curstep,
+                    pjump,
+                    PROP_COUNT + (opt_est_locusrate || opt_est_heredity),
+                    opt_est_delimit ?
+                      (ft_round_rj ? pjump_rj / ft_round_rj : 0) : -1,
+                    opt_est_stree ?
+                      (ft_round_spr ? (double)pjump_slider / ft_round_spr : 0) :
+                      -1,
+                    mean_logl,
+                    i+1 == opt_samples*opt_samplefreq);
+
+    trace_end("Step", trace_step_start, "step", (long)curstep);
   }
 
   progress_done();
 
+  /* wait for a checkpoint still being written */
+  checkpoint_wait();
+
+  /* overall speed and memory when profiling, e.g. for test/perftest.py */
+  if (!opt_onlysummary)
+    prof_run_print(stdout,curstep);
+
+  /* print time spent per move */
+  prof_print(stdout);
+  prof_print(fp_out);
+  prof_fini();
+
+  /* print hardware counters of the likelihood kernels */
+  perfcnt_print(stdout);
+  perfcnt_print(fp_out);
+  perfcnt_fini();
+
   free(pjump);
 
   if (opt_bfbeta != 1 && !opt_onlysummary)
@@ -1534,6 +1942,22 @@ if(i>=0 && opt_revolutionary_spr_method)
     fprintf(stdout, "\nBFbeta = %8.6f  E_b(lnf(X)) = %9.4f\n\n", opt_bfbeta, mean_logl);
   }
 
+  /* write remaining samples and stop the writer thread */
+  if (!opt_onlysummary)
+  {
+    if (opt_mcmc_binary)
+      mcmcbin_fini(mcmc_stream);
+    writer_fini();
+    if (opt_gtree_container)
+      gtreefile_fini();
+  }
+  trace_fini();
+  free(gtree_stream);
+  free(mcmc_row);
+  free(stree_newick);
+  stree_newick = NULL;
+  stree_newick_maxsize = 0;
+
   /* close mcmc file */
   if (!opt_onlysummary)
     fclose(fp_mcmc);
@@ -1541,8 +1965,9 @@ if(i>=0 && opt_revolutionary_spr_method)
   if (opt_onlysummary)
   {
     /* read file and correctly set opt_samples */
-    opt_samples = getlinecount(opt_mcmcfile);
-    if (opt_samples)
+    if (mcmcbin_detect(opt_mcmcfile))
+      opt_samples = mcmcbin_samplecount(opt_mcmcfile);
+    else if ((opt_samples = getlinecount(opt_mcmcfile)))
     {
       if ((opt_method == METHOD_00) || (opt_method == METHOD_10))
         --opt_samples;
@@ -1556,14 +1981,14 @@ if(i>=0 && opt_revolutionary_spr_method)
 
   if (opt_print_genetrees)
   {
-    for (i = 0; i < opt_locus_count; ++i)
+    for (i = 0; i < gtree_file_count(); ++i)
       fclose(fp_gtree[i]);
     free(fp_gtree);
     if (opt_checkpoint)
       free(gtree_offset);
   }
 
-  /* print summary using the MCMC file */
+  /* print summary using the MCMC file or the accumulated summaries */
   if (opt_method == METHOD_10)          /* species delimitation */
   {
     delimit_summary(fp_out, stree);
@@ -0,0 +1,383 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Single-pass parser for the binary rooted trees written in MCMC sample
+   files. Trees are parsed into a flat, reusable node array where children
+   always precede their parents, and tip labels are mapped to indices of a
+   label dictionary that persists across trees. Theta attributes (#) are
+   skipped and branch lengths are stored */
+
+typedef struct nlabel_s
+{
+  char * label;
+  long index;
+} nlabel_t;
+
+static int cb_cmp_nlabel(void * a, void * b)
+{
+  nlabel_t * nl = (nlabel_t *)a;
+  char * label = (char *)b;
+
+  return !strcmp(nl->label,label);
+}
+
+static long label_insert(ntree_t * t, const char * label)
+{
+  nlabel_t * nl;
+
+  if (t->label_count == t->label_maxcount)
+  {
+    t->label_maxcount = MAX(2*t->label_maxcount, 16);
+    t->labels = (char **)xrealloc(t->labels,
+                                  (size_t)t->label_maxcount*sizeof(char *));
+  }
+
+  nl = (nlabel_t *)xmalloc(sizeof(nlabel_t));
+  nl->label = xstrdup(label);
+  nl->index = t->label_count;
+
+  if (!hashtable_insert(t->ht_labels,
+                        (void *)nl,
+                        hash_fnv(nl->label),
+                        cb_cmp_nlabel))
+    fatal("Duplicate label (%s)", label);
+
+  t->labels[t->label_count] = nl->label;
+
+  return t->label_count++;
+}
+
+/* create an empty tree with an optional initial list of labels, such that
+   label i is assigned index i */
+ntree_t * ntree_create(char ** labels, long count)
+{
+  long i;
+  ntree_t * t = (ntree_t *)xcalloc(1,sizeof(ntree_t));
+
+  t->ht_labels = hashtable_create((unsigned long)(MAX(count,16)*10));
+
+  for (i = 0; i < count; ++i)
+    label_insert(t,labels[i]);
+
+  return t;
+}
+
+static void cb_nlabel_dealloc(void * data)
+{
+  nlabel_t * nl = (nlabel_t *)data;
+
+  free(nl->label);
+  free(nl);
+}
+
+void ntree_destroy(ntree_t * t)
+{
+  hashtable_destroy(t->ht_labels,cb_nlabel_dealloc);
+  free(t->labels);
+  free(t->nodes);
+  free(t->keys);
+  free(t->label_buffer);
+  free(t);
+}
+
+static long label_lookup(ntree_t * t, const char * label)
+{
+  nlabel_t * nl = hashtable_find(t->ht_labels,
+                                 (void *)label,
+                                 hash_fnv((char *)label),
+                                 cb_cmp_nlabel);
+
+  return nl ? nl->index : label_insert(t,label);
+}
+
+static long node_new(ntree_t * t)
+{
+  if (t->node_count == t->node_maxcount)
+  {
+    t->node_maxcount = MAX(2*t->node_maxcount, 64);
+    t->nodes = (nnode_t *)xrealloc(t->nodes,
+                                   (size_t)t->node_maxcount*sizeof(nnode_t));
+  }
+
+  nnode_t * node = t->nodes + t->node_count;
+  node->left = node->right = node->label = -1;
+  node->length = 0;
+
+  return t->node_count++;
+}
+
+static const char * skip_ws(const char * p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    ++p;
+
+  return p;
+}
+
+static size_t label_length(const char * p)
+{
+  return strcspn(p, " \t\r\n(),:;#");
+}
+
+static const char * parse_attributes(const char * p,
+                                     double * length,
+                                     const char * s)
+{
+  char * end;
+
+  while (1)
+  {
+    p = skip_ws(p);
+
+    if (*p == '#')
+    {
+      strtod(p+1,&end);
+      if (end == p+1)
+        fatal("Invalid theta in tree %s", s);
+      p = end;
+    }
+    else if (*p == ':')
+    {
+      *length = strtod(p+1,&end);
+      if (end == p+1)
+        fatal("Invalid branch length in tree %s", s);
+      p = end;
+    }
+    else
+      return p;
+  }
+}
+
+static long parse_subtree(ntree_t * t, const char ** ps, const char * s)
+{
+  long index;
+  const char * p = skip_ws(*ps);
+
+  if (*p == '(')
+  {
+    ++p;
+    long left = parse_subtree(t,&p,s);
+
+    p = skip_ws(p);
+    if (*p != ',')
+      fatal("Expected ',' at position %ld of tree %s", (long)(p-s), s);
+    ++p;
+
+    long right = parse_subtree(t,&p,s);
+
+    p = skip_ws(p);
+    if (*p != ')')
+      fatal("Expected ')' at position %ld of tree %s", (long)(p-s), s);
+    ++p;
+
+    index = node_new(t);
+    t->nodes[index].left = left;
+    t->nodes[index].right = right;
+
+    /* inner node labels are ignored */
+    p += label_length(p);
+  }
+  else
+  {
+    size_t len = label_length(p);
+    if (!len)
+      fatal("Expected label at position %ld of tree %s", (long)(p-s), s);
+
+    if (len+1 > t->label_buffer_size)
+    {
+      t->label_buffer_size = len+1;
+      free(t->label_buffer);
+      t->label_buffer = (char *)xmalloc(t->label_buffer_size);
+    }
+    memcpy(t->label_buffer,p,len);
+    t->label_buffer[len] = 0;
+    p += len;
+
+    index = node_new(t);
+    t->nodes[index].label = label_lookup(t,t->label_buffer);
+    t->tip_count++;
+  }
+
+  *ps = parse_attributes(p,&(t->nodes[index].length),s);
+  return index;
+}
+
+/* parse newick string s into t and return a pointer to the character
+   following the terminating semicolon */
+const char * ntree_parse(ntree_t * t, const char * s)
+{
+  const char * p = s;
+
+  t->node_count = 0;
+  t->tip_count = 0;
+
+  t->root = parse_subtree(t,&p,s);
+
+  p = skip_ws(p);
+  if (*p != ';')
+    fatal("Expected ';' at position %ld of tree %s", (long)(p-s), s);
+
+  return p+1;
+}
+
+/* round a branch length to the "%f" text written to the MCMC sample file,
+   such that zero lengths are recognized identically in both summaries */
+static double printed_length(double x)
+{
+  char s[32];
+
+  if (!(fabs(x) < 1e9))
+    return x;
+
+  snprintf(s, sizeof(s), "%f", x);
+  return strtod(s,NULL);
+}
+
+static long import_recursive(ntree_t * t, const snode_t * node)
+{
+  long index;
+
+  if (!node->left)
+  {
+    index = node_new(t);
+    t->nodes[index].label = label_lookup(t,node->label);
+    t->tip_count++;
+  }
+  else
+  {
+    long left = import_recursive(t,node->left);
+    long right = import_recursive(t,node->right);
+
+    index = node_new(t);
+    t->nodes[index].left = left;
+    t->nodes[index].right = right;
+  }
+
+  if (node->parent)
+    t->nodes[index].length = printed_length(node->parent->tau - node->tau);
+
+  return index;
+}
+
+/* fill t with the topology and branch lengths of a species tree, in the
+   same way as parsing the tree from the MCMC sample file */
+void ntree_import_stree(ntree_t * t, const stree_t * stree)
+{
+  t->node_count = 0;
+  t->tip_count = 0;
+
+  t->root = import_recursive(t,stree->root);
+}
+
+static int key_cmp(const ntree_t * t, const nnode_t * a, const nnode_t * b)
+{
+  size_t len = MIN(a->key_len,b->key_len);
+  int rc = memcmp(t->keys+a->key, t->keys+b->key, len);
+
+  if (rc) return rc;
+
+  return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+}
+
+/* order the children of each inner node by the concatenation of the tip
+   labels of their subtrees, in the same way as the summary of species trees
+   has always done, such that identical topologies get identical orderings */
+void ntree_sort(ntree_t * t)
+{
+  long i;
+
+  t->keys_size = 0;
+
+  /* children precede their parents in the node array */
+  for (i = 0; i < t->node_count; ++i)
+  {
+    nnode_t * node = t->nodes+i;
+    size_t len;
+
+    if (node->left < 0)
+      len = strlen(t->labels[node->label]);
+    else
+    {
+      if (key_cmp(t, t->nodes+node->left, t->nodes+node->right) > 0)
+        SWAP(node->left,node->right);
+
+      len = t->nodes[node->left].key_len + t->nodes[node->right].key_len;
+    }
+
+    if (t->keys_size + len > t->keys_maxsize)
+    {
+      t->keys_maxsize = MAX(2*t->keys_maxsize, t->keys_size + len + 256);
+      t->keys = (char *)xrealloc(t->keys, t->keys_maxsize);
+    }
+
+    node->key = t->keys_size;
+    node->key_len = len;
+
+    if (node->left < 0)
+      memcpy(t->keys+node->key, t->labels[node->label], len);
+    else
+    {
+      const nnode_t * left = t->nodes+node->left;
+      const nnode_t * right = t->nodes+node->right;
+
+      memcpy(t->keys+node->key, t->keys+left->key, left->key_len);
+      memcpy(t->keys+node->key+left->key_len,
+             t->keys+right->key,
+             right->key_len);
+    }
+    t->keys_size += len;
+  }
+}
+
+static size_t export_topology_recursive(const ntree_t * t,
+                                        long index,
+                                        char ** buffer,
+                                        size_t * maxsize,
+                                        size_t pos)
+{
+  const nnode_t * node = t->nodes+index;
+
+  if (node->left < 0)
+  {
+    const char * label = t->labels[node->label];
+    return xbuf_append(buffer, maxsize, pos, label, strlen(label));
+  }
+
+  pos = xbuf_append(buffer, maxsize, pos, "(", 1);
+  pos = export_topology_recursive(t,node->left,buffer,maxsize,pos);
+  pos = xbuf_append(buffer, maxsize, pos, ", ", 2);
+  pos = export_topology_recursive(t,node->right,buffer,maxsize,pos);
+  return xbuf_append(buffer, maxsize, pos, ")", 1);
+}
+
+/* write the topology (tip labels only) into a growable buffer in the format
+   of stree_export_newick and return its length */
+size_t ntree_export_topology(const ntree_t * t, char ** buffer, size_t * maxsize)
+{
+  size_t pos = export_topology_recursive(t,t->root,buffer,maxsize,0);
+
+  if (t->nodes[t->root].left >= 0)
+    pos = xbuf_append(buffer, maxsize, pos, ";", 1);
+
+  return pos;
+}
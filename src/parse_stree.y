@@ -117,6 +117,17 @@ void stree_destroy(stree_t * tree,
     free(tree->pptable);
   }
 
+  if (tree->lcatable)
+  {
+    for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
+      if (tree->lcatable[i])
+        free(tree->lcatable[i]);
+    free(tree->lcatable);
+  }
+
+  if (tree->pdepth)
+    free(tree->pdepth);
+
   /* deallocate tree structure */
   free(tree->nodes);
   free(tree);
@@ -358,6 +369,8 @@ stree_t * stree_wraptree(snode_t * root,
   tree->inner_count = tip_count-1;
   tree->root = root;
   tree->pptable = NULL;
+  tree->lcatable = NULL;
+  tree->pdepth = NULL;
 
   /* reorder tip nodes if specified */
   if (opt_reorder)
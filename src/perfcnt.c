@@ -0,0 +1,340 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Hardware counters for the likelihood kernels (--perfcounters, Linux only).
+   The kernel dispatchers in core_partials.c and core_likelihood.c call
+   perfcnt_begin() and perfcnt_end(), which read a perf_event group of CPU
+   cycles, instructions, last-level cache references and misses for the
+   calling thread, and accumulate the differences per kernel together with
+   the wall-clock time and the nominal floating point operations and bytes
+   of CLV traffic.
+
+   Only the thread that called perfcnt_init() is measured. If the counters
+   cannot be opened (e.g. restricted by kernel.perf_event_paranoid or not
+   exposed in a virtual machine), only times and nominal rates are
+   reported */
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PERFCNT_EVENTS 4
+
+/* indices of the events in the group */
+#define EV_CYCLES       0
+#define EV_INSTRUCTIONS 1
+#define EV_LLC_REFS     2
+#define EV_LLC_MISSES   3
+
+#define CACHE_LINE 64
+
+typedef struct perfcnt_s
+{
+  long calls;
+  int64_t nsec;
+  double sites;
+  double flops;
+  double bytes;
+  uint64_t count[PERFCNT_EVENTS];
+} perfcnt_t;
+
+static const char * kernel_label[PERFCNT_COUNT] =
+{
+  "Partials (tip-tip)",
+  "Partials (tip-inner)",
+  "Partials (inner-inner)",
+  "Root log-L",
+  "Root likelihood vector"
+};
+
+static const uint64_t event_config[PERFCNT_EVENTS] =
+{
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_REFERENCES,
+  PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const char * event_label[PERFCNT_EVENTS] =
+{
+  "cycles", "instructions", "LLC references", "LLC misses"
+};
+
+static perfcnt_t perfcnt[PERFCNT_COUNT];
+
+/* file descriptor of each event (-1 if unavailable) and its position in the
+   values returned by reading the group */
+static int event_fd[PERFCNT_EVENTS];
+static int event_slot[PERFCNT_EVENTS];
+static int group_fd = -1;
+static int group_size = 0;
+
+static uint64_t start_count[PERFCNT_EVENTS];
+static int64_t start_nsec;
+
+static __THREAD int perfcnt_owner = 0;
+
+static int64_t perfcnt_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+}
+
+static int open_event(uint64_t config, int leader)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = (leader == -1);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+static void read_counters(uint64_t * count)
+{
+  long i;
+  uint64_t buf[1+PERFCNT_EVENTS];
+
+  if (read(group_fd, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t))
+    return;
+
+  for (i = 0; i < PERFCNT_EVENTS; ++i)
+    count[i] = (event_fd[i] >= 0) ? buf[1+event_slot[i]] : 0;
+}
+
+void perfcnt_init()
+{
+  long i;
+
+  memset(perfcnt, 0, PERFCNT_COUNT*sizeof(perfcnt_t));
+  group_size = 0;
+
+  for (i = 0; i < PERFCNT_EVENTS; ++i)
+  {
+    event_fd[i] = open_event(event_config[i], group_fd);
+    if (event_fd[i] < 0)
+    {
+      if (i == EV_CYCLES)
+      {
+        fprintf(stderr, "WARNING: Hardware counters are not available (%s)%s. "
+                "Only kernel times will be reported\n", strerror(errno),
+                (errno == EACCES || errno == EPERM) ?
+                  ", check kernel.perf_event_paranoid" : "");
+        break;
+      }
+      fprintf(stderr, "WARNING: Counter for %s is not available (%s)\n",
+              event_label[i], strerror(errno));
+      continue;
+    }
+
+    if (i == EV_CYCLES)
+      group_fd = event_fd[i];
+    event_slot[i] = group_size++;
+  }
+  for (; i < PERFCNT_EVENTS; ++i)
+    event_fd[i] = -1;
+
+  if (group_fd >= 0)
+  {
+    ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  perfcnt_owner = 1;
+}
+
+int64_t perfcnt_begin()
+{
+  if (!perfcnt_owner) return 0;
+
+  if (group_fd >= 0)
+    read_counters(start_count);
+
+  start_nsec = perfcnt_clock();
+  return start_nsec;
+}
+
+void perfcnt_end(long kernel,
+                 int64_t start,
+                 unsigned int states,
+                 unsigned int sites,
+                 unsigned int rate_cats)
+{
+  long i;
+  uint64_t count[PERFCNT_EVENTS];
+  double s = states;
+  double r = rate_cats;
+
+  if (!start) return;
+
+  perfcnt_t * p = perfcnt + kernel;
+
+  p->nsec += perfcnt_clock() - start;
+  if (group_fd >= 0)
+  {
+    read_counters(count);
+    for (i = 0; i < PERFCNT_EVENTS; ++i)
+      p->count[i] += count[i] - start_count[i];
+  }
+  p->calls++;
+  p->sites += sites;
+
+  /* nominal operations and CLV traffic per site, as in bench.c */
+  switch (kernel)
+  {
+    case PERFCNT_PARTIAL_II:
+      p->flops += sites * r*s*(4*s + 1);
+      p->bytes += sites * 3*r*s*sizeof(double);
+      break;
+    case PERFCNT_PARTIAL_TI:
+      p->flops += sites * r*s*(2*s + 1);
+      p->bytes += sites * (2*r*s*sizeof(double) + 1);
+      break;
+    case PERFCNT_PARTIAL_TT:
+      p->bytes += sites * (r*s*sizeof(double) + 2);
+      break;
+    default:
+      p->flops += sites * (r*(2*s + 1) + 2);
+      p->bytes += sites * (r*s*sizeof(double) + sizeof(unsigned int));
+  }
+}
+
+static void print_counter(FILE * fp, double value, int available)
+{
+  if (available)
+    fprintf(fp, " %9.2f", value);
+  else
+    fprintf(fp, " %9s", "n/a");
+}
+
+void perfcnt_print(FILE * fp)
+{
+  long i;
+
+  if (!perfcnt_owner) return;
+
+  fprintf(fp, "\nLikelihood kernels:\n\n");
+  fprintf(fp, "%-23s %10s %9s %9s %9s %9s %9s %9s %9s\n",
+          "Kernel", "Calls", "Seconds", "GFLOP/s", "GB/s", "IPC",
+          "Cyc/site", "LLC miss%", "LLC GB/s");
+
+  for (i = 0; i < PERFCNT_COUNT; ++i)
+  {
+    perfcnt_t * p = perfcnt + i;
+
+    if (!p->calls) continue;
+
+    double sec = p->nsec / 1e9;
+    double cycles = (double)p->count[EV_CYCLES];
+    double refs = (double)p->count[EV_LLC_REFS];
+    double misses = (double)p->count[EV_LLC_MISSES];
+
+    fprintf(fp, "%-23s %10ld %9.3f %9.2f %9.2f",
+            kernel_label[i],
+            p->calls,
+            sec,
+            sec ? p->flops / sec / 1e9 : 0,
+            sec ? p->bytes / sec / 1e9 : 0);
+
+    print_counter(fp,
+                  cycles ? p->count[EV_INSTRUCTIONS] / cycles : 0,
+                  event_fd[EV_CYCLES] >= 0 && event_fd[EV_INSTRUCTIONS] >= 0);
+    print_counter(fp,
+                  cycles / p->sites,
+                  event_fd[EV_CYCLES] >= 0);
+    print_counter(fp,
+                  refs ? 100 * misses / refs : 0,
+                  event_fd[EV_LLC_REFS] >= 0 && event_fd[EV_LLC_MISSES] >= 0);
+    print_counter(fp,
+                  sec ? misses * CACHE_LINE / sec / 1e9 : 0,
+                  event_fd[EV_LLC_MISSES] >= 0);
+    fprintf(fp, "\n");
+  }
+
+  fprintf(fp, "\nGFLOP/s and GB/s are nominal rates from the operation count "
+              "and CLV traffic of each\nkernel. LLC GB/s assumes one %d-byte "
+              "line is transferred per LLC miss.\n", CACHE_LINE);
+}
+
+void perfcnt_fini()
+{
+  long i;
+
+  if (!perfcnt_owner) return;
+
+  for (i = 0; i < PERFCNT_EVENTS; ++i)
+    if (event_fd[i] >= 0)
+      close(event_fd[i]);
+
+  group_fd = -1;
+  perfcnt_owner = 0;
+}
+
+#else
+
+int64_t perfcnt_begin()
+{
+  return 0;
+}
+
+void perfcnt_end(long kernel,
+                 int64_t start,
+                 unsigned int states,
+                 unsigned int sites,
+                 unsigned int rate_cats)
+{
+  (void)kernel;
+  (void)start;
+  (void)states;
+  (void)sites;
+  (void)rate_cats;
+}
+
+void perfcnt_init()
+{
+  fatal("Hardware counters (--perfcounters) are only available on Linux");
+}
+
+void perfcnt_print(FILE * fp)
+{
+  (void)fp;
+}
+
+void perfcnt_fini()
+{
+}
+
+#endif
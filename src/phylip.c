@@ -99,53 +99,39 @@ static char * reallocline(phylip_t * fd, size_t newmaxsize)
   return temp;
 }
 
+/* copy the next line of the (mapped) file into fd->line with a single memcpy.
+   The line buffer grows geometrically */
 static char * getnextline(phylip_t * fd)
 {
-  size_t len = 0;
+  const char * start;
+  const char * end;
+  size_t len;
 
   fd->line_size = 0;
 
-  /* read from file until newline or eof */
-  while (fgets(fd->buffer, LINEALLOC, fd->fp))
-  {
-    len = strlen(fd->buffer);
-
-    if (fd->line_size + len > fd->line_maxsize)
-      if (!reallocline(fd, fd->line_maxsize + LINEALLOC))
-        return NULL;
-
-    memcpy(fd->line+fd->line_size,fd->buffer,len*sizeof(char));
-    fd->line_size += len;
-
-    if (fd->buffer[len-1] == '\n')
-    {
-      #if 0
-      if (line_size+1 > line_maxsize)
-        reallocline(line_maxsize+1);
-
-      line[line_size] = 0;
-      #else
-        fd->line[fd->line_size-1] = 0;
-      #endif
-
-      return fd->line;
-    }
-  }
-
-  if (!fd->line_size)
+  if (fd->map.pos >= fd->map.size)
   {
     free(fd->line);
     fd->line = NULL;
+    fd->line_maxsize = 0;
     return NULL;
   }
 
-  if (fd->line_size == fd->line_maxsize)
-    if (!reallocline(fd,fd->line_maxsize+1))
-      return NULL;
+  start = fd->map.data + fd->map.pos;
+  end = (const char *)memchr(start, '\n', fd->map.size - fd->map.pos);
+  len = end ? (size_t)(end - start) : fd->map.size - fd->map.pos;
 
-  fd->line[fd->line_size] = 0;
-  return fd->line;
+  fd->map.pos += len + (end ? 1 : 0);
+  fd->lineno++;
+
+  if (len+1 > fd->line_maxsize)
+    reallocline(fd, MAX(len+1, 2*fd->line_maxsize));
 
+  memcpy(fd->line, start, len*sizeof(char));
+  fd->line[len] = 0;
+  fd->line_size = len;
+
+  return fd->line;
 }
 
 static int args_getint(const char * arg, int * len)
@@ -278,18 +264,11 @@ phylip_t * phylip_open(const char * filename,
 
   fd->chrstatus = map;
 
-  /* open file */
-  fd->fp = fopen(filename, "r");
-  if (!(fd->fp))
+  /* map file into memory, or read it if it is not a regular file */
+  if (!mapfile_open(&fd->map, filename))
     fatal("Unable to open file (%s)", filename);
 
-  /* get filesize */
-  if (fseek(fd->fp, 0, SEEK_END))
-    fatal("Unable to seek in file (%s)", filename);
-
-  fd->filesize = ftell(fd->fp);
-
-  rewind(fd->fp);
+  fd->filesize = (long)fd->map.size;
 
   /* reset stripped char frequencies */
   fd->stripped_count = 0;
@@ -299,10 +278,7 @@ phylip_t * phylip_open(const char * filename,
   /* cache line */
   if (!getnextline(fd))
   {
-    if (fd->line)
-      free(fd->line);
-    fclose(fd->fp);
-    free(fd);
+    phylip_close(fd);
     return NULL;
   }
 
@@ -315,7 +291,7 @@ int phylip_rewind(phylip_t * fd)
 {
   int i;
 
-  rewind(fd->fp);
+  fd->map.pos = 0;
 
   /* reset stripped char frequencies */
   fd->stripped_count = 0;
@@ -333,7 +309,7 @@ int phylip_rewind(phylip_t * fd)
 
 void phylip_close(phylip_t * fd)
 {
-  fclose(fd->fp);
+  mapfile_close(&fd->map);
   if (fd->line)
     free(fd->line);
   free(fd);
@@ -629,8 +605,7 @@ msa_t * phylip_parse_sequential(phylip_t * fd)
 
 msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
 {
-  long msa_slotalloc = 10;
-  long msa_maxcount = 0;
+  long msa_maxcount = 16;
   char * p;
   
   *count = 0;
@@ -639,13 +614,11 @@ msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
   
   while (1)
   {
+    /* grow capacity geometrically */
     if (*count == msa_maxcount)
     {
-      msa_maxcount += msa_slotalloc;
-      msa_t ** temp = (msa_t **)xmalloc(msa_maxcount*sizeof(msa_t *));
-      memcpy(temp,msa,*count * sizeof(msa_t *));
-      free(msa);
-      msa = temp;
+      msa_maxcount *= 2;
+      msa = (msa_t **)xrealloc(msa, msa_maxcount*sizeof(msa_t *));
     }
 
     msa[*count] = phylip_parse_sequential(fd);
@@ -0,0 +1,367 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Per-move profiler for the MCMC loop. Each move is bracketed by
+   prof_begin() and prof_end(), which accumulate its wall-clock time, number
+   of calls, and the number of log-likelihood evaluations and partial CLV
+   updates performed during the move. Statistics cover the current run only,
+   i.e. they restart when resuming from a checkpoint.
+
+   The same quantities, along with acceptance rates, are also kept per locus
+   for the gene tree age and SPR moves, which operate on one locus at a time
+   and account for most of the run time.
+
+   The same brackets also record the moves in the trace timeline (trace.c)
+   when it is enabled.
+
+   With the profiler enabled, the overall rate of MCMC steps, the time until
+   the first step and the peak memory are also printed at the end of the run
+   (prof_run_print) */
+
+typedef struct prof_s
+{
+  long calls;
+  int64_t nsec;
+  long logl;
+  long partials;
+} prof_t;
+
+typedef struct prof_locus_s
+{
+  long index;
+  long tips;
+  long sites;
+  int64_t nsec;
+  long logl;
+  long partials;
+  long age_proposed;
+  long age_accepted;
+  long spr_proposed;
+  long spr_accepted;
+} prof_locus_t;
+
+static const char * move_label[PROF_COUNT] =
+{
+  "Gene tree ages",
+  "Gene tree SPR",
+  "Theta",
+  "Tau",
+  "Mixing",
+  "Locus rate/heredity",
+  "RJ split/join",
+  "Species tree SPR",
+  "Sampling"
+};
+
+/* move names in the machine-readable file */
+static const char * move_key[PROF_COUNT] =
+{
+  "gtage", "gtspr", "theta", "tau", "mix", "lrht", "rj", "sspr", "sample"
+};
+
+/* incremented by the likelihood functions in locus.c while the profiler is
+   active, i.e. not during the multi-threaded initialization */
+long prof_active = 0;
+long prof_logl_count = 0;
+long prof_partials_count = 0;
+
+static prof_t prof[PROF_COUNT];
+static int64_t start_nsec;
+static long start_logl;
+static long start_partials;
+static FILE * fp_prof = NULL;
+
+static prof_locus_t * prof_locus = NULL;
+static long prof_locus_count = 0;
+static int64_t locus_start_nsec;
+static long locus_start_logl;
+static long locus_start_partials;
+
+/* start of the current move and locus in the trace */
+static int64_t trace_start;
+static int64_t locus_trace_start;
+
+static int64_t run_start_nsec;
+static int64_t run_first_nsec;
+static unsigned long run_first_step;
+
+/* monotonic clock in nanoseconds, 64-bit also where long is 32-bit */
+int64_t prof_clock()
+{
+  struct timespec ts;
+
+#ifndef _WIN32
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  timespec_get(&ts, TIME_UTC);
+#endif
+
+  return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+}
+
+void prof_init(locus_t ** locus, long locus_count)
+{
+  long i;
+
+  if (!opt_profile) return;
+
+  memset(prof, 0, PROF_COUNT*sizeof(prof_t));
+  prof_active = 1;
+
+  prof_locus = (prof_locus_t *)xcalloc((size_t)locus_count,
+                                       sizeof(prof_locus_t));
+  prof_locus_count = locus_count;
+  for (i = 0; i < locus_count; ++i)
+  {
+    prof_locus[i].index = i;
+    prof_locus[i].tips = locus[i]->tips;
+    prof_locus[i].sites = locus[i]->diploid ?
+                            (long)locus[i]->unphased_length :
+                            (long)locus[i]->sites;
+  }
+
+  if (opt_profile_step)
+  {
+    char * s = NULL;
+    xasprintf(&s, "%s.profile.txt", opt_outfile);
+
+    /* a resumed run continues the file of the interrupted one */
+    fp_prof = xopen(s, opt_resume ? "a" : "w");
+    if (!opt_resume)
+      fprintf(fp_prof, "Gen\tMove\tCalls\tSeconds\tLogL\tPartials\n");
+    free(s);
+  }
+}
+
+void prof_begin()
+{
+  trace_start = trace_begin();
+
+  if (!opt_profile) return;
+
+  start_logl = prof_logl_count;
+  start_partials = prof_partials_count;
+  start_nsec = prof_clock();
+}
+
+void prof_end(long move)
+{
+  trace_end(move_label[move], trace_start, NULL, 0);
+
+  if (!opt_profile) return;
+
+  prof[move].nsec += prof_clock() - start_nsec;
+  prof[move].calls++;
+  prof[move].logl += prof_logl_count - start_logl;
+  prof[move].partials += prof_partials_count - start_partials;
+}
+
+void prof_locus_begin()
+{
+  locus_trace_start = trace_begin();
+
+  if (!prof_active) return;
+
+  locus_start_logl = prof_logl_count;
+  locus_start_partials = prof_partials_count;
+  locus_start_nsec = prof_clock();
+}
+
+/* account the move on locus index with the given number of proposed and
+   accepted updates */
+void prof_locus_end(long index, long move, long proposed, long accepted)
+{
+  trace_end("Locus", locus_trace_start, "locus", index+1);
+
+  if (!prof_active) return;
+
+  prof_locus_t * p = prof_locus + index;
+
+  p->nsec += prof_clock() - locus_start_nsec;
+  p->logl += prof_logl_count - locus_start_logl;
+  p->partials += prof_partials_count - locus_start_partials;
+
+  if (move == PROF_GTAGE)
+  {
+    p->age_proposed += proposed;
+    p->age_accepted += accepted;
+  }
+  else
+  {
+    p->spr_proposed += proposed;
+    p->spr_accepted += accepted;
+  }
+}
+
+static int cb_cmp_locus_time(const void * a, const void * b)
+{
+  const prof_locus_t * x = (const prof_locus_t *)a;
+  const prof_locus_t * y = (const prof_locus_t *)b;
+
+  if (x->nsec != y->nsec)
+    return (x->nsec < y->nsec) - (x->nsec > y->nsec);
+
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/* print loci sorted by decreasing time, at most max_count of them (all if
+   max_count is 0) */
+static void print_loci(FILE * fp, long max_count)
+{
+  long i;
+  int64_t total = 0;
+  long count = prof_locus_count;
+
+  if (max_count && max_count < count)
+    count = max_count;
+
+  for (i = 0; i < prof_locus_count; ++i)
+    total += prof_locus[i].nsec;
+
+  if (count < prof_locus_count)
+    fprintf(fp, "Time spent per locus in gene tree age and SPR moves "
+                "(%ld most expensive of %ld loci):\n\n",
+            count, prof_locus_count);
+  else
+    fprintf(fp, "Time spent per locus in gene tree age and SPR moves:\n\n");
+
+  fprintf(fp, "%8s %6s %8s %10s %6s %12s %12s %7s %7s\n",
+          "Locus", "Seqs", "Sites", "Seconds", "%", "lnL", "CLVs",
+          "Pjump_a", "Pjump_s");
+
+  for (i = 0; i < count; ++i)
+  {
+    const prof_locus_t * p = prof_locus + i;
+
+    fprintf(fp, "%8ld %6ld %8ld %10.3f %6.2f %12ld %12ld %7.4f %7.4f\n",
+            p->index+1,
+            p->tips,
+            p->sites,
+            p->nsec / 1e9,
+            total ? 100.0 * p->nsec / total : 0,
+            p->logl,
+            p->partials,
+            p->age_proposed ? (double)p->age_accepted / p->age_proposed : 0,
+            p->spr_proposed ? (double)p->spr_accepted / p->spr_proposed : 0);
+  }
+  fprintf(fp, "\n");
+}
+
+/* write the accumulated statistics every opt_profile_step steps */
+void prof_step(unsigned long step)
+{
+  long i;
+
+  if (!fp_prof || step % opt_profile_step) return;
+
+  for (i = 0; i < PROF_COUNT; ++i)
+  {
+    if (!prof[i].calls) continue;
+
+    fprintf(fp_prof, "%lu\t%s\t%ld\t%.6f\t%ld\t%ld\n",
+            step,
+            move_key[i],
+            prof[i].calls,
+            prof[i].nsec / 1e9,
+            prof[i].logl,
+            prof[i].partials);
+  }
+  fflush(fp_prof);
+}
+
+void prof_print(FILE * fp)
+{
+  long i;
+  int64_t total = 0;
+
+  if (!opt_profile) return;
+
+  for (i = 0; i < PROF_COUNT; ++i)
+    total += prof[i].nsec;
+
+  fprintf(fp, "\nTime spent per move:\n\n");
+  fprintf(fp, "%-20s %10s %10s %6s %10s %9s %10s\n",
+          "Move", "Calls", "Seconds", "%", "usec/call", "lnL/call",
+          "CLVs/call");
+
+  for (i = 0; i < PROF_COUNT; ++i)
+  {
+    if (!prof[i].calls) continue;
+
+    fprintf(fp, "%-20s %10ld %10.3f %6.2f %10.2f %9.2f %10.2f\n",
+            move_label[i],
+            prof[i].calls,
+            prof[i].nsec / 1e9,
+            total ? 100.0 * prof[i].nsec / total : 0,
+            prof[i].nsec / 1e3 / prof[i].calls,
+            (double)prof[i].logl / prof[i].calls,
+            (double)prof[i].partials / prof[i].calls);
+  }
+  fprintf(fp, "\n");
+
+  /* the screen gets the most expensive loci only */
+  qsort(prof_locus, (size_t)prof_locus_count, sizeof(prof_locus_t),
+        cb_cmp_locus_time);
+  print_loci(fp, fp == stdout ? 20 : 0);
+}
+
+void prof_fini()
+{
+  prof_active = 0;
+
+  free(prof_locus);
+  prof_locus = NULL;
+  prof_locus_count = 0;
+  if (fp_prof)
+    fclose(fp_prof);
+  fp_prof = NULL;
+}
+
+void prof_run_start()
+{
+  run_start_nsec = prof_clock();
+}
+
+/* mark the start of the MCMC loop at the given step (non-zero when
+   resuming) */
+void prof_run_first(unsigned long step)
+{
+  run_first_nsec = prof_clock();
+  run_first_step = step;
+}
+
+void prof_run_print(FILE * fp, unsigned long step)
+{
+  if (!opt_profile) return;
+
+  int64_t nsec = prof_clock() - run_first_nsec;
+  unsigned long steps = step - run_first_step;
+
+  fprintf(fp, "\nPerformance: %lu steps in %.3f seconds (%.2f steps/s), "
+              "first step after %.3f seconds, peak memory %.1f MB\n",
+          steps,
+          nsec / 1e9,
+          nsec ? steps / (nsec / 1e9) : 0,
+          (run_first_nsec - run_start_nsec) / 1e9,
+          arch_get_memused() / 1048576.0);
+}
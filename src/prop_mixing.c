@@ -21,33 +21,6 @@
 
 #include "bpp.h"
 
-#define SWAP_CLV_INDEX(n,i) ((n)+((i)-1)%(2*(n)-2))
-#define SWAP_SCALER_INDEX(n,i) (((n)+((i)-1))%(2*(n)-2))
-
-static void all_partials_recursive(gnode_t * node,
-                                   unsigned int * trav_size,
-                                   gnode_t ** outbuffer)
-{
-  if (!node->left)
-    return;
-
-  all_partials_recursive(node->left,  trav_size, outbuffer);
-  all_partials_recursive(node->right, trav_size, outbuffer);
-
-  outbuffer[*trav_size] = node;
-  *trav_size = *trav_size + 1;
-}
-
-static void gtree_all_partials(gnode_t * root,
-                               gnode_t ** travbuffer,
-                               unsigned int * trav_size)
-{
-  *trav_size = 0;
-  if (!root->left) return;
-
-  all_partials_recursive(root, trav_size, travbuffer);
-}
-
 long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
 {
   unsigned i,j,k;
@@ -58,18 +31,6 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
   double lnacceptance;
   long accepted = 0;
 
-  double * notheta_old_logpr = NULL;
-
-  size_t nodes_count = stree->tip_count+stree->inner_count; 
-
-
-  if (!opt_est_theta)
-  {
-    notheta_old_logpr = (double *)xmalloc(nodes_count * sizeof(double));
-    for (i = 0; i < nodes_count; ++i)
-      notheta_old_logpr[i] = stree->nodes[i]->notheta_logpr_contrib;
-  }
-  
   /* TODO: Account for method 11 / rj-MCMC */
   if (opt_est_theta)
   {
@@ -130,8 +91,20 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
     }
   }
   
-  if (!opt_est_theta)
+  /* Scaling all coalescent times, taus and thetas by c leaves the ratios
+     T2h/theta unchanged, and therefore the new MSC density is computed
+     analytically from the old one without re-sorting coalescent events */
+  if (opt_est_theta)
+  {
+    for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
+      gtree_scale_logprob_contrib(snodes[i],c,stree->locus_count);
+  }
+  else
+  {
     logpr = stree->notheta_logpr;
+    for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
+      logpr += gtree_scale_logprob_contrib(snodes[i],c,stree->locus_count);
+  }
 
   for (i = 0; i < stree->locus_count; ++i)
   {
@@ -162,14 +135,7 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
     locus_update_matrices_jc69(locus[i],gt_nodes,k);
 
     gtree_all_partials(gt->root,gt_nodes,&k);
-    for (j = 0; j < k; ++j)
-    {
-      gt_nodes[j]->clv_index = SWAP_CLV_INDEX(gt->tip_count,
-                                              gt_nodes[j]->clv_index);
-      if (opt_scaling)
-        gt_nodes[j]->scaler_index = SWAP_SCALER_INDEX(gt->tip_count,
-                                                      gt_nodes[j]->scaler_index);
-    }
+    gtree_swap_clv_indices(gt,gt_nodes,k);
 
     locus_update_partials(locus[i],gt_nodes,k);
 
@@ -179,27 +145,16 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
 
 
     if (opt_est_theta)
-      logpr = gtree_logprob(stree,locus[i]->heredity[0],i);
-    else
     {
-      for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
-      {
-        logpr -= stree->nodes[j]->notheta_logpr_contrib;
-        logpr += gtree_update_logprob_contrib(stree->nodes[j],locus[i]->heredity[0],i);
-      }
-    }
-        
-
-    if (opt_est_theta)
+      /* each of the inner_count coalescent events contributes -log(c) */
+      logpr = gt->logpr - gt->inner_count*lnc;
       lnacceptance += logl - gt->logl + logpr - gt->logpr;
-    else
-      lnacceptance += logl - gt->logl;
 
-    if (opt_est_theta)
-    {
       gt->old_logpr = gt->logpr;
       gt->logpr = logpr;
     }
+    else
+      lnacceptance += logl - gt->logl;
 
     gt->old_logl = gt->logl;
     gt->logl = logl;
@@ -247,11 +202,13 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
     }
     else
     {
+      /* restore the T2h sums exactly, as the incremental revert would leave
+         their rounding errors scaled by c */
       for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
       {
-        for (j = 0; j < opt_locus_count; ++j)
+        for (j = 0; j < stree->locus_count; ++j)
           logprob_revert_notheta(stree->nodes[i],j);
-        stree->nodes[i]->notheta_logpr_contrib = notheta_old_logpr[i];
+        stree->nodes[i]->t2h_sum = stree->nodes[i]->old_t2h_sum;
       }
     }
 
@@ -278,15 +235,11 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
 
       gnode_t ** gnodeptr = gtree[i]->nodes;
       /* revert CLV indices and coalescent event ages */
+      gtree_swap_clv_indices(gtree[i],
+                             gnodeptr+gtree[i]->tip_count,
+                             gtree[i]->inner_count);
       for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-      {
-        gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                gnodeptr[j]->clv_index);
-        if (opt_scaling)
-          gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                gnodeptr[j]->scaler_index);
         gnodeptr[j]->time = gnodeptr[j]->old_time;
-      }
 
       
       gnode_t ** gt_nodes = (gnode_t **)xmalloc((gtree[i]->tip_count +
@@ -306,9 +259,6 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
   }
   free(snodes);
 
-  if (!opt_est_theta)
-    free(notheta_old_logpr);
-
   return accepted;
 
 }
@@ -21,9 +21,6 @@
 
 #include "bpp.h"
 
-#define SWAP_CLV_INDEX(n,i) ((n)+((i)-1)%(2*(n)-2))
-#define SWAP_SCALER_INDEX(n,i) (((n)+((i)-1))%(2*(n)-2))
-
 #define MARK_BRANCH_UPDATE      1
 #define MARK_ANCESTOR_LNODE     2
 #define MARK_ANCESTOR_RNODE     4
@@ -43,32 +40,6 @@ static int * feasible;
 static gnode_t *** partials;
 static unsigned int * partials_count;
 
-#if 0
-static void all_partials_recursive(gnode_t * node,
-                                   unsigned int * trav_size,
-                                   gnode_t ** outbuffer)
-{
-  if (!node->left)
-    return;
-
-  all_partials_recursive(node->left,  trav_size, outbuffer);
-  all_partials_recursive(node->right, trav_size, outbuffer);
-
-  outbuffer[*trav_size] = node;
-  *trav_size = *trav_size + 1;
-}
-
-static void gtree_all_partials(gnode_t * root,
-                               gnode_t ** travbuffer,
-                               unsigned int * trav_size)
-{
-  *trav_size = 0;
-  if (!root->left) return;
-
-  all_partials_recursive(root, trav_size, travbuffer);
-}
-#endif
-
 void rj_init(gtree_t ** gtreelist, stree_t * stree, unsigned int count)
 {
   unsigned int i;
@@ -543,17 +514,12 @@ long prop_split(gtree_t ** gtree,
 
       /* TODO: Never call functions like propose_age that change travbuffer
          from gtree.c */
-      partials[i] = gtree_return_partials(gtree[i]->root,
-                                          i,
-                                          partials_count+i);
-      for (k = 0; k < partials_count[i]; ++k)
-      {
-        partials[i][k]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                   partials[i][k]->clv_index);
-        if (opt_scaling)
-          partials[i][k]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                   partials[i][k]->scaler_index);
-      }
+      partials[i] = gtree_return_dirty_partials(gtree[i],
+                                                nodevec+nodevec_offset[i],
+                                                nodevec_count[i],
+                                                i,
+                                                partials_count+i);
+      gtree_swap_clv_indices(gtree[i],partials[i],partials_count[i]);
 
       /* update partials */
       locus_update_partials(locus[i],partials[i],partials_count[i]);
@@ -689,14 +655,7 @@ long prop_split(gtree_t ** gtree,
                                    nodevec+nodevec_offset[i],
                                    nodevec_count[i]);
 
-        for (k = 0; k < partials_count[i]; ++k)
-        {
-          partials[i][k]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                     partials[i][k]->clv_index);
-          if (opt_scaling)
-            partials[i][k]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                           partials[i][k]->scaler_index);
-        }
+        gtree_swap_clv_indices(gtree[i],partials[i],partials_count[i]);
         gtree[i]->logl  = gtree[i]->old_logl;
       }
       if (opt_est_theta)
@@ -741,12 +700,7 @@ long prop_split(gtree_t ** gtree,
     locus_update_matrices_jc69(locus[i],gt_nodes,k);
 
     gtree_all_partials(gt->root,gt_nodes,&k);
-    for (j = 0; j < k; ++j)
-    {
-      gt_nodes[j]->clv_index = SWAP_CLV_INDEX(gt->tip_count,gt_nodes[j]->clv_index);
-      if (opt_scaling)
-        gt_nodes[j]->scaler_index = SWAP_SCALER_INDEX(gt->tip_count,gt_nodes[j]->scaler_index);
-    }
+    gtree_swap_clv_indices(gt,gt_nodes,k);
 
     locus_update_partials(locus[i],gt_nodes,k);
 
@@ -931,18 +885,12 @@ long prop_join(gtree_t ** gtree,
 
       /* TODO: Never call functions like propose_age that change travbuffer
          from gtree.c */
-      partials[i] = gtree_return_partials(gtree[i]->root,
-                                          i,
-                                          partials_count+i);
-
-      for (k = 0; k < partials_count[i]; ++k)
-      {
-        partials[i][k]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                   partials[i][k]->clv_index);
-        if (opt_scaling)
-          partials[i][k]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                           partials[i][k]->scaler_index);
-      }
+      partials[i] = gtree_return_dirty_partials(gtree[i],
+                                                nodevec+nodevec_offset[i],
+                                                nodevec_count[i],
+                                                i,
+                                                partials_count+i);
+      gtree_swap_clv_indices(gtree[i],partials[i],partials_count[i]);
 
       /* update partials */
       locus_update_partials(locus[i],partials[i],partials_count[i]);
@@ -1081,14 +1029,7 @@ long prop_join(gtree_t ** gtree,
                                    nodevec+nodevec_offset[i],
                                    nodevec_count[i]);
 
-        for (k = 0; k < partials_count[i]; ++k)
-        {
-          partials[i][k]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                     partials[i][k]->clv_index);
-          if (opt_scaling)
-            partials[i][k]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                             partials[i][k]->scaler_index);
-        }
+        gtree_swap_clv_indices(gtree[i],partials[i],partials_count[i]);
 
         gtree[i]->logl = gtree[i]->old_logl;
       }
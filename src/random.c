@@ -27,6 +27,54 @@
 /* legacy random number generators */
 static unsigned int z_rndu = 666;
 
+/* 64-bit generator (xoshiro256**) for --simulate, with one state per thread.
+   Each locus seeds its own state from the seed and the locus index, such that
+   loci draw from independent streams regardless of the thread running them */
+static __THREAD uint64_t sim_state[4];
+
+static uint64_t splitmix64(uint64_t * x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+void sim_rndu_init(long seed, long stream)
+{
+  int i;
+  uint64_t x = (uint64_t)seed;
+
+  /* distinct streams start from distinct splitmix64 states */
+  x = splitmix64(&x) ^ (uint64_t)stream;
+
+  for (i = 0; i < 4; ++i)
+    sim_state[i] = splitmix64(&x);
+}
+
+/* uniform variate in (0,1) */
+double sim_rndu()
+{
+  uint64_t * s = sim_state;
+  uint64_t r = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return ((r >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
 void legacy_init()
 {
   z_rndu = (unsigned int)opt_seed;
@@ -112,122 +112,97 @@ void stree_show_ascii(const snode_t * root, int options)
   free(active_node_order);
 }
 
-static char * stree_export_newick_recursive(const snode_t * root,
-                                            char * (*cb_serialize)(const snode_t *))
+/* append node information either with a callback that appends directly to
+   the buffer, or with a callback returning an allocated string */
+static size_t export_newick_node(const snode_t * node,
+                                 char * (*cb_serialize)(const snode_t *),
+                                 stree_newick_cb_t cb_append,
+                                 char ** buffer,
+                                 size_t * maxsize,
+                                 size_t pos)
 {
-  char * newick;
-  int size_alloced;
-  assert(root != NULL);
+  if (cb_append)
+    return cb_append(node,buffer,maxsize,pos);
 
-  if (!(root->left) || !(root->right))
+  if (cb_serialize)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    char * temp = cb_serialize(node);
+    pos = xbuf_append(buffer, maxsize, pos, temp, strlen(temp));
+    free(temp);
+    return pos;
   }
-  else
-  {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
+  if (node->label)
+    pos = xbuf_append(buffer, maxsize, pos, node->label, strlen(node->label));
+  pos = xbuf_append(buffer, maxsize, pos, ":", 1);
+  return xbuf_double(buffer, maxsize, pos, node->length);
+}
+
+static size_t stree_export_newick_recursive(const snode_t * root,
+                                            char * (*cb_serialize)(const snode_t *),
+                                            stree_newick_cb_t cb_append,
+                                            char ** buffer,
+                                            size_t * maxsize,
+                                            size_t pos)
+{
+  assert(root != NULL);
+
+  if (root->left && root->right)
   {
-    fatal("Memory allocation during newick export failed");
+    pos = xbuf_append(buffer, maxsize, pos, "(", 1);
+    pos = stree_export_newick_recursive(root->left,
+                                        cb_serialize,
+                                        cb_append,
+                                        buffer,
+                                        maxsize,
+                                        pos);
+    pos = xbuf_append(buffer, maxsize, pos, ", ", 2);
+    pos = stree_export_newick_recursive(root->right,
+                                        cb_serialize,
+                                        cb_append,
+                                        buffer,
+                                        maxsize,
+                                        pos);
+    pos = xbuf_append(buffer, maxsize, pos, ")", 1);
   }
 
-  return newick;
+  return export_newick_node(root,cb_serialize,cb_append,buffer,maxsize,pos);
+}
+
+/* append the newick string of the tree rooted at root to a growable buffer
+   at position pos and return the new end position. The callback appends the
+   information of each node (label, branch length etc) */
+size_t stree_export_newick_append(const snode_t * root,
+                                  stree_newick_cb_t cb_append,
+                                  char ** buffer,
+                                  size_t * maxsize,
+                                  size_t pos)
+{
+  pos = stree_export_newick_recursive(root,NULL,cb_append,buffer,maxsize,pos);
+
+  if (root->left && root->right)
+    pos = xbuf_append(buffer, maxsize, pos, ";", 1);
+
+  return pos;
 }
 
 char * stree_export_newick(const snode_t * root,
                            char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
+  char * newick = NULL;
+  size_t maxsize = 0;
+  size_t pos;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
-  }
-  else
-  {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (!subtree1)
-      fatal("Unable to allocate enough memory.");
-
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (!subtree2)
-      fatal("Unable to allocate enough memory.");
+  if (!root) return NULL;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s;",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f;",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
+  pos = stree_export_newick_recursive(root,
+                                      cb_serialize,
+                                      NULL,
+                                      &newick,
+                                      &maxsize,
+                                      0);
+  if (root->left && root->right)
+    xbuf_append(&newick, &maxsize, pos, ";", 1);
 
   return newick;
 }
@@ -0,0 +1,333 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Simulation of sequence data under the multispecies coalescent (--simulate).
+   Gene trees are generated with gtree_simulate on a species tree whose
+   branch lengths give the speciation times (tau), with all population sizes
+   (theta) set to the mean of thetaprior. Sequences are then evolved along
+   each gene tree under JC69.
+
+   Loci are simulated in parallel in batches, and locus i draws from its own
+   64-bit random number stream (sim_rndu) seeded from 'seed' and i, so the
+   output depends only on the control file and not on the number of threads */
+
+#define SIM_BATCH  1024
+#define SIM_MEMORY (64*1024*1024)
+
+typedef struct sim_data_s
+{
+  stree_t * stree;
+  msa_t ** msa;
+  long first;
+} sim_data_t;
+
+/* set speciation times from the branch lengths of the species tree */
+static double set_tau_recursive(snode_t * node)
+{
+  if (!node->left)
+  {
+    node->tau = 0;
+    return 0;
+  }
+
+  if (node->left->length < 0 || node->right->length < 0)
+    fatal("Negative branch length in species tree at node %s", node->label);
+
+  double l = set_tau_recursive(node->left) + node->left->length;
+  double r = set_tau_recursive(node->right) + node->right->length;
+
+  if (fabs(l-r) > 1e-6*MAX(l,r))
+    fatal("Species tree is not ultrametric at node %s (%f vs %f)",
+          node->label, l, r);
+
+  node->tau = (l+r)/2;
+  return node->tau;
+}
+
+/* JC69 along the gene tree. Buffers hold states 0-3 and are indexed by the
+   clv index of each node, such that tips write directly into the alignment */
+static void evolve_recursive(gnode_t * node, unsigned char ** seq, long sites)
+{
+  long i;
+  unsigned char * x = seq[node->clv_index];
+
+  if (!node->parent)
+  {
+    for (i = 0; i < sites; ++i)
+      x[i] = (unsigned char)MIN(3,(int)(4*sim_rndu()));
+  }
+  else
+  {
+    double t = node->parent->time - node->time;
+    double p = -0.75*expm1(-4*t/3);
+
+    memcpy(x, seq[node->parent->clv_index], (size_t)sites);
+
+    /* skip over unchanged sites with geometric waiting times and change each
+       selected site to one of the other three states */
+    if (p > 0)
+    {
+      double logq = log1p(-p);
+      double pos = -1;
+
+      while ((pos += 1 + floor(log(sim_rndu()) / logq)) < sites)
+      {
+        i = (long)pos;
+        x[i] = (unsigned char)((x[i] + 1 + MIN(2,(int)(3*sim_rndu()))) % 4);
+      }
+    }
+  }
+
+  if (!node->left) return;
+
+  evolve_recursive(node->left, seq, sites);
+  evolve_recursive(node->right, seq, sites);
+}
+
+static void cb_simulate_locus(long index, void * data)
+{
+  long i,j;
+  sim_data_t * sim = (sim_data_t *)data;
+  msa_t * msa = sim->msa[index];
+  long sites = msa->length;
+
+  sim_rndu_init(opt_seed, sim->first + index);
+
+  gtree_t * gtree = gtree_simulate(sim->stree, msa, (int)index, sim_rndu);
+
+  unsigned char ** seq = (unsigned char **)xmalloc((size_t)(2*msa->count-1) *
+                                                   sizeof(unsigned char *));
+  unsigned char * inner = (unsigned char *)xmalloc((size_t)(msa->count-1) *
+                                                   (size_t)sites);
+  for (i = 0; i < msa->count; ++i)
+    seq[i] = (unsigned char *)msa->sequence[i];
+  for (i = 0; i < msa->count-1; ++i)
+    seq[msa->count+i] = inner + i*sites;
+
+  evolve_recursive(gtree->root, seq, sites);
+
+  for (i = 0; i < msa->count; ++i)
+  {
+    for (j = 0; j < sites; ++j)
+      msa->sequence[i][j] = "ACGT"[seq[i][j]];
+    msa->sequence[i][sites] = 0;
+  }
+
+  free(inner);
+  free(seq);
+  gtree_destroy(gtree,NULL);
+}
+
+/* clear the coalescent events of the previous batch */
+static void reset_events(stree_t * stree)
+{
+  unsigned int i,j;
+
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+  {
+    snode_t * node = stree->nodes[i];
+    for (j = 0; j < stree->locus_count; ++j)
+    {
+      dlist_clear(node->event[j],NULL);
+      node->event_count[j] = 0;
+      node->seqin_count[j] = 0;
+    }
+  }
+}
+
+static void alloc_events(stree_t * stree, long batch)
+{
+  unsigned int i;
+  long j;
+
+  stree->locus_count = (unsigned int)batch;
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+  {
+    snode_t * node = stree->nodes[i];
+
+    node->event = (dlist_t **)xcalloc((size_t)batch, sizeof(dlist_t *));
+    node->event_count = (int *)xcalloc((size_t)batch, sizeof(int));
+    node->seqin_count = (int *)xcalloc((size_t)batch, sizeof(int));
+    for (j = 0; j < batch; ++j)
+      node->event[j] = dlist_create();
+  }
+}
+
+/* return the number of sequences for species label as listed in
+   'species&tree' */
+static long species_seqcount(const char * label)
+{
+  long i = 0;
+  const char * p = opt_reorder;
+
+  while (*p)
+  {
+    size_t len = strcspn(p,",");
+    if (len == strlen(label) && !strncmp(p,label,len))
+      return opt_sp_seqcount[i];
+
+    p += len;
+    if (*p) ++p;
+    ++i;
+  }
+
+  fatal("Species %s in the tree is not listed in 'species&tree'", label);
+  return 0;
+}
+
+static void print_model(stree_t * stree)
+{
+  unsigned int i;
+
+  printf("\nSimulating %ld loci of %ld sites (JC69)\n\n",
+         opt_locus_count, opt_simulate_sites);
+  printf("%-20s %10s %10s\n", "Population", "tau", "theta");
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+    printf("%-20s %10.6f %10.6f\n",
+           stree->nodes[i]->label, stree->nodes[i]->tau,
+           stree->nodes[i]->theta);
+  printf("\n");
+}
+
+void cmd_simulate()
+{
+  long i,j,k;
+  long seq_count = 0;
+  list_t * maplist = NULL;
+  sim_data_t sim;
+  FILE * fp;
+
+  stree_t * stree = stree_parse_newick_string(opt_streenewick);
+  if (!stree)
+    fatal("Error while reading species tree");
+
+  stree_label(stree);
+
+  /* sequences are labelled by species, e.g. A1^A, A2^A, ... */
+  long * sp_seqcount = (long *)xmalloc(stree->tip_count*sizeof(long));
+  for (i = 0; i < (long)stree->tip_count; ++i)
+  {
+    sp_seqcount[i] = species_seqcount(stree->nodes[i]->label);
+    seq_count += sp_seqcount[i];
+  }
+  if (seq_count < 2)
+    fatal("At least two sequences are required in 'species&tree'");
+
+  char ** labels = (char **)xmalloc((size_t)seq_count*sizeof(char *));
+  for (i = 0, k = 0; i < (long)stree->tip_count; ++i)
+    for (j = 0; j < sp_seqcount[i]; ++j)
+      xasprintf(labels+k++, "%s%ld^%s",
+                stree->nodes[i]->label, j+1, stree->nodes[i]->label);
+
+  /* parameters */
+  if (stree->tip_count > 1)
+  {
+    if (set_tau_recursive(stree->root) <= 0)
+      fatal("Species tree branch lengths are required for simulation");
+  }
+  for (i = 0; i < (long)(stree->tip_count + stree->inner_count); ++i)
+    stree->nodes[i]->theta = opt_theta_beta / (opt_theta_alpha - 1);
+  opt_est_theta = 1;
+
+  print_model(stree);
+
+  /* write the Imap file and read it back for mapping sequences to species */
+  if (stree->tip_count > 1)
+  {
+    fp = xopen(opt_mapfile,"w");
+    for (i = 0; i < (long)stree->tip_count; ++i)
+      fprintf(fp, "%s %s\n", stree->nodes[i]->label, stree->nodes[i]->label);
+    fclose(fp);
+
+    maplist = yy_parse_map(opt_mapfile);
+  }
+  gtree_simulate_init(stree,maplist);
+
+  /* batches are bounded in memory but large enough to keep threads busy */
+  size_t locus_size = (size_t)seq_count * (size_t)(opt_simulate_sites+1);
+  long batch = MIN(SIM_BATCH, (long)(SIM_MEMORY / locus_size));
+  batch = MAX(batch, threads_get_count());
+  batch = MIN(batch, opt_locus_count);
+
+  alloc_events(stree,batch);
+
+  msa_t ** msa = (msa_t **)xmalloc((size_t)batch*sizeof(msa_t *));
+  for (i = 0; i < batch; ++i)
+  {
+    msa[i] = (msa_t *)xcalloc(1,sizeof(msa_t));
+    msa[i]->count = (int)seq_count;
+    msa[i]->length = (int)opt_simulate_sites;
+    msa[i]->original_length = (int)opt_simulate_sites;
+    msa[i]->label = labels;
+    msa[i]->sequence = (char **)xmalloc((size_t)seq_count*sizeof(char *));
+    for (j = 0; j < seq_count; ++j)
+      msa[i]->sequence[j] = (char *)xmalloc((size_t)(opt_simulate_sites+1));
+  }
+
+  sim.stree = stree;
+  sim.msa = msa;
+
+  fp = xopen(opt_msafile,"w");
+
+  printf("Simulating loci...");
+  fflush(stdout);
+  for (sim.first = 0; sim.first < opt_locus_count; sim.first += batch)
+  {
+    long count = MIN(batch, opt_locus_count - sim.first);
+
+    reset_events(stree);
+    threads_parallel_for(count, cb_simulate_locus, &sim);
+    msa_print_phylip(fp, msa, count);
+  }
+  printf(" Done\n");
+
+  fclose(fp);
+
+  printf("Sequences written to %s\n", opt_msafile);
+  if (stree->tip_count > 1)
+    printf("Imap written to %s\n", opt_mapfile);
+
+  /* cleanup */
+  gtree_simulate_fini(stree);
+  if (maplist)
+  {
+    list_clear(maplist,map_dealloc);
+    free(maplist);
+  }
+
+  for (i = 0; i < batch; ++i)
+  {
+    for (j = 0; j < seq_count; ++j)
+      free(msa[i]->sequence[j]);
+    free(msa[i]->sequence);
+    free(msa[i]);
+  }
+  free(msa);
+
+  for (i = 0; i < seq_count; ++i)
+    free(labels[i]);
+  free(labels);
+  free(sp_seqcount);
+
+  stree_destroy(stree,NULL);
+}
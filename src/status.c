@@ -0,0 +1,163 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Machine-readable status of a running MCMC (status = seconds), rewritten
+   every opt_status_interval seconds to <outfile>.status.json for batch
+   schedulers and monitoring scripts. The file is written to a temporary
+   file and renamed, such that readers never see a partial file.
+
+   The speed is measured over the last STATUS_WINDOW updates, such that it
+   follows changes during the run (e.g. after burnin) */
+
+#define STATUS_WINDOW 10
+
+/* names of the pjump entries in method.c */
+static const char * pjump_key[] =
+{
+  "gtage", "gtspr", "theta", "tau", "mix", "lrht"
+};
+
+static int64_t window_nsec[STATUS_WINDOW];
+static unsigned long window_step[STATUS_WINDOW];
+static long window_count;
+
+static unsigned long status_total;
+static int64_t status_start_nsec;
+static int64_t status_next_nsec;
+
+static int64_t checkpoint_nsec;
+static long checkpoint_count;
+
+void status_init(unsigned long step, unsigned long total)
+{
+  status_total = total;
+  status_start_nsec = prof_clock();
+  status_next_nsec = status_start_nsec +
+                     (int64_t)opt_status_interval * 1000000000;
+
+  window_nsec[0] = status_start_nsec;
+  window_step[0] = step;
+  window_count = 1;
+
+  checkpoint_nsec = 0;
+  checkpoint_count = 0;
+}
+
+/* account time spent writing a checkpoint */
+void status_checkpoint(int64_t nsec)
+{
+  checkpoint_nsec += nsec;
+  checkpoint_count++;
+}
+
+/* non-finite values (e.g. unknown speed) are written as null */
+static void print_number(FILE * fp, const char * key, double x)
+{
+  if (isfinite(x))
+    fprintf(fp, "  \"%s\": %.6g,\n", key, x);
+  else
+    fprintf(fp, "  \"%s\": null,\n", key);
+}
+
+/* write the status at the given step if the interval has elapsed or if
+   final is set. pjump_rj and pjump_sspr are negative when the moves are not
+   used */
+void status_update(unsigned long step,
+                   const double * pjump,
+                   long pjump_count,
+                   double pjump_rj,
+                   double pjump_sspr,
+                   double mean_logl,
+                   int final)
+{
+  long i;
+  char * s = NULL;
+  char * tmp = NULL;
+  int64_t now = prof_clock();
+
+  if (!final && now < status_next_nsec) return;
+
+  status_next_nsec = now + (int64_t)opt_status_interval * 1000000000;
+
+  /* steps per second over the window, oldest entry first */
+  long oldest = window_count < STATUS_WINDOW ?
+                  0 : window_count % STATUS_WINDOW;
+  double sec = (now - window_nsec[oldest]) / 1e9;
+  double speed = sec > 0 ? (step - window_step[oldest]) / sec : NAN;
+
+  window_nsec[window_count % STATUS_WINDOW] = now;
+  window_step[window_count % STATUS_WINDOW] = step;
+  window_count++;
+
+  xasprintf(&s, "%s.status.json", opt_outfile);
+  xasprintf(&tmp, "%s.tmp", s);
+
+  FILE * fp = fopen(tmp, "w");
+  if (!fp)
+  {
+    fprintf(stderr, "WARNING: Cannot write status file %s\n", tmp);
+    free(s);
+    free(tmp);
+    return;
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"state\": \"%s\",\n", final ? "done" : "running");
+  fprintf(fp, "  \"time\": %ld,\n", (long)time(NULL));
+  fprintf(fp, "  \"step\": %lu,\n", step);
+  fprintf(fp, "  \"total_steps\": %lu,\n", status_total);
+  fprintf(fp, "  \"burnin\": %ld,\n", opt_burnin);
+  print_number(fp, "elapsed", (now - status_start_nsec) / 1e9);
+  print_number(fp, "steps_per_sec", speed);
+  print_number(fp, "eta", final ? 0 : (status_total - step) / speed);
+  print_number(fp, "memory_mb", arch_get_memused() / 1048576.0);
+  print_number(fp, "mean_lnL", opt_usedata ? mean_logl : NAN);
+  print_number(fp, "checkpoint_seconds", checkpoint_nsec / 1e9);
+  fprintf(fp, "  \"checkpoints\": %ld,\n", checkpoint_count);
+
+  fprintf(fp, "  \"pjump\": {");
+  for (i = 0; i < pjump_count; ++i)
+    fprintf(fp, "%s\"%s\": %.6f", i ? ", " : "", pjump_key[i], pjump[i]);
+  if (pjump_rj >= 0)
+    fprintf(fp, ", \"rj\": %.6f", pjump_rj);
+  if (pjump_sspr >= 0)
+    fprintf(fp, ", \"sspr\": %.6f", pjump_sspr);
+  fprintf(fp, "}\n");
+  fprintf(fp, "}\n");
+
+  int failed = ferror(fp);
+  if (fclose(fp) || failed)
+    fprintf(stderr, "WARNING: Cannot write status file %s\n", tmp);
+  else
+  {
+#ifdef _WIN32
+    /* rename does not replace existing files on Windows */
+    remove(s);
+#endif
+    if (rename(tmp, s))
+      fprintf(stderr, "WARNING: Cannot write status file %s\n", s);
+  }
+
+  free(s);
+  free(tmp);
+}
@@ -23,9 +23,7 @@
 
 #define PROP_THRESHOLD 10
 
-#define SWAP_CLV_INDEX(n,i) ((n)+((i)-1)%(2*(n)-2))
 #define SWAP_PMAT_INDEX(e,i) (((e)+(i))%((e)<<1))
-#define SWAP_SCALER_INDEX(n,i) (((n)+((i)-1))%(2*(n)-2))
 
 
 /* species tree spr move related */
@@ -221,6 +219,7 @@ static void snode_clone(snode_t * snode, snode_t * clone, stree_t * clone_stree)
    if (!opt_est_theta)
    {
       clone->t2h_sum = snode->t2h_sum;
+      clone->old_t2h_sum = snode->old_t2h_sum;
       clone->event_count_sum = snode->event_count_sum;
       clone->notheta_logpr_contrib = snode->notheta_logpr_contrib;
       clone->notheta_old_logpr_contrib = snode->notheta_old_logpr_contrib;
@@ -298,9 +297,12 @@ static void stree_clone(stree_t * stree, stree_t * clone)
    for (i = 0; i < nodes_count; ++i)
       snode_clone(stree->nodes[i], clone->nodes[i], clone);
 
-   /* clone pptable */
+   /* clone pptable and LCA table */
    for (i = 0; i < nodes_count; ++i)
       memcpy(clone->pptable[i], stree->pptable[i], nodes_count * sizeof(int));
+   for (i = 0; i < nodes_count; ++i)
+      memcpy(clone->lcatable[i], stree->lcatable[i], nodes_count * sizeof(int));
+   memcpy(clone->pdepth, stree->pdepth, nodes_count * sizeof(int));
 
    clone->root = clone->nodes[stree->root->node_index];
 
@@ -335,6 +337,16 @@ stree_t * stree_clone_init(stree_t * stree)
       clone->pptable[i] = (int *)xmalloc(nodes_count * sizeof(int));
       memcpy(clone->pptable[i], stree->pptable[i], nodes_count * sizeof(int));
    }
+
+   clone->lcatable = (int **)xmalloc(nodes_count * sizeof(int *));
+   for (i = 0; i < nodes_count; ++i)
+   {
+      clone->lcatable[i] = (int *)xmalloc(nodes_count * sizeof(int));
+      memcpy(clone->lcatable[i], stree->lcatable[i], nodes_count * sizeof(int));
+   }
+   clone->pdepth = (int *)xmalloc(nodes_count * sizeof(int));
+   memcpy(clone->pdepth, stree->pdepth, nodes_count * sizeof(int));
+
    clone->root = clone->nodes[stree->root->node_index];
 
    return clone;
@@ -785,23 +797,78 @@ static void stree_init_theta(stree_t * stree,
    free(seqcount);
 }
 
-void stree_reset_pptable(stree_t * stree)
+static void reset_lcatable_recursive(stree_t * stree, snode_t * node)
 {
-   unsigned int i;
-   snode_t * ancnode;
-   snode_t * curnode;
-
-   for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
-      memset(stree->pptable[i],
-         0,
-         (stree->tip_count + stree->inner_count) * sizeof(int));
-
-   for (i = 0; i < stree->tip_count; ++i)
+   unsigned int j;
+   unsigned int nodes_count = stree->tip_count + stree->inner_count;
+   unsigned int i = node->node_index;
+   int * lca = stree->lcatable[i];
+
+   /* the row of the parent population is already filled, since the species
+      tree is visited in pre-order. The LCA of node and population j is node
+      itself if node is ancestral to j, otherwise it is the LCA of the parent
+      of node and j */
+   if (!node->parent)
    {
-      for (curnode = stree->nodes[i]; curnode; curnode = curnode->parent)
-         for (ancnode = curnode; ancnode; ancnode = ancnode->parent)
-            stree->pptable[curnode->node_index][ancnode->node_index] = 1;
+      for (j = 0; j < nodes_count; ++j)
+         lca[j] = i;
+      stree->pdepth[i] = 0;
    }
+   else
+   {
+      int * plca = stree->lcatable[node->parent->node_index];
+      for (j = 0; j < nodes_count; ++j)
+         lca[j] = stree->pptable[j][i] ? (int)i : plca[j];
+      stree->pdepth[i] = stree->pdepth[node->parent->node_index] + 1;
+   }
+
+   if (node->left)
+      reset_lcatable_recursive(stree, node->left);
+   if (node->right)
+      reset_lcatable_recursive(stree, node->right);
+}
+
+snode_t * stree_lca(stree_t * stree, snode_t * a, snode_t * b)
+{
+   return stree->nodes[stree->lcatable[a->node_index][b->node_index]];
+}
+
+/* pptable[i][j] is set if population j is ancestral to (or is) population
+   i, hence the row of a population is the row of its parent plus itself */
+static void reset_pptable_recursive(stree_t * stree, snode_t * node)
+{
+   unsigned int nodes_count = stree->tip_count + stree->inner_count;
+   unsigned int i = node->node_index;
+
+   if (node->parent)
+      memcpy(stree->pptable[i],
+             stree->pptable[node->parent->node_index],
+             nodes_count * sizeof(int));
+   else
+      memset(stree->pptable[i], 0, nodes_count * sizeof(int));
+   stree->pptable[i][i] = 1;
+
+   if (node->left)
+      reset_pptable_recursive(stree, node->left);
+   if (node->right)
+      reset_pptable_recursive(stree, node->right);
+}
+
+/* recompute the pptable, LCA table and depth rows of the populations in the
+   subtree rooted at node, after its topology has changed. Other rows are not
+   affected, as the ancestors of other populations are unchanged and their
+   LCA with any population in the subtree is their LCA with node */
+void stree_update_pptable(stree_t * stree, snode_t * node)
+{
+   reset_pptable_recursive(stree, node);
+
+   /* O(1) lookup of most recent common ancestral populations */
+   reset_lcatable_recursive(stree, node);
+}
+
+void stree_reset_pptable(stree_t * stree)
+{
+   stree_update_pptable(stree, stree->root);
 }
 
 void stree_alloc_internals(stree_t * stree, unsigned int gtree_inner_sum, long msa_count)
@@ -878,6 +945,12 @@ void stree_init(stree_t * stree,
    for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
       stree->pptable[i] = (int *)xcalloc((stree->tip_count + stree->inner_count), sizeof(int));
 
+   /* lcatable[i][j] is the most recent common ancestral population of i and j */
+   stree->lcatable = (int **)xcalloc((stree->tip_count + stree->inner_count), sizeof(int *));
+   for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+      stree->lcatable[i] = (int *)xcalloc((stree->tip_count + stree->inner_count), sizeof(int));
+   stree->pdepth = (int *)xcalloc((stree->tip_count + stree->inner_count), sizeof(int));
+
    stree_reset_pptable(stree);
 #if 0
    for (i = 0; i < stree->tip_count; ++i)
@@ -929,6 +1002,7 @@ void stree_init(stree_t * stree,
          stree->nodes[i]->t2h = (double*)xcalloc((size_t)msa_count, sizeof(double));
          stree->nodes[i]->old_t2h = (double*)xcalloc((size_t)msa_count, sizeof(double));
          stree->nodes[i]->t2h_sum = 0;
+         stree->nodes[i]->old_t2h_sum = 0;
          stree->nodes[i]->event_count_sum = 0;
       }
 
@@ -1239,18 +1313,13 @@ static long propose_tau(locus_t ** loci,
 
          /* get list of nodes for which partials must be recomputed */
          unsigned int partials_count;
-         gnode_t ** partials = gtree_return_partials(gtree[i]->root,
-            i,
-            &partials_count);
+         gnode_t ** partials = gtree_return_dirty_partials(gtree[i],
+                                                           branchptr,
+                                                           branch_count,
+                                                           i,
+                                                           &partials_count);
 
-         for (j = 0; j < partials_count; ++j)
-         {
-            partials[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                    partials[j]->clv_index);
-            if (opt_scaling)
-              partials[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                      partials[j]->scaler_index);
-         }
+         gtree_swap_clv_indices(gtree[i], partials, partials_count);
 
          /* update partials */
          locus_update_partials(loci[i], partials, partials_count);
@@ -1338,23 +1407,18 @@ static long propose_tau(locus_t ** loci,
 
 
 
-         /* get the list of nodes for which CLVs must be reverted, i.e. all marked
-            nodes and all nodes whose left or right subtree has at least one marked
-            node */
+         /* get the list of nodes for which CLVs must be reverted, i.e. all
+            nodes on the root-paths of nodes whose branch lengths changed */
          unsigned int partials_count;
-         gnode_t ** partials = gtree_return_partials(gtree[i]->root,
-            i,
-            &partials_count);
+         gnode_t ** partials = gtree_return_dirty_partials(gtree[i],
+                                                           gt_nodesptr,
+                                                           __mark_count[i] +
+                                                           __extra_count[i],
+                                                           i,
+                                                           &partials_count);
 
          /* revert CLV indices */
-         for (j = 0; j < partials_count; ++j)
-         {
-            partials[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                    partials[j]->clv_index);
-            if (opt_scaling)                                                    
-              partials[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                      partials[j]->scaler_index);
-         }
+         gtree_swap_clv_indices(gtree[i], partials, partials_count);
 
          /* un-mark nodes */
          for (j = 0; j < k; ++j)
@@ -1650,7 +1714,6 @@ long stree_propose_spr(stree_t ** streeptr,
    {
       snode_t * c_cand;  /* candidate for node C */
       snode_t * z_cand;  /* candidate for node Z */
-      snode_t * tmp;
 
       c_cand = stree->nodes[i];
 
@@ -1663,17 +1726,15 @@ long stree_propose_spr(stree_t ** streeptr,
          c_cand->parent->tau <= y->tau) continue;
 
       /* compute z_cand as the lowest common ancestor of c_cand and y */
-      for (z_cand = c_cand->parent; z_cand; z_cand = z_cand->parent)
-         if (stree->pptable[x->node_index][z_cand->node_index])
-            break;
+      z_cand = stree_lca(stree, c_cand, x);
 
       /* compute the weight as the reciprocal of number of nodes on the shortest
          path between c_cand and y */
       target_weight[target_count] = 1; /* TODO: should this be 2? */
-      for (tmp = y; tmp != z_cand; tmp = tmp->parent)
-         target_weight[target_count]++;
-      for (tmp = c_cand; tmp != z_cand; tmp = tmp->parent)
-         target_weight[target_count]++;
+      target_weight[target_count] += stree->pdepth[y->node_index] -
+                                     stree->pdepth[z_cand->node_index];
+      target_weight[target_count] += stree->pdepth[c_cand->node_index] -
+                                     stree->pdepth[z_cand->node_index];
       target_weight[target_count] = 1 / target_weight[target_count];
       sum += target_weight[target_count];
 
@@ -1697,10 +1758,7 @@ long stree_propose_spr(stree_t ** streeptr,
    lnacceptance -= log(target_weight[i]);
 
    /* now compute node Z, i.e. the LCA of C and Y */
-   snode_t * z;
-   for (z = c->parent; z; z = z->parent)
-      if (stree->pptable[x->node_index][z->node_index])
-         break;
+   snode_t * z = stree_lca(stree, c, x);
    assert(z);
 
    /* now create two arrays that hold the nodes from A to Z and C to Z always
@@ -2287,7 +2345,9 @@ long stree_propose_spr(stree_t ** streeptr,
       fill_seqin_counts(stree, i);
 
    reset_gene_leaves_count(stree);
-   stree_reset_pptable(stree);
+
+   /* the SPR only rearranges the subtree rooted at Z */
+   stree_update_pptable(stree, z);
 
    init_weights(stree);
 
@@ -2301,7 +2361,6 @@ long stree_propose_spr(stree_t ** streeptr,
    {
       snode_t * c_cand;
       snode_t * z_cand;
-      snode_t * tmp;
 
       c_cand = stree->nodes[i];
 
@@ -2313,17 +2372,14 @@ long stree_propose_spr(stree_t ** streeptr,
       if (c_cand == b)
          k = target_count;
 
-      for (z_cand = c_cand->parent; z_cand; z_cand = z_cand->parent)
-         if (stree->pptable[y->node_index][z_cand->node_index])
-            break;  /* y is father of AC after move */
+      /* y is father of AC after move */
+      z_cand = stree_lca(stree, c_cand, y);
 
       target_weight[target_count] = 1;
-
-      for (tmp = y; tmp != z_cand; tmp = tmp->parent)
-         target_weight[target_count]++;
-
-      for (tmp = c_cand; tmp != z_cand; tmp = tmp->parent)
-         target_weight[target_count]++;
+      target_weight[target_count] += stree->pdepth[y->node_index] -
+                                     stree->pdepth[z_cand->node_index];
+      target_weight[target_count] += stree->pdepth[c_cand->node_index] -
+                                     stree->pdepth[z_cand->node_index];
 
       target_weight[target_count] = 1 / target_weight[target_count];
       sum += target_weight[target_count++];
@@ -2353,21 +2409,15 @@ long stree_propose_spr(stree_t ** streeptr,
 
          locus_update_matrices_jc69(loci[i], bl_list, __mark_count[i]);
 
-         /* retrieve all nodes whose partials must be updates */
+         /* retrieve all nodes whose partials must be updates and point them to
+            the double-buffered partials space */
          unsigned int partials_count;
-         gnode_t ** partials = gtree_return_partials(gtree_list[i]->root,
-            i,
-            &partials_count);
-
-         /* point to the double-buffered partials space */
-         for (j = 0; j < partials_count; ++j)
-         {
-            partials[j]->clv_index = SWAP_CLV_INDEX(gtree_list[i]->tip_count,
-                                                    partials[j]->clv_index);
-            if (opt_scaling)                                                    
-              partials[j]->scaler_index = SWAP_SCALER_INDEX(gtree_list[i]->tip_count,
-                                                    partials[j]->scaler_index);
-         }
+         gnode_t ** partials = gtree_return_dirty_partials(gtree_list[i],
+                                                           bl_list,
+                                                           __mark_count[i],
+                                                           i,
+                                                           &partials_count);
+         gtree_swap_clv_indices(gtree_list[i], partials, partials_count);
 
          /* update conditional probabilities (partials) of affected nodes */
          locus_update_partials(loci[i], partials, partials_count);
@@ -21,6 +21,9 @@
 
 #include "bpp.h"
 
+#define DUMP(x,n,fp) chk_write((const void *)(x),sizeof(*(x)),n,fp)
+#define LOAD(x,n,fp) (chk_read((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
 static long ulong_bits;      /* number of bits in unsigned long */
 static long bitmask_bits;    /* number of bits in bitmask */
 static long bitmask_elms;    /* how many unsigned long a bitmask is made of */
@@ -239,46 +242,85 @@ static void assign_bitmasks(stree_t * stree)
   bitmask_update_recursive(stree->root);
 }
 
-/* updates counts in hashtable with bipartitions of current tree */
-void bipartitions_update(stree_t * stree)
+/* bitmasks of the nodes of the current tree */
+static unsigned long * ntree_bitmasks = NULL;
+static long ntree_bitmasks_count = 0;
+
+static void bipartition_add(unsigned long * bitmask)
 {
-  long i;
   struct bipartition_s * bp;
+  unsigned long hash = hash_fnv_long(bitmask,bitmask_elms);
 
-  assign_bitmasks(stree);
+  bp = hashtable_find(ht_biparts, (void *)bitmask, hash, cb_cmp_bitmask);
+  if (bp)
+  {
+    bp->count++;
+  }
+  else
+  {
+    bp = (struct bipartition_s *)xmalloc(sizeof(struct bipartition_s));
+    bp->bitmask = (unsigned long *)xmalloc((size_t)bitmask_elms *
+                                           sizeof(unsigned long));
+    bp->count = 1;
+    memcpy(bp->bitmask, bitmask, (size_t)bitmask_elms*sizeof(unsigned long));
+    hashtable_insert_force(ht_biparts, (void *)bp, hash);
+  }
+}
 
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
+/* visit inner nodes in preorder, which is the order of inner nodes in trees
+   built by stree_parse_newick_string() */
+static void bipartitions_update_recursive(const ntree_t * t, long index)
+{
+  const nnode_t * node = t->nodes+index;
+
+  if (node->left < 0) return;
+
+  if (index != t->root)
+    bipartition_add(ntree_bitmasks + index*bitmask_elms);
+
+  bipartitions_update_recursive(t,node->left);
+  bipartitions_update_recursive(t,node->right);
+}
+
+/* updates counts in hashtable with bipartitions of current tree */
+void bipartitions_update(const ntree_t * t)
+{
+  long i,j;
+
+  if (t->node_count > ntree_bitmasks_count)
   {
-    if (stree->nodes[i]->parent)
+    free(ntree_bitmasks);
+    ntree_bitmasks_count = t->node_count;
+    ntree_bitmasks = (unsigned long *)xmalloc((size_t)(ntree_bitmasks_count *
+                                                       bitmask_elms) *
+                                              sizeof(unsigned long));
+  }
+
+  /* children precede their parents in the node array */
+  for (i = 0; i < t->node_count; ++i)
+  {
+    const nnode_t * node = t->nodes+i;
+    unsigned long * bitmask = ntree_bitmasks + i*bitmask_elms;
+
+    if (node->left < 0)
     {
-      bp = hashtable_find(ht_biparts,
-                          (void *)(stree->nodes[i]->bitmask),
-                          hash_fnv_long(stree->nodes[i]->bitmask,bitmask_elms),
-                          cb_cmp_bitmask);
-      if (bp)
-      {
-        bp->count++;
-      }
-      else
-      {
-        bp = (struct bipartition_s *)xmalloc(sizeof(struct bipartition_s));
-        bp->bitmask = (unsigned long *)xmalloc((size_t)bitmask_elms *
-                                               sizeof(unsigned long));
-        bp->count = 1;
-        memcpy(bp->bitmask,
-               stree->nodes[i]->bitmask,
-               (size_t)bitmask_elms*sizeof(unsigned long));
-        hashtable_insert_force(ht_biparts,
-                               (void *)bp,
-                               hash_fnv_long(stree->nodes[i]->bitmask,
-                                             bitmask_elms));
-      }
+      if (node->label >= bitmask_bits)
+        fatal("Unknown species %s in sampled tree", t->labels[node->label]);
+
+      memset(bitmask, 0, (size_t)bitmask_elms*sizeof(unsigned long));
+      bitmask[node->label / ulong_bits] = 1ul << (node->label % ulong_bits);
+    }
+    else
+    {
+      const unsigned long * lmask = ntree_bitmasks + node->left*bitmask_elms;
+      const unsigned long * rmask = ntree_bitmasks + node->right*bitmask_elms;
+
+      for (j = 0; j < bitmask_elms; ++j)
+        bitmask[j] = lmask[j] | rmask[j];
     }
   }
 
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
-    if (stree->nodes[i]->bitmask)
-      free(stree->nodes[i]->bitmask);
+  bipartitions_update_recursive(t,t->root);
 }
 
 static void cb_bptrivial_dealloc(void * data)
@@ -357,6 +399,10 @@ static void print_stree_with_support(FILE * fp_out,
 
 void summary_dealloc_hashtables()
 {
+  free(ntree_bitmasks);
+  ntree_bitmasks = NULL;
+  ntree_bitmasks_count = 0;
+
   hashtable_destroy(ht_biparts,cb_bipartition_dealloc);
   hashtable_destroy(ht_trivial,cb_bptrivial_dealloc);
 }
@@ -542,13 +588,6 @@ static char * line = NULL;
 static size_t line_size = 0;
 static size_t line_maxsize = 0;
 
-static char * cb_serialize_none(const snode_t * snode)
-{
-  if (!snode->left) return xstrdup(snode->label);
-
-  return xstrdup("");
-}
-
 static void reallocline(size_t newmaxsize)
 {
   char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
@@ -609,105 +648,296 @@ static char * getnextline(FILE * fp)
   return line;
 }
 
-static void strip_attributes(char * s)
+static int cb_dtree_cmp(const void * a, const void * b)
+{
+  const struct distinct_s * pa = (const struct distinct_s *)a;
+  const struct distinct_s * pb = (const struct distinct_s *)b;
+
+  if (pa->count < pb->count) return 1;
+  else if (pa->count > pb->count) return -1;
+
+  return 0;
+}
+
+/* distinct topology and its frequency */
+struct treefreq_s
+{
+  char * newick;
+  size_t count;
+};
+
+static int cb_cmp_treefreq(void * a, void * b)
 {
-  char * p = s;
+  struct treefreq_s * tf = (struct treefreq_s *)a;
+  char * newick = (char *)b;
 
-  while (*s)
+  return !strcmp(tf->newick,newick);
+}
+
+static int cb_treefreq_strcmp(const void * a, const void * b)
+{
+  const struct treefreq_s * pa = *((const struct treefreq_s **)a);
+  const struct treefreq_s * pb = *((const struct treefreq_s **)b);
+
+  return strcmp(pa->newick,pb->newick);
+}
+
+static void cb_treefreq_dealloc(void * data)
+{
+  struct treefreq_s * tf = (struct treefreq_s *)data;
+
+  free(tf->newick);
+  free(tf);
+}
+
+/* serialize hashtable of topologies to an array */
+static struct treefreq_s ** hashtable_serialize_trees(hashtable_t * ht)
+{
+  unsigned long i,k;
+  struct treefreq_s ** tflist;
+
+  tflist = (struct treefreq_s **)xmalloc((ht->entries_count+1) *
+                                         sizeof(struct treefreq_s *));
+
+  for (i = 0, k = 0; i < ht->table_size; ++i)
   {
-    if (*s == '#' || *s == ':')
-    {
-      while (*s && *s != ',' && *s != ')' && *s != ';')
-        ++s;
-    }
-    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
-      ++s;
-    else
-      *p++ = *s++;
+    list_item_t * head = ht->entries[i]->head;
+    for (; head; head = head->next)
+      tflist[k++] = (struct treefreq_s *)(((ht_item_t *)(head->data))->value);
   }
-  *p = 0;
+
+  assert(k == ht->entries_count);
+
+  return tflist;
 }
 
-static int cb_strcmp(const void * a, const void * b)
+/* topologies and bipartitions of the sampled species trees, accumulated
+   during MCMC sampling or read from the MCMC sample file */
+static ntree_t * sampled_tree = NULL;
+static hashtable_t * ht_trees = NULL;
+static size_t sampled_count = 0;
+static char * sampled_newick = NULL;
+static size_t sampled_newick_maxsize = 0;
+
+static void summary_init(char ** species_names, long species_count)
 {
-  const char ** pa = (const char **)a;
-  const char ** pb = (const char **)b;
+  bipartitions_init(species_names,species_count);
 
-  return strcmp(*pa,*pb);
+  /* species labels get the indices of their bits in bipartition bitmasks */
+  sampled_tree = ntree_create(species_names,species_count);
+  ht_trees = hashtable_create(MIN((size_t)opt_samples+1,65536));
+  sampled_count = 0;
 }
 
-static void stree_sort_recursive(snode_t * node)
+static void summary_fini()
 {
-  if (!node->left)
-    return;
+  summary_dealloc_hashtables();
+  hashtable_destroy(ht_trees,cb_treefreq_dealloc);
+  ntree_destroy(sampled_tree);
+  free(sampled_newick);
+
+  ht_trees = NULL;
+  sampled_tree = NULL;
+  sampled_newick = NULL;
+  sampled_newick_maxsize = 0;
+  sampled_count = 0;
+}
 
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
+/* record the bipartitions of the tree in sampled_tree and count the
+   occurrences of its topology (tip names only, children sorted) */
+static void summary_add()
+{
+  bipartitions_update(sampled_tree);
+  ntree_sort(sampled_tree);
+  ntree_export_topology(sampled_tree,&sampled_newick,&sampled_newick_maxsize);
+
+  unsigned long hash = hash_fnv(sampled_newick);
+  struct treefreq_s * tf = hashtable_find(ht_trees,
+                                          (void *)sampled_newick,
+                                          hash,
+                                          cb_cmp_treefreq);
+  if (tf)
+    tf->count++;
+  else
+  {
+    tf = (struct treefreq_s *)xmalloc(sizeof(struct treefreq_s));
+    tf->newick = xstrdup(sampled_newick);
+    tf->count = 1;
+    hashtable_insert_force(ht_trees,(void *)tf,hash);
+  }
+  sampled_count++;
+}
+
+/* start accumulating the summary during MCMC; species are ordered as the
+   tips of stree */
+void stree_summary_init(const stree_t * stree)
+{
+  unsigned int i;
+  char ** species = (char **)xmalloc(stree->tip_count * sizeof(char *));
 
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
+  for (i = 0; i < stree->tip_count; ++i)
+    species[i] = stree->nodes[i]->label;
 
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
+  summary_init(species,(long)(stree->tip_count));
+  free(species);
+}
 
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
+void stree_summary_add(const stree_t * stree)
+{
+  ntree_import_stree(sampled_tree,stree);
+  summary_add();
 }
 
-static void stree_sort(stree_t * stree)
+void stree_summary_dump(FILE * fp)
 {
-  stree_sort_recursive(stree->root); 
+  unsigned long i;
+  long count;
+
+  count = (long)sampled_count;
+  DUMP(&count,1,fp);
+
+  /* bipartitions in hashtable order such that loading preserves the order
+     of equal frequency splits */
+  struct bipartition_s ** blist = hashtable_serialize1p(ht_biparts);
+  count = (long)(ht_biparts->entries_count);
+  DUMP(&count,1,fp);
+  for (i = 0; i < ht_biparts->entries_count; ++i)
+  {
+    DUMP(blist[i]->bitmask,bitmask_elms,fp);
+    DUMP(&(blist[i]->count),1,fp);
+  }
+  free(blist);
+
+  /* topologies */
+  struct treefreq_s ** tflist = hashtable_serialize_trees(ht_trees);
+  count = (long)(ht_trees->entries_count);
+  DUMP(&count,1,fp);
+  for (i = 0; i < ht_trees->entries_count; ++i)
+  {
+    long len = (long)strlen(tflist[i]->newick);
+    DUMP(&len,1,fp);
+    DUMP(tflist[i]->newick,len,fp);
+    count = (long)(tflist[i]->count);
+    DUMP(&count,1,fp);
+  }
+  free(tflist);
 }
 
-static int cb_dtree_cmp(const void * a, const void * b)
+void stree_summary_load(FILE * fp, const stree_t * stree)
 {
-  const struct distinct_s * pa = (const struct distinct_s *)a;
-  const struct distinct_s * pb = (const struct distinct_s *)b;
+  long i,n;
+  long count;
+
+  stree_summary_init(stree);
+
+  if (!LOAD(&count,1,fp))
+    fatal("Cannot read species tree summary");
+  sampled_count = (size_t)count;
+
+  if (!LOAD(&n,1,fp))
+    fatal("Cannot read species tree summary");
+  for (i = 0; i < n; ++i)
+  {
+    struct bipartition_s * bp;
+
+    bp = (struct bipartition_s *)xmalloc(sizeof(struct bipartition_s));
+    bp->bitmask = (unsigned long *)xmalloc((size_t)bitmask_elms *
+                                           sizeof(unsigned long));
+    if (!LOAD(bp->bitmask,bitmask_elms,fp) || !LOAD(&(bp->count),1,fp))
+      fatal("Cannot read species tree summary");
+
+    hashtable_insert_force(ht_biparts,
+                           (void *)bp,
+                           hash_fnv_long(bp->bitmask,bitmask_elms));
+  }
+
+  if (!LOAD(&n,1,fp))
+    fatal("Cannot read species tree summary");
+  for (i = 0; i < n; ++i)
+  {
+    long len;
+    struct treefreq_s * tf;
+
+    if (!LOAD(&len,1,fp) || len < 0)
+      fatal("Cannot read species tree summary");
+
+    tf = (struct treefreq_s *)xmalloc(sizeof(struct treefreq_s));
+    tf->newick = (char *)xmalloc((size_t)(len+1)*sizeof(char));
+    if (!LOAD(tf->newick,len,fp) || !LOAD(&count,1,fp))
+      fatal("Cannot read species tree summary");
+    tf->newick[len] = 0;
+    tf->count = (size_t)count;
+
+    hashtable_insert_force(ht_trees,(void *)tf,hash_fnv(tf->newick));
+  }
+}
+
+static int cb_treefreq_count(const void * a, const void * b)
+{
+  const struct treefreq_s * pa = *((const struct treefreq_s **)a);
+  const struct treefreq_s * pb = *((const struct treefreq_s **)b);
 
   if (pa->count < pb->count) return 1;
   else if (pa->count > pb->count) return -1;
 
-  return 0;
+  return strcmp(pa->newick,pb->newick);
+}
+
+/* print the most frequent topologies sampled so far, without changing the
+   accumulated tables */
+void stree_summary_snapshot(FILE * fp, long max_count)
+{
+  size_t i;
+
+  if (!ht_trees || !sampled_count) return;
+
+  size_t distinct = ht_trees->entries_count;
+  struct treefreq_s ** tflist = hashtable_serialize_trees(ht_trees);
+  qsort(tflist,distinct,sizeof(struct treefreq_s *),cb_treefreq_count);
+
+  fprintf(fp, "Best trees in the sample so far (%ld samples, %ld distinct "
+          "trees)\n", (long)sampled_count, (long)distinct);
+  for (i = 0; i < distinct && i < (size_t)max_count; ++i)
+    fprintf(fp, " %8ld %8.5f %s\n",
+            (long)(tflist[i]->count),
+            tflist[i]->count / (double)sampled_count,
+            tflist[i]->newick);
+  fprintf(fp, "\n");
+
+  free(tflist);
 }
 
 void stree_summary(FILE * fp_out, char ** species_names, long species_count)
 {
   size_t i,distinct;
-  size_t line_count = 0;
-  FILE * fp_mcmc;
   char ** treelist;
   struct distinct_s * dtree;
 
-  /* allocate space for holding all species tree samples */
-  treelist = (char **)xmalloc((size_t)(opt_samples+1)*sizeof(char *));
+  /* if the summary was not accumulated during MCMC (summary only mode),
+     read the trees from the MCMC file */
+  if (!ht_trees)
+  {
+    FILE * fp_mcmc;
 
-  /* open mcmc file */
-  #ifndef DEBUG_MAJORITY
-  fp_mcmc = xopen(opt_mcmcfile,"r");
-  #else
-  fp_mcmc = xopen("test.txt","r");
-  #endif
+    #ifndef DEBUG_MAJORITY
+    fp_mcmc = xopen(opt_mcmcfile,"r");
+    #else
+    fp_mcmc = xopen("test.txt","r");
+    #endif
 
-  bipartitions_init(species_names,species_count);
+    summary_init(species_names,species_count);
 
-  /* read each line from the file, and strip all thetas and branch lengths
-     such that only the tree topology and tip names remain, and store them
-     in treelist */
-  while (getnextline(fp_mcmc))
-  {
-    strip_attributes(line);
-    stree_t * t = stree_parse_newick_string(line);
-    stree_sort(t);
-    treelist[line_count++] = stree_export_newick(t->root,cb_serialize_none);
+    while (getnextline(fp_mcmc))
+    {
+      ntree_parse(sampled_tree,line);
+      summary_add();
+    }
 
-    bipartitions_update(t);
-    stree_destroy(t,NULL);
+    fclose(fp_mcmc);
   }
+  size_t line_count = sampled_count;
   assert(line_count);
 
-
   fprintf(stdout, "Species in order:\n");
   fprintf(fp_out, "Species in order:\n");
   for (i = 0; i < (size_t)species_count; ++i)
@@ -718,28 +948,22 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  qsort(treelist,(size_t)line_count,sizeof(char *), cb_strcmp);
-
-  distinct = 1;
-  size_t * uniquepos = (size_t *)xmalloc(line_count*sizeof(size_t));
-  uniquepos[0] = 0;
-  for (i = 1; i < line_count; ++i)
-  {
-    if (strcmp(treelist[i],treelist[i-1]))
-    {
-      uniquepos[distinct++] = i;
-    }
-  }
-
+  /* sort distinct topologies lexicographically */
+  distinct = ht_trees->entries_count;
   assert(distinct > 0);
 
+  struct treefreq_s ** tflist = hashtable_serialize_trees(ht_trees);
+  qsort(tflist,distinct,sizeof(struct treefreq_s *),cb_treefreq_strcmp);
+
+  treelist = (char **)xmalloc(distinct*sizeof(char *));
   dtree = (struct distinct_s *)xmalloc(distinct * sizeof(struct distinct_s));
   for (i = 0; i < distinct; ++i)
   {
-    dtree[i].start = uniquepos[i];
-    dtree[i].count = (i == distinct - 1) ?
-                      line_count - uniquepos[i] : uniquepos[i+1] - uniquepos[i];
+    treelist[i] = tflist[i]->newick;
+    dtree[i].start = i;
+    dtree[i].count = tflist[i]->count;
   }
+  free(tflist);
 
   qsort(dtree, distinct, sizeof(struct distinct_s), cb_dtree_cmp);
   fprintf(stdout, "(A) Best trees in the sample (%ld distinct trees in all)\n", distinct);
@@ -772,16 +996,10 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
                              line_count);
   }
 
-  summary_dealloc_hashtables();
-  free(uniquepos);
   free(dtree);
- 
-  /* deallocate list of trees */
-  for (i = 0; i < line_count; ++i)
-    free(treelist[i]);
   free(treelist);
 
-  fclose(fp_mcmc);
+  summary_fini();
 }
 
 long getlinecount(const char * filename)
@@ -21,6 +21,9 @@
 
 #include "bpp.h"
 
+#define DUMP(x,n,fp) chk_write((const void *)(x),sizeof(*(x)),n,fp)
+#define LOAD(x,n,fp) (chk_read((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
 /* A11 method summary */
 static char buffer[LINEALLOC];
 static char * line = NULL;
@@ -87,31 +90,6 @@ static char * getnextline(FILE * fp)
   return line;
 }
 
-static void stree_sort_recursive(snode_t * node)
-{
-  if (!node->left)
-    return;
-
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
-
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
-
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
-
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
-}
-
-static void stree_sort(stree_t * stree)
-{
-  stree_sort_recursive(stree->root); 
-}
-
 typedef struct db_bitvector_s
 {
   uint64_t * bitvector;
@@ -180,129 +158,97 @@ static int cb_delimit_strcmp(const void * s1, const void * s2)
   return strcmp(a, b);
 }
 
-/* recursively fill buf (starting at position index) with all tip nodes of
+/* recursively fill buf (starting at position index) with all tip labels of
    subtree rooted at node */
-static void snode_getleaves(const snode_t * node, int * index, char ** buf)
+static void ntree_getleaves(const ntree_t * t,
+                            long node,
+                            long * index,
+                            const char ** buf)
 {
-  if (!(node->left))
+  if (t->nodes[node].left < 0)
   {
-    buf[*index] = xstrdup(node->label);
+    buf[*index] = t->labels[t->nodes[node].label];
     *index = *index+1;
     return;
   }
 
-  snode_getleaves(node->left,index,buf);
-  snode_getleaves(node->right,index,buf);
+  ntree_getleaves(t,t->nodes[node].left,index,buf);
+  ntree_getleaves(t,t->nodes[node].right,index,buf);
 }
 
-static char * delimit_string(const snode_t * root)
+/* node ages and buffer of tip labels used for exporting delimitations */
+static double * ntree_tau = NULL;
+static const char ** ntree_leaves = NULL;
+static long ntree_maxcount = 0;
+
+static size_t export_delimitation_recursive(const ntree_t * t,
+                                            long index,
+                                            char ** buffer,
+                                            size_t * maxsize,
+                                            size_t pos)
 {
-  int index = 0;
   long i;
-  char ** labels = (char **)xmalloc((size_t)(root->leaves) * sizeof(char *));
-
-  snode_getleaves(root,&index,labels);
+  const nnode_t * node = t->nodes+index;
 
-  qsort(labels,root->leaves,sizeof(char *),cb_delimit_strcmp);
-
-  long sumsize = 0;
-  for (i = 0; i < root->leaves; ++i)
-    sumsize += strlen(labels[i]);
-  sumsize++;
-
-  char * l = (char *)xmalloc((size_t)sumsize * sizeof(char));
-  l[0] = 0;
-
-  char * p = l;
-  for (i = 0; i < root->leaves; ++i)
+  if (node->left < 0)
   {
-    size_t len = strlen(labels[i]);
-    memcpy(p,labels[i],len*sizeof(char));
-    p+=len;
+    const char * label = t->labels[node->label];
+    return xbuf_append(buffer, maxsize, pos, label, strlen(label));
   }
-  *p = 0;
 
-  for (i = 0; i < root->leaves; ++i)
-    free(labels[i]);
-  free(labels);
-  
-  return l;
-}
-
-static char * stree_export_delimitation_recursive(const snode_t * root)
-{
-  char * newick;
-  int size_alloced;
-  assert(root != NULL);
-
-  if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
-  else
+  if (ntree_tau[index])
   {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
-
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
-
-      size_alloced = xasprintf(&newick, "(%s, %s)", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
-    else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s", subtree);
-      free(subtree);
-    }
+    pos = xbuf_append(buffer, maxsize, pos, "(", 1);
+    pos = export_delimitation_recursive(t,node->left,buffer,maxsize,pos);
+    pos = xbuf_append(buffer, maxsize, pos, ", ", 2);
+    pos = export_delimitation_recursive(t,node->right,buffer,maxsize,pos);
+    return xbuf_append(buffer, maxsize, pos, ")", 1);
   }
 
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
+  /* subtree of zero age is a single species named by its sorted tips */
+  long count = 0;
+  ntree_getleaves(t,index,&count,ntree_leaves);
+  qsort(ntree_leaves,count,sizeof(char *),cb_delimit_strcmp);
 
-  return newick;
+  for (i = 0; i < count; ++i)
+    pos = xbuf_append(buffer, maxsize, pos,
+                      ntree_leaves[i], strlen(ntree_leaves[i]));
+
+  return pos;
 }
 
-static char * stree_export_delimitation(const snode_t * root)
+/* convert sorted tree into delimited tree, e.g.:
+
+   ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB, (C, D)); */
+static size_t export_delimitation(const ntree_t * t,
+                                  char ** buffer,
+                                  size_t * maxsize)
 {
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
+  long i;
 
-  if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
-  else
+  if (t->node_count > ntree_maxcount)
   {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
+    free(ntree_tau);
+    free(ntree_leaves);
+    ntree_maxcount = t->node_count;
+    ntree_tau = (double *)xmalloc((size_t)ntree_maxcount*sizeof(double));
+    ntree_leaves = (const char **)xmalloc((size_t)ntree_maxcount *
+                                          sizeof(char *));
+  }
 
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
+  /* node ages; children precede their parents in the node array */
+  for (i = 0; i < t->node_count; ++i)
+  {
+    const nnode_t * node = t->nodes+i;
 
-      size_alloced = xasprintf(&newick, "(%s, %s);", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
+    if (node->left < 0)
+      ntree_tau[i] = 0;
     else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s;", subtree);
-      free(subtree);
-    }
+      ntree_tau[i] = ntree_tau[node->left] + t->nodes[node->left].length;
   }
 
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
-
-  return newick;
+  size_t pos = export_delimitation_recursive(t,t->root,buffer,maxsize,0);
+  return xbuf_append(buffer, maxsize, pos, ";", 1);
 }
 
 static int logint64_len(int64_t x)
@@ -387,20 +333,6 @@ static int64_t get_int64(const char * pline, int64_t * value)
   return ws + end - start;
 }
 
-static void recursive_age(snode_t * node)
-{
-  if (!node->left)
-  {
-    node->tau = 0;
-    return;
-  }
-
-  recursive_age(node->left);
-  recursive_age(node->right);
-
-  node->tau = node->left->tau + node->left->length;
-}
-
 static int cb_stree_count(const void * pa, const void * pb)
 {
   const db_stree_t * a = (const db_stree_t *)pa;
@@ -411,27 +343,24 @@ static int cb_stree_count(const void * pa, const void * pb)
 
   return 0;
 }
+/* order by number of species and then by newick string */
 static int cb_stree_species(const void * pa, const void * pb)
 {
-  db_stree_t * a = (db_stree_t *)pa;
-  db_stree_t * b = (db_stree_t *)pb;
+  const db_stree_t * a = (const db_stree_t *)pa;
+  const db_stree_t * b = (const db_stree_t *)pb;
 
   if (a->species > b->species) return 1;
   if (a->species < b->species) return -1;
 
-  return 0;
-  //return (int)(a->species - b->species);
+  return strcmp(a->newick, b->newick);
 }
 
-static int cb_stree_strcmp(const void * pa, const void * pb)
+static int cb_cmp_stree(void * a, void * b)
 {
-  const db_stree_t * sa = (db_stree_t *)pa;
-  const db_stree_t * sb = (db_stree_t *)pb;
+  const db_stree_t * x = (const db_stree_t *)a;
+  const db_stree_t * y = (const db_stree_t *)b;
 
-  const char * a = sa->newick;
-  const char * b = sb->newick;
-
-  return strcmp(a, b);
+  return x->species == y->species && !strcmp(x->newick,y->newick);
 }
 
 static int cb_cmp_label(void * a, void * b)
@@ -441,12 +370,6 @@ static int cb_cmp_label(void * a, void * b)
 
   return !strcmp(sf->label,label);
 }
-static char * get_delimit_string(stree_t * stree)
-{
-  recursive_age(stree->root);
-  return stree_export_delimitation(stree->root);
-}
-
 static int cb_countcmp(const void * a, const void * b)
 {
   const stringfreq_t * pa = *((const stringfreq_t **)a);
@@ -458,25 +381,6 @@ static int cb_countcmp(const void * a, const void * b)
   return 0;
 }
 
-static void strip_theta_attributes(char * s)
-{
-  char * p = s;
-
-  while (*s)
-  {
-    if (*s == '#')
-    {
-      while (*s && *s != ',' && *s != ')' && *s != ';' && *s != ':')
-        ++s;
-    }
-    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
-      ++s;
-    else
-      *p++ = *s++;
-  }
-  *p = 0;
-}
-
 static stree_t * parse_tree(const char * s)
 {
   stree_t * t;
@@ -520,28 +424,181 @@ static stree_t * parse_tree(const char * s)
   return t;
 }
 
-static void replace(db_stree_t * treelist,
-                    int64_t index,
-                    int64_t start,
-                    int64_t freq)
+/* delimited trees of the sampled species trees, accumulated during MCMC
+   sampling or read from the MCMC sample file */
+static ntree_t * sampled_tree = NULL;
+static hashtable_t * ht_trees = NULL;
+static int64_t sampled_count = 0;
+static char * sampled_newick = NULL;
+static size_t sampled_newick_maxsize = 0;
+
+void mixed_summary_init()
+{
+  sampled_tree = ntree_create(NULL,0);
+  ht_trees = hashtable_create(MIN((size_t)opt_samples+1,65536));
+  sampled_count = 0;
+}
+
+/* newick strings of the entries are freed by mixed_summary() */
+static void summary_fini()
+{
+  hashtable_destroy(ht_trees,free);
+  ntree_destroy(sampled_tree);
+  free(sampled_newick);
+  free(ntree_tau);
+  free(ntree_leaves);
+
+  ht_trees = NULL;
+  sampled_tree = NULL;
+  sampled_newick = NULL;
+  sampled_newick_maxsize = 0;
+  sampled_count = 0;
+  ntree_tau = NULL;
+  ntree_leaves = NULL;
+  ntree_maxcount = 0;
+}
+
+/* unambiguously sort the tree in sampled_tree by its labels, convert it
+   into a delimited tree and count its occurrences */
+static void summary_add(int64_t species)
+{
+  ntree_sort(sampled_tree);
+  export_delimitation(sampled_tree,&sampled_newick,&sampled_newick_maxsize);
+
+  db_stree_t query;
+  query.species = species;
+  query.newick = sampled_newick;
+
+  unsigned long hash = hash_fnv(sampled_newick);
+  db_stree_t * entry = hashtable_find(ht_trees,
+                                      (void *)&query,
+                                      hash,
+                                      cb_cmp_stree);
+  if (entry)
+    entry->count++;
+  else
+  {
+    entry = (db_stree_t *)xmalloc(sizeof(db_stree_t));
+    entry->newick = xstrdup(sampled_newick);
+    entry->species = species;
+    entry->count = 1;
+    hashtable_insert_force(ht_trees,(void *)entry,hash);
+  }
+  sampled_count++;
+}
+
+void mixed_summary_add(const stree_t * stree, long ndspecies)
+{
+  ntree_import_stree(sampled_tree,stree);
+  summary_add(ndspecies);
+}
+
+void mixed_summary_dump(FILE * fp)
+{
+  unsigned long i;
+  long count;
+
+  count = (long)sampled_count;
+  DUMP(&count,1,fp);
+
+  /* entries in hashtable order such that loading preserves the order of
+     equal frequency trees */
+  count = (long)(ht_trees->entries_count);
+  DUMP(&count,1,fp);
+  for (i = 0; i < ht_trees->table_size; ++i)
+  {
+    list_item_t * head = ht_trees->entries[i]->head;
+    for (; head; head = head->next)
+    {
+      db_stree_t * entry = (db_stree_t *)(((ht_item_t *)(head->data))->value);
+      long len = (long)strlen(entry->newick);
+
+      DUMP(&len,1,fp);
+      DUMP(entry->newick,len,fp);
+      DUMP(&(entry->species),1,fp);
+      DUMP(&(entry->count),1,fp);
+    }
+  }
+}
+
+void mixed_summary_load(FILE * fp)
 {
-  if (index != start)
+  long i,n;
+  long count;
+
+  mixed_summary_init();
+
+  if (!LOAD(&count,1,fp))
+    fatal("Cannot read species tree summary");
+  sampled_count = count;
+
+  if (!LOAD(&n,1,fp))
+    fatal("Cannot read species tree summary");
+  for (i = 0; i < n; ++i)
   {
-    if (treelist[index].newick)
-      free(treelist[index].newick);
-    treelist[index].newick = treelist[start].newick;
-    treelist[start].newick = NULL;
+    long len;
+
+    if (!LOAD(&len,1,fp) || len < 0)
+      fatal("Cannot read species tree summary");
+
+    db_stree_t * entry = (db_stree_t *)xmalloc(sizeof(db_stree_t));
+    entry->newick = (char *)xmalloc((size_t)(len+1)*sizeof(char));
+    if (!LOAD(entry->newick,len,fp) ||
+        !LOAD(&(entry->species),1,fp) ||
+        !LOAD(&(entry->count),1,fp))
+      fatal("Cannot read species tree summary");
+    entry->newick[len] = 0;
 
-    treelist[index].species = treelist[start].species;
+    hashtable_insert_force(ht_trees,(void *)entry,hash_fnv(entry->newick));
   }
-  treelist[index].count = freq;
+}
+
+/* order by frequency (descending), number of species and newick string */
+static int cb_stree_snapshot(const void * pa, const void * pb)
+{
+  int rc = cb_stree_count(pa,pb);
+
+  return rc ? rc : cb_stree_species(pa,pb);
+}
+
+/* print the most frequent delimited trees sampled so far, without changing
+   the accumulated tables */
+void mixed_summary_snapshot(FILE * fp, long max_count)
+{
+  int64_t i,j;
+
+  if (!ht_trees || !sampled_count) return;
+
+  int64_t index = (int64_t)(ht_trees->entries_count);
+  db_stree_t * treelist = (db_stree_t *)xmalloc((size_t)index *
+                                                sizeof(db_stree_t));
+  for (i = 0, j = 0; i < (int64_t)(ht_trees->table_size); ++i)
+  {
+    list_item_t * head = ht_trees->entries[i]->head;
+    for (; head; head = head->next)
+      treelist[j++] = *(db_stree_t *)(((ht_item_t *)(head->data))->value);
+  }
+  assert(j == index);
+
+  qsort(treelist,(size_t)index,sizeof(db_stree_t),cb_stree_snapshot);
+
+  fprintf(fp, "Best models in the sample so far (%ld samples, %ld distinct "
+          "models)\n", (long)sampled_count, (long)index);
+  for (i = 0; i < index && i < max_count; ++i)
+    fprintf(fp, " %8ld %8.5f %ld  %s\n",
+            (long)(treelist[i].count),
+            treelist[i].count / (double)sampled_count,
+            (long)(treelist[i].species),
+            treelist[i].newick);
+  fprintf(fp, "\n");
+
+  /* the newick strings are still owned by the hashtable */
+  free(treelist);
 }
 
 void mixed_summary(FILE * fp_out)
 {
-  int64_t line_count = 0;
   int64_t i,j;
-  FILE * fp_mcmc;
   db_stree_t * treelist;
   snode_t ** inner;
 
@@ -553,94 +610,48 @@ void mixed_summary(FILE * fp_out)
      stree_parse_newick_string, but we should come up with a better solution */
   long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
 
-  /* open MCMC file for reading */
-  fp_mcmc = xopen(opt_mcmcfile,"r");
-
   /* allocate space for storing inner nodes */
   inner = (snode_t **)xmalloc((size_t)opt_max_species_count*sizeof(snode_t *));
 
-  /* allocate space for reading trees from MCMC file */
-  treelist = (db_stree_t *)xmalloc((size_t)(opt_samples+1)*sizeof(db_stree_t));
-
-  /* read trees and species counts from MCMC file */
-  while (getnextline(fp_mcmc))
+  /* if the summary was not accumulated during MCMC (summary only mode),
+     read trees and species counts from the MCMC file */
+  if (!ht_trees)
   {
-    /* separate line into two zero-terminated strings, the first one (line)
-       contains the newick tree string and the second (tmp) holds the species
-       count */
-    char * tmp =  strchr(line,';');
-    tmp++;
-    *tmp = 0;
-    tmp++;
+    FILE * fp_mcmc = xopen(opt_mcmcfile,"r");
 
-    /* parse newick string and unambiguously sort tree by its labels */
-    if (opt_est_theta)
-      strip_theta_attributes(line);
-    stree_t * t = stree_parse_newick_string(line);
-    stree_sort(t);
+    mixed_summary_init();
 
-    /* convert expanded tree into delimited tree, e.g.:
-
-       ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB,(C,D)); */
-    char * dnewick = get_delimit_string(t);
-
-    int64_t species_count;
-    if (!get_int64(tmp,&species_count))
-      fatal("Cannot read number of species; line %ld of %s",line_count+1,opt_mcmcfile);
+    while (getnextline(fp_mcmc))
+    {
+      /* the species count follows the tree */
+      const char * tmp = ntree_parse(sampled_tree,line);
 
-    treelist[line_count].newick = dnewick;
-    treelist[line_count].species = species_count;
-    treelist[line_count].count = 1;
-    line_count++;
+      int64_t species;
+      if (!get_int64(tmp,&species))
+        fatal("Cannot read number of species; line %ld of %s",
+              sampled_count+1, opt_mcmcfile);
 
-   // if (species_count > max_species_count)
-   //   max_species_count = species_count;
+      summary_add(species);
+    }
 
-    stree_destroy(t,NULL);
+    fclose(fp_mcmc);
   }
-  assert(line_count);
-
-  /* sort by number of species (ascending order - not relevant) */
-  qsort(treelist,(size_t)line_count, sizeof(db_stree_t), cb_stree_species);
+  assert(sampled_count);
 
-  /* now sort by newick each range of trees having the same number of species */
-  int64_t start = 0;
-  int64_t freq = 1; 
-  for (i = 1; i < line_count; ++i)
+  /* collect unique trees */
+  int64_t index = (int64_t)(ht_trees->entries_count);
+  treelist = (db_stree_t *)xmalloc((size_t)index*sizeof(db_stree_t));
+  for (i = 0, j = 0; i < (int64_t)(ht_trees->table_size); ++i)
   {
-    if (treelist[i].species == treelist[i-1].species)
-      ++freq;
-    else
-    {
-      qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
-      start = i;
-      freq = 1;
-    }
+    list_item_t * head = ht_trees->entries[i]->head;
+    for (; head; head = head->next)
+      treelist[j++] = *(db_stree_t *)(((ht_item_t *)(head->data))->value);
   }
-  if (freq > 1)
-    qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
+  assert(j == index);
+  summary_fini();
 
-  /* now keep only the unique trees in treelist */
-  int64_t index = 0;
-  start = 0; freq = 1;
-  for (i = 1; i < line_count; ++i)
-  {
-    if (!strcmp(treelist[i].newick,treelist[i-1].newick))
-    {
-      ++freq;
-    }
-    else
-    {
-      replace(treelist,index,start,freq);
-      ++index;
-
-      start = i;
-      freq = 1;
-
-    }
-  }
-  replace(treelist,index,start,freq);
-  ++index;
+  /* sort by number of species (ascending order) and newick string */
+  qsort(treelist,(size_t)index, sizeof(db_stree_t), cb_stree_species);
 
   /* Print summary statistics (A) with the following columns: 
   
@@ -662,7 +673,6 @@ void mixed_summary(FILE * fp_out)
   int maxlen = logint64_len(treelist[0].count);
   double prob;
   double cum = 0;
-  start = 0; freq = 1;
   fprintf(stdout,
           "\n(A) List of best models (count postP #species SpeciesTree)\n");
   fprintf(fp_out,
@@ -735,11 +745,8 @@ void mixed_summary(FILE * fp_out)
     }
     stree_destroy(t,NULL);
   }
-  for (i = 0; i < line_count; ++i)
-  {
-    if (treelist[i].newick)
-      free(treelist[i].newick);
-  }
+  for (i = 0; i < index; ++i)
+    free(treelist[i].newick);
   free(treelist);
 
   /* Print delimitation summary statistics (B) with the following columns:
@@ -858,7 +865,6 @@ void mixed_summary(FILE * fp_out)
   hashtable_destroy(ht_delims,cb_stringfreq_dealloc);
                  
   free(inner);   
-  fclose(fp_mcmc);
 
   opt_diploid = debug_opt_diploid;
 }                
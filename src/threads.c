@@ -0,0 +1,93 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef struct thread_work_s
+{
+  long count;
+  long next;
+  void (*cb)(long index, void * data);
+  void * data;
+} thread_work_t;
+
+#ifndef _WIN32
+static void * worker(void * arg)
+{
+  long i;
+  thread_work_t * work = (thread_work_t *)arg;
+
+  /* loci differ a lot in size, so hand them out one at a time */
+  while ((i = __sync_fetch_and_add(&work->next,1)) < work->count)
+    work->cb(i,work->data);
+
+  return NULL;
+}
+#endif
+
+long threads_get_count()
+{
+  return opt_threads ? opt_threads : arch_get_cores();
+}
+
+/* call cb(i,data) for i = 0..count-1 using up to opt_threads threads (the
+   calling thread included). Calls for different indices must be independent */
+void threads_parallel_for(long count,
+                          void (*cb)(long index, void * data),
+                          void * data)
+{
+  long i;
+  long thread_count = MIN(threads_get_count(), count);
+
+#ifndef _WIN32
+  if (thread_count > 1)
+  {
+    thread_work_t work;
+    pthread_t * tid = (pthread_t *)xmalloc((size_t)(thread_count-1) *
+                                           sizeof(pthread_t));
+
+    work.count = count;
+    work.next  = 0;
+    work.cb    = cb;
+    work.data  = data;
+
+    for (i = 0; i < thread_count-1; ++i)
+      if (pthread_create(tid+i, NULL, worker, &work))
+        fatal("Unable to create thread");
+
+    worker(&work);
+
+    for (i = 0; i < thread_count-1; ++i)
+      if (pthread_join(tid[i], NULL))
+        fatal("Unable to join thread");
+
+    free(tid);
+    return;
+  }
+#endif
+
+  for (i = 0; i < count; ++i)
+    cb(i,data);
+}
@@ -0,0 +1,189 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Timeline of the MCMC phases for steps opt_trace_from..opt_trace_to
+   (trace = from to), written as a Chrome trace-event file to
+   <outfile>.trace.json for viewing in chrome://tracing or Perfetto.
+
+   Each thread records complete events (name, start, duration and an
+   optional integer argument) into its own ring buffer, so recording takes
+   no locks and only a few stores. When a buffer is full the oldest events
+   are overwritten. Buffers are written out by trace_fini() once all other
+   threads have finished */
+
+#define TRACE_MAX_THREADS 64
+#define TRACE_BUFSIZE     (1 << 16)
+
+typedef struct trace_event_s
+{
+  const char * name;
+  const char * arg_name;
+  long arg;
+  int64_t start;
+  int64_t dur;
+} trace_event_t;
+
+typedef struct trace_buf_s
+{
+  const char * name;
+  trace_event_t * event;
+  unsigned long count;
+} trace_buf_t;
+
+/* read by all threads, written by the MCMC thread */
+static volatile int trace_active = 0;
+
+static trace_buf_t trace_buf[TRACE_MAX_THREADS];
+static long trace_thread_count = 0;
+static int64_t trace_origin = 0;
+static int trace_enabled = 0;
+
+static __THREAD trace_buf_t * tbuf = NULL;
+static __THREAD const char * tname = NULL;
+
+static trace_buf_t * thread_buf()
+{
+  if (!tbuf)
+  {
+#ifndef _WIN32
+    long i = __sync_fetch_and_add(&trace_thread_count,1);
+#else
+    long i = trace_thread_count++;
+#endif
+    if (i >= TRACE_MAX_THREADS)
+      return NULL;
+
+    tbuf = trace_buf + i;
+    tbuf->name = tname ? tname : "Thread";
+    tbuf->event = (trace_event_t *)xmalloc(TRACE_BUFSIZE *
+                                           sizeof(trace_event_t));
+    tbuf->count = 0;
+  }
+  return tbuf;
+}
+
+void trace_init()
+{
+  if (!opt_trace_to) return;
+
+  trace_enabled = 1;
+  trace_origin = prof_clock();
+  trace_thread("MCMC");
+}
+
+/* name the calling thread before it records its first event */
+void trace_thread(const char * name)
+{
+  tname = name;
+}
+
+/* enable recording if step is within the traced window */
+void trace_step(unsigned long step)
+{
+  if (!trace_enabled) return;
+
+  trace_active = ((long)step >= opt_trace_from && (long)step <= opt_trace_to);
+}
+
+/* return the start time of an event, or zero if tracing is off */
+int64_t trace_begin()
+{
+  return trace_active ? prof_clock() : 0;
+}
+
+/* record an event started at start (unless zero); arg_name is NULL when
+   there is no argument */
+void trace_end(const char * name,
+               int64_t start,
+               const char * arg_name,
+               long arg)
+{
+  if (!start) return;
+
+  trace_buf_t * b = thread_buf();
+  if (!b) return;
+
+  trace_event_t * e = b->event + (b->count++ % TRACE_BUFSIZE);
+  e->name = name;
+  e->arg_name = arg_name;
+  e->arg = arg;
+  e->start = start;
+  e->dur = prof_clock() - start;
+}
+
+void trace_fini()
+{
+  long i;
+  unsigned long j;
+  char * s = NULL;
+
+  if (!trace_enabled) return;
+
+  trace_enabled = 0;
+  trace_active = 0;
+
+  xasprintf(&s, "%s.trace.json", opt_outfile);
+  FILE * fp = xopen(s, "w");
+
+  long thread_count = MIN(trace_thread_count, TRACE_MAX_THREADS);
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+              "\"args\":{\"name\":\"%s\"}}", PROG_NAME);
+
+  for (i = 0; i < thread_count; ++i)
+  {
+    trace_buf_t * b = trace_buf + i;
+
+    fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}", i, b->name);
+
+    if (b->count > TRACE_BUFSIZE)
+      fprintf(stderr, "WARNING: Trace buffer of thread '%s' is full, the "
+              "first %lu events are not in the trace\n",
+              b->name, b->count - TRACE_BUFSIZE);
+
+    j = b->count > TRACE_BUFSIZE ? b->count - TRACE_BUFSIZE : 0;
+    for (; j < b->count; ++j)
+    {
+      trace_event_t * e = b->event + (j % TRACE_BUFSIZE);
+
+      fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%ld,"
+                  "\"ts\":%.3f,\"dur\":%.3f",
+              e->name, i, (e->start - trace_origin) / 1e3, e->dur / 1e3);
+      if (e->arg_name)
+        fprintf(fp, ",\"args\":{\"%s\":%ld}", e->arg_name, e->arg);
+      fprintf(fp, "}");
+    }
+
+    free(b->event);
+    b->event = NULL;
+  }
+  fprintf(fp, "\n]}\n");
+
+  fclose(fp);
+  free(s);
+
+  trace_thread_count = 0;
+  tbuf = NULL;
+}
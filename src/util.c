@@ -140,6 +140,129 @@ FILE * xopen(const char * filename, const char * mode)
   return out;
 }
 
+/* read the remaining contents of fd into a buffer */
+static int mapfile_readall(mapfile_t * m, int fd)
+{
+  long n;
+  size_t alloc = 0;
+  char * buffer = NULL;
+
+  do
+  {
+    if (m->size == alloc)
+    {
+      alloc = MAX(2*alloc, 65536);
+      buffer = (char *)xrealloc(buffer, alloc);
+    }
+    n = (long)read(fd, buffer + m->size, (unsigned int)(alloc - m->size));
+    if (n > 0)
+      m->size += (size_t)n;
+  }
+  while (n > 0);
+
+  if (n < 0)
+  {
+    free(buffer);
+    m->size = 0;
+    return 0;
+  }
+
+  m->data = buffer;
+  return 1;
+}
+
+/* Whole-file reader for sequence files and the binary formats (data cache,
+   binary samples, gene tree containers). Regular files are mapped into
+   memory where mmap is available; other files (pipes, /dev/stdin) and all
+   files on Windows are read into a buffer. The contents are consumed with
+   mapfile_take() and mapfile_read(), which check the remaining size.
+   Returns 0 if the file cannot be opened or read */
+int mapfile_open(mapfile_t * m, const char * filename)
+{
+  struct stat st;
+  int rc;
+
+  m->data = NULL;
+  m->size = 0;
+  m->pos = 0;
+  m->mapped = 0;
+
+  int fd = open(filename, O_RDONLY | O_BINARY);
+  if (fd == -1)
+    return 0;
+
+  if (fstat(fd, &st) == -1)
+  {
+    close(fd);
+    return 0;
+  }
+
+#ifndef _WIN32
+  if (S_ISREG(st.st_mode))
+  {
+    m->size = (size_t)st.st_size;
+    if (m->size)
+    {
+      void * data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+      {
+        close(fd);
+        m->size = 0;
+        return 0;
+      }
+      madvise(data, m->size, MADV_SEQUENTIAL);
+      m->data = (const char *)data;
+      m->mapped = 1;
+    }
+    close(fd);
+    return 1;
+  }
+#endif
+
+  rc = mapfile_readall(m,fd);
+  close(fd);
+
+  return rc;
+}
+
+void mapfile_close(mapfile_t * m)
+{
+#ifndef _WIN32
+  if (m->mapped)
+    munmap((void *)m->data, m->size);
+  else
+#endif
+    free((void *)m->data);
+
+  m->data = NULL;
+  m->mapped = 0;
+}
+
+/* return the next size bytes and advance, or NULL if fewer bytes remain */
+const void * mapfile_take(mapfile_t * m, size_t size)
+{
+  const void * p;
+
+  if (m->size - m->pos < size)
+    return NULL;
+
+  p = m->data + m->pos;
+  m->pos += size;
+
+  return p;
+}
+
+/* copy the next size bytes to x; returns 0 if fewer bytes remain */
+int mapfile_read(mapfile_t * m, void * x, size_t size)
+{
+  const void * p = mapfile_take(m,size);
+
+  if (!p) return 0;
+
+  memcpy(x,p,size);
+  return 1;
+}
+
 void * pll_aligned_alloc(size_t size, size_t alignment)
 {
   void * mem;
@@ -163,6 +286,99 @@ void pll_aligned_free(void * ptr)
 #endif
 }
 
+/* Growable string buffers. Text is appended at position pos of buffer
+   (allocated on first use) and the new end position is returned. The
+   buffer is always NUL-terminated */
+
+static void xbuf_reserve(char ** buffer, size_t * maxsize, size_t size)
+{
+  if (size <= *maxsize && *buffer) return;
+
+  *maxsize = MAX(2 * *maxsize, MAX(size, 256));
+  *buffer = (char *)xrealloc(*buffer, *maxsize);
+}
+
+size_t xbuf_append(char ** buffer,
+                   size_t * maxsize,
+                   size_t pos,
+                   const char * s,
+                   size_t len)
+{
+  xbuf_reserve(buffer, maxsize, pos+len+1);
+  memcpy(*buffer+pos, s, len);
+  (*buffer)[pos+len] = 0;
+
+  return pos+len;
+}
+
+size_t xbuf_printf(char ** buffer,
+                   size_t * maxsize,
+                   size_t pos,
+                   const char * format,
+                   ...)
+{
+  int len;
+  va_list argptr;
+
+  xbuf_reserve(buffer, maxsize, pos+1);
+  while (1)
+  {
+    va_start(argptr, format);
+    len = vsnprintf(*buffer+pos, *maxsize-pos, format, argptr);
+    va_end(argptr);
+
+    if (len < 0)
+      fatal("Unable to format string");
+
+    if (pos + (size_t)len < *maxsize)
+      return pos + (size_t)len;
+
+    xbuf_reserve(buffer, maxsize, pos+(size_t)len+1);
+  }
+}
+
+/* append x in the format of printf("%f"). Values whose scaled fraction is
+   too close to a rounding boundary are passed to snprintf, so the output
+   is identical to printf in all cases */
+size_t xbuf_double(char ** buffer, size_t * maxsize, size_t pos, double x)
+{
+  char digits[32];
+  char * p = digits + sizeof(digits);
+  int negative = signbit(x) ? 1 : 0;
+  double a = negative ? -x : x;
+
+  if (!(a < 1e9))
+    return xbuf_printf(buffer, maxsize, pos, "%f", x);
+
+  /* a*1e6 is below 2^50, so the scaling error is below 2^-3 */
+  double s = a * 1e6;
+  double f = floor(s);
+  double tol = s * DBL_EPSILON + 1e-300;
+  if (fabs(s - f - 0.5) <= tol)
+    return xbuf_printf(buffer, maxsize, pos, "%f", x);
+
+  unsigned long long n = (unsigned long long)f + (s - f > 0.5);
+  unsigned long long ipart = n / 1000000;
+  unsigned long frac = (unsigned long)(n % 1000000);
+  int i;
+
+  for (i = 0; i < 6; ++i)
+  {
+    *--p = (char)('0' + frac % 10);
+    frac /= 10;
+  }
+  *--p = '.';
+  do
+  {
+    *--p = (char)('0' + ipart % 10);
+    ipart /= 10;
+  } while (ipart);
+  if (negative)
+    *--p = '-';
+
+  return xbuf_append(buffer, maxsize, pos, p, (size_t)(digits+sizeof(digits)-p));
+}
+
 #ifdef _MSC_VER
 static int vasprintf(char **strp, const char *fmt, va_list ap)
 {
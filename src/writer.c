@@ -0,0 +1,421 @@
+/*
+    Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* Background writer for the files written during MCMC sampling. The MCMC
+   thread (single producer) appends records to a ring buffer and a writer
+   thread (single consumer) performs the formatting and I/O. A record is
+   either raw bytes or a payload with a callback that formats it into the
+   stream's file. Records never wrap around the end of the ring; a padding
+   record fills the gap instead.
+
+   The ring head/tail are accessed atomically across threads. The mutex and
+   condition variables are used solely to put the idle writer to sleep and
+   to wait for synchronization points */
+
+#define WRITER_RING_SIZE  (8*1024*1024)
+#define WRITER_STAGE_SIZE (64*1024)
+
+#define REC_PAD   -1
+#define REC_SYNC  -2
+#define REC_STOP  -3
+
+#define ALIGN8(x) (((x)+7) & ~((size_t)7))
+
+typedef struct writer_rec_s
+{
+  long stream;
+  writer_cb_t cb;
+  size_t size;
+} writer_rec_t;
+
+static char * ring = NULL;
+static size_t ring_size = 0;
+static size_t ring_head = 0;              /* written by producer only */
+static size_t ring_tail = 0;              /* written by consumer only */
+
+/* pending reservation */
+static size_t reserved = 0;
+
+/* streams */
+static FILE ** stream_fp = NULL;
+static long * stream_offset = NULL;
+static long stream_count = 0;
+
+/* staged raw output of the current stream */
+static char * stage = NULL;
+static size_t stage_size = 0;
+static size_t stage_maxsize = 0;
+static long stage_stream = -1;
+
+static int active = 0;
+
+#ifndef _WIN32
+static pthread_t tid;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_data = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_sync = PTHREAD_COND_INITIALIZER;
+static int consumer_waiting = 0;
+static long sync_done = 0;
+#endif
+static long sync_requested = 0;
+
+static void process_record(const writer_rec_t * rec)
+{
+  long i;
+  const void * payload = (const void *)(rec+1);
+
+  if (rec->stream >= 0)
+  {
+    if (rec->cb)
+      rec->cb(stream_fp[rec->stream],payload,rec->size);
+    else
+      fwrite(payload,1,rec->size,stream_fp[rec->stream]);
+  }
+  else if (rec->stream == REC_SYNC)
+  {
+    /* flush all streams and record their offsets */
+    for (i = 0; i < stream_count; ++i)
+    {
+      fflush(stream_fp[i]);
+      stream_offset[i] = ftell(stream_fp[i]);
+    }
+  }
+}
+
+#ifndef _WIN32
+static void * consumer(void * arg)
+{
+  size_t tail = 0;
+  int64_t trace_start = 0;
+
+  (void)arg;
+
+  trace_thread("Writer");
+
+  while (1)
+  {
+    /* sleep while the ring is empty */
+    if (__atomic_load_n(&ring_head,__ATOMIC_SEQ_CST) == tail)
+    {
+      /* records processed since the last wake-up form one trace event */
+      trace_end("Write", trace_start, NULL, 0);
+
+      pthread_mutex_lock(&mutex);
+      __atomic_store_n(&consumer_waiting,1,__ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&ring_head,__ATOMIC_SEQ_CST) == tail)
+        pthread_cond_wait(&cond_data,&mutex);
+      __atomic_store_n(&consumer_waiting,0,__ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&mutex);
+
+      trace_start = trace_begin();
+    }
+
+    size_t pos = tail % ring_size;
+
+    /* gap too small for a record header at the end of the ring */
+    if (ring_size - pos < sizeof(writer_rec_t))
+    {
+      tail += ring_size - pos;
+      __atomic_store_n(&ring_tail,tail,__ATOMIC_RELEASE);
+      continue;
+    }
+
+    const writer_rec_t * rec = (const writer_rec_t *)(ring+pos);
+    size_t total = (rec->stream == REC_PAD) ?
+                     rec->size : ALIGN8(sizeof(writer_rec_t)+rec->size);
+    long stream = rec->stream;
+
+    process_record(rec);
+
+    tail += total;
+    __atomic_store_n(&ring_tail,tail,__ATOMIC_RELEASE);
+
+    if (stream == REC_SYNC)
+    {
+      pthread_mutex_lock(&mutex);
+      sync_done++;
+      pthread_cond_broadcast(&cond_sync);
+      pthread_mutex_unlock(&mutex);
+    }
+    else if (stream == REC_STOP)
+    {
+      trace_end("Write", trace_start, NULL, 0);
+      break;
+    }
+  }
+
+  return NULL;
+}
+#endif
+
+/* wait until the ring can hold size more bytes */
+static void wait_space(size_t size)
+{
+#ifndef _WIN32
+  while (ring_size - (ring_head - __atomic_load_n(&ring_tail,__ATOMIC_ACQUIRE))
+         < size)
+    sched_yield();
+#else
+  (void)size;
+#endif
+}
+
+static void commit()
+{
+  writer_rec_t * rec = (writer_rec_t *)(ring + ring_head % ring_size);
+
+  if (!active)
+  {
+    /* no writer thread; process the record right away */
+    process_record(rec);
+    ring_head = ring_tail = 0;
+    return;
+  }
+
+#ifndef _WIN32
+  __atomic_store_n(&ring_head,ring_head+reserved,__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&consumer_waiting,__ATOMIC_SEQ_CST))
+  {
+    pthread_mutex_lock(&mutex);
+    pthread_cond_signal(&cond_data);
+    pthread_mutex_unlock(&mutex);
+  }
+#endif
+}
+
+static void * reserve(long stream, writer_cb_t cb, size_t size)
+{
+  size_t pos;
+  size_t total = ALIGN8(sizeof(writer_rec_t) + size);
+
+  /* make room for oversized records while the writer is idle. The ring is
+     empty, so head and tail map to the same position in the new ring */
+  if (2*total > ring_size)
+  {
+    writer_sync();
+    free(ring);
+    ring_size = 2*total;
+    ring = (char *)xmalloc(ring_size);
+  }
+
+  pos = ring_head % ring_size;
+  if (ring_size - pos < total)
+  {
+    size_t gap = ring_size - pos;
+
+    wait_space(gap);
+    if (gap >= sizeof(writer_rec_t))
+    {
+      writer_rec_t * pad = (writer_rec_t *)(ring+pos);
+      pad->stream = REC_PAD;
+      pad->cb = NULL;
+      pad->size = gap;
+    }
+    __atomic_store_n(&ring_head,ring_head+gap,__ATOMIC_SEQ_CST);
+    pos = 0;
+  }
+
+  wait_space(total);
+
+  writer_rec_t * rec = (writer_rec_t *)(ring+pos);
+  rec->stream = stream;
+  rec->cb = cb;
+  rec->size = size;
+  reserved = total;
+
+  return (void *)(rec+1);
+}
+
+static void stage_push()
+{
+  size_t i,n;
+
+  for (i = 0; i < stage_size; i += n)
+  {
+    n = MIN(stage_size - i, ring_size/4);
+    memcpy(reserve(stage_stream,NULL,n), stage+i, n);
+    commit();
+  }
+
+  stage_size = 0;
+}
+
+void writer_init()
+{
+  ring_size = WRITER_RING_SIZE;
+  ring = (char *)xmalloc(ring_size);
+  ring_head = ring_tail = 0;
+
+  stage_maxsize = WRITER_STAGE_SIZE;
+  stage = (char *)xmalloc(stage_maxsize);
+  stage_size = 0;
+  stage_stream = -1;
+
+#ifndef _WIN32
+  sync_requested = sync_done = 0;
+  if (pthread_create(&tid, NULL, consumer, NULL))
+    fatal("Unable to create writer thread");
+  active = 1;
+#endif
+}
+
+/* register an open file with the writer; the file must not be accessed
+   directly until writer_fini() is called */
+long writer_open(FILE * fp)
+{
+  stream_fp = (FILE **)xrealloc(stream_fp,
+                                (size_t)(stream_count+1)*sizeof(FILE *));
+  stream_offset = (long *)xrealloc(stream_offset,
+                                   (size_t)(stream_count+1)*sizeof(long));
+  stream_fp[stream_count] = fp;
+  stream_offset[stream_count] = ftell(fp);
+
+  return stream_count++;
+}
+
+void writer_write(long stream, const void * data, size_t size)
+{
+  if (stream != stage_stream || stage_size + size > stage_maxsize)
+  {
+    stage_push();
+    stage_stream = stream;
+  }
+
+  if (size > stage_maxsize)
+  {
+    memcpy(reserve(stream,NULL,size), data, size);
+    commit();
+    return;
+  }
+
+  memcpy(stage+stage_size, data, size);
+  stage_size += size;
+}
+
+void writer_printf(long stream, const char * format, ...)
+{
+  int len;
+  va_list argptr;
+
+  if (stream != stage_stream)
+  {
+    stage_push();
+    stage_stream = stream;
+  }
+
+  while (1)
+  {
+    va_start(argptr, format);
+    len = vsnprintf(stage+stage_size, stage_maxsize-stage_size, format, argptr);
+    va_end(argptr);
+
+    if (len < 0)
+      fatal("Unable to format output");
+
+    if (stage_size + (size_t)len < stage_maxsize)
+      break;
+
+    /* does not fit; push staged data or grow the stage */
+    if (stage_size)
+      stage_push();
+    else
+    {
+      stage_maxsize = (size_t)len + 1;
+      stage = (char *)xrealloc(stage, stage_maxsize);
+    }
+  }
+
+  stage_size += (size_t)len;
+}
+
+/* reserve size bytes for a record that is formatted on the writer thread by
+   calling cb; fill the returned buffer and then call writer_commit() */
+void * writer_reserve(long stream, writer_cb_t cb, size_t size)
+{
+  stage_push();
+  return reserve(stream,cb,size);
+}
+
+void writer_commit()
+{
+  commit();
+}
+
+/* wait until all records are written and all streams flushed. The offsets
+   returned by writer_tell() are then consistent with the files on disk */
+void writer_sync()
+{
+  stage_push();
+
+  reserve(REC_SYNC,NULL,0);
+  commit();
+
+#ifndef _WIN32
+  if (active)
+  {
+    ++sync_requested;
+    pthread_mutex_lock(&mutex);
+    while (sync_done < sync_requested)
+      pthread_cond_wait(&cond_sync,&mutex);
+    pthread_mutex_unlock(&mutex);
+  }
+#endif
+}
+
+long writer_tell(long stream)
+{
+  return stream_offset[stream];
+}
+
+void writer_fini()
+{
+  writer_sync();
+
+#ifndef _WIN32
+  if (active)
+  {
+    reserve(REC_STOP,NULL,0);
+    commit();
+    if (pthread_join(tid, NULL))
+      fatal("Unable to join writer thread");
+    active = 0;
+  }
+#endif
+
+  free(ring);
+  free(stage);
+  free(stream_fp);
+  free(stream_offset);
+  ring = stage = NULL;
+  stream_fp = NULL;
+  stream_offset = NULL;
+  stream_count = 0;
+  ring_size = stage_size = stage_maxsize = 0;
+  stage_stream = -1;
+}
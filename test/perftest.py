@@ -0,0 +1,303 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+# Department of Genetics, Evolution and Environment,
+# University College London, Gower Street, London WC1E 6BT, England
+
+# Performance regression suite. Synthetic datasets of increasing size are
+# simulated with 'bpp --simulate', and methods A00, A01, A10 and A11 are run
+# on each with a fixed seed. The MCMC steps per second, the time until the
+# first step and the peak memory reported by 'bpp --profile' are compared
+# against a baseline stored by a previous run with --update on the same
+# machine.
+#
+# Usage: perftest.py [--update] [--bin BPP] [--baseline FILE] [tier ...]
+
+from __future__ import print_function
+from subprocess import Popen, PIPE
+
+import sys, os, re, json, argparse
+
+# define path to BPP binary
+
+opt_bpp_bin = "$HOME/GIT/bpp/src/bpp"
+
+# working directory for datasets and outputs, and default baseline file
+
+opt_workdir  = os.path.join(os.path.dirname(os.path.abspath(__file__)), "perf")
+opt_baseline = os.path.join(opt_workdir, "baseline.json")
+
+# architecture and number of threads used for all runs
+
+opt_arch    = "AVX2"
+opt_threads = 1
+
+# each run is repeated and the best measurement is kept
+
+opt_repeats = 3
+
+# tolerances: steps/s may drop by at most opt_tol_speed, time to first step
+# and peak memory may increase by at most opt_tol_first (plus
+# opt_tol_first_abs seconds) and opt_tol_memory, respectively
+
+opt_tol_speed     = 0.15
+opt_tol_first     = 0.25
+opt_tol_first_abs = 0.10
+opt_tol_memory    = 0.10
+
+# dataset tiers: [name, loci, sites, sequences per species]
+
+opt_tiers = [
+   ["small",   10,  500, 4],
+   ["medium", 100,  500, 4],
+   ["large",  500, 1000, 8]
+]
+
+# methods: [name, speciesdelimitation, speciestree]
+
+opt_methods = [
+   ["A00", "0",       "0"],
+   ["A01", "0",       "1"],
+   ["A10", "1 0 2",   "0"],
+   ["A11", "1 0 2",   "1"]
+]
+
+opt_seed    = 12345
+opt_burnin  = 200
+opt_sampfreq = 2
+opt_nsample = 500
+
+
+##############################
+# DO NOT MODIFY FROM HERE ON #
+##############################
+
+colors = {
+   "default"  : "",
+   "-"        : "\x1b[00m",
+   "red"      : "\x1b[31;1m",
+   "green"    : "\x1b[32;1m",
+   "yellow"   : "\x1b[33;1m",
+   "cyan"     : "\x1b[36;1m",
+   "bluebg"   : "\x1b[44;1m",
+   "yellowbg" : "\x1b[43;2m"
+ }
+
+species = ["A", "B", "C", "D"]
+stree = "((A:0.002,B:0.002):0.002,(C:0.003,D:0.003):0.001);"
+guide = "((A,B),(C,D));"
+
+perf_re = re.compile(r"Performance: (\d+) steps in ([0-9.]+) seconds "
+                     r"\(([0-9.]+) steps/s\), first step after ([0-9.]+) "
+                     r"seconds, peak memory ([0-9.]+) MB")
+
+def has_colors(stream):
+  if not hasattr(stream,"isatty"):
+    return False
+  if not stream.isatty():
+    return False
+  try:
+    import curses
+    curses.setupterm()
+    return curses.tigetnum("colors") > 2
+  except:
+    return False
+
+def ansiprint(color,text,breakline=0):
+  if colors[color] and has_colors(sys.stdout):
+    sys.stdout.write(colors[color] + text + "\x1b[00m")
+  else:
+    sys.stdout.write(text)
+  if breakline:
+    sys.stdout.write("\n")
+  sys.stdout.flush()
+
+def run(args, cwd):
+  p = Popen(args, cwd=cwd, stdout=PIPE, stderr=PIPE)
+  out, err = p.communicate()
+  out = out.decode("utf-8", "replace")
+  if p.returncode:
+    sys.stderr.write(err.decode("utf-8", "replace"))
+    sys.exit("Command failed: " + " ".join(args))
+  return out
+
+def write_ctl(path, lines):
+  f = open(path, "w")
+  for l in lines:
+    f.write("%s = %s\n" % l)
+  f.close()
+
+def simulate(bpp, tier):
+  name, loci, sites, seqs = tier
+  d = os.path.join(opt_workdir, name)
+  if os.path.isfile(os.path.join(d, "sim.txt")):
+    return d
+  if not os.path.exists(d):
+    os.makedirs(d)
+
+  write_ctl(os.path.join(d, "sim.ctl"), [
+    ("seed",         opt_seed),
+    ("seqfile",      "sim.txt"),
+    ("Imapfile",     "sim.Imap.txt"),
+    ("species&tree", "%d %s\n%s\n%s" %
+                     (len(species), " ".join(species),
+                      " ".join([str(seqs)]*len(species)), stree)),
+    ("thetaprior",   "3 0.004"),
+    ("nloci",        loci),
+    ("nsites",       sites)])
+  run([bpp, "--simulate", "sim.ctl"], d)
+  return d
+
+def measure(bpp, tier, method, d):
+  name, loci, sites, seqs = tier
+  mname, delimit, sptree = method
+  ctl = mname + ".ctl"
+
+  write_ctl(os.path.join(d, ctl), [
+    ("seed",                opt_seed),
+    ("seqfile",             "sim.txt"),
+    ("Imapfile",            "sim.Imap.txt"),
+    ("outfile",             mname + ".out.txt"),
+    ("mcmcfile",            mname + ".mcmc.txt"),
+    ("speciesdelimitation", delimit),
+    ("speciestree",         sptree),
+    ("species&tree",        "%d %s\n%s\n%s" %
+                            (len(species), " ".join(species),
+                             " ".join([str(seqs)]*len(species)), guide)),
+    ("usedata",             1),
+    ("nloci",               loci),
+    ("cleandata",           0),
+    ("thetaprior",          "3 0.004 E"),
+    ("tauprior",            "3 0.004"),
+    ("finetune",            "1: 5 0.001 0.001 0.001 0.3 0.33 1.0"),
+    ("print",               "1 0 0 0"),
+    ("threads",             opt_threads),
+    ("burnin",              opt_burnin),
+    ("sampfreq",            opt_sampfreq),
+    ("nsample",             opt_nsample)])
+
+  best = None
+  for i in range(opt_repeats):
+    out = run([bpp, "--cfile", ctl, "--arch", opt_arch, "--profile"], d)
+    m = perf_re.search(out)
+    if not m:
+      sys.exit("No performance statistics in the output of " + ctl)
+    r = { "steps"        : int(m.group(1)),
+          "steps_per_sec": float(m.group(3)),
+          "first_step"   : float(m.group(4)),
+          "memory_mb"    : float(m.group(5)) }
+    if best is None:
+      best = r
+    else:
+      best["steps_per_sec"] = max(best["steps_per_sec"], r["steps_per_sec"])
+      best["first_step"] = min(best["first_step"], r["first_step"])
+      best["memory_mb"] = min(best["memory_mb"], r["memory_mb"])
+  return best
+
+# return a list of failed checks of r against baseline b
+def compare(r, b):
+  fails = []
+  if r["steps_per_sec"] < b["steps_per_sec"] * (1 - opt_tol_speed):
+    fails.append("steps/s")
+  if r["first_step"] > b["first_step"] * (1 + opt_tol_first) + opt_tol_first_abs:
+    fails.append("first step")
+  if r["memory_mb"] > b["memory_mb"] * (1 + opt_tol_memory):
+    fails.append("memory")
+  return fails
+
+def fmt(r, b, key, spec):
+  s = spec % r[key]
+  if b:
+    s += " (%+.0f%%)" % (100.0 * (r[key] - b[key]) / b[key] if b[key] else 0)
+  return s
+
+def runtests(bpp, tiers, baseline, update):
+  results = {}
+  failed = 0
+
+  ansiprint("yellowbg", "{:<16} {:<20} {:<20} {:<18} Result"
+             .format("Test", "Steps/s", "First step [s]", "Memory [MB]"), True)
+
+  for tier in tiers:
+    d = simulate(bpp, tier)
+    for method in opt_methods:
+      key = tier[0] + "-" + method[0]
+      r = measure(bpp, tier, method, d)
+      results[key] = r
+      b = baseline.get(key)
+
+      ansiprint("cyan", "{:<16} ".format(key))
+      ansiprint("-", "{:<20} {:<20} {:<18} ".format(
+                fmt(r, b, "steps_per_sec", "%.1f"),
+                fmt(r, b, "first_step", "%.3f"),
+                fmt(r, b, "memory_mb", "%.1f")))
+
+      if update:
+        ansiprint("yellow", "Stored", True)
+      elif not b:
+        ansiprint("yellow", "No baseline", True)
+      else:
+        fails = compare(r, b)
+        if fails:
+          failed += 1
+          ansiprint("red", "Fail (" + ", ".join(fails) + ")", True)
+        else:
+          ansiprint("green", "OK", True)
+
+  return results, failed
+
+if __name__ == "__main__":
+
+  parser = argparse.ArgumentParser(description="bpp performance regression "
+                                               "suite")
+  parser.add_argument("--update", action="store_true",
+                      help="store the measurements as the new baseline")
+  parser.add_argument("--bin", default=opt_bpp_bin, help="path to bpp")
+  parser.add_argument("--baseline", default=opt_baseline,
+                      help="baseline file (default: %(default)s)")
+  parser.add_argument("tiers", nargs="*",
+                      help="dataset tiers to run (default: all)")
+  args = parser.parse_args()
+
+  bpp = os.path.abspath(os.path.expandvars(args.bin))
+  if not os.path.isfile(bpp):
+    sys.exit("BPP binary not found. Please update variable 'opt_bpp_bin' "
+             "or use --bin")
+
+  tiers = [t for t in opt_tiers if not args.tiers or t[0] in args.tiers]
+  if not tiers:
+    sys.exit("Unknown tier(s): " + " ".join(args.tiers))
+
+  baseline = {}
+  if os.path.isfile(args.baseline):
+    f = open(args.baseline)
+    baseline = json.load(f)
+    f.close()
+
+  results, failed = runtests(bpp, tiers, baseline, args.update)
+
+  if args.update:
+    baseline.update(results)
+    f = open(args.baseline, "w")
+    json.dump(baseline, f, indent=2, sort_keys=True)
+    f.write("\n")
+    f.close()
+    print("Baseline written to " + args.baseline)
+  elif failed:
+    print("%d of %d tests exceeded the tolerances" % (failed, len(results)))
+    sys.exit(1)